@@ -0,0 +1,243 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ *
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This measures the speed of the selected AES implementation on a
+ * development machine, to compare the implementations offered by
+ * config.h. It first checks the implementation against the FIPS-197
+ * and RFC4493 test vectors.
+ *
+ * This is not an Arduino sketch. Compile it from the library directory
+ * once for every implementation, with something like:
+ *
+ *   gcc -std=gnu99 -O2 -fwrapv -Isrc -DUSE_TTABLE_AES -o aes-bench \
+ *       extras/aes-bench/aes-bench.c $(find src -name '*.c')
+ *
+ * Use -DUSE_ORIGINAL_AES or -DUSE_BITSLICE_AES for the others. For the
+ * Ideetron implementation, leave out the define and compile and link
+ * src/aes/ideetron/AES-128_V10.cpp with g++ as well.
+ *
+ * On x86-64, add -DUSE_AESNI_AES to any of these to use the AES-NI
+ * instructions (when the processor has them).
+ *
+ * On x86, the results are in TSC cycles as well as nanoseconds.
+ *
+ *******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <lmic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#if defined(USE_ORIGINAL_AES)
+#define AES_NAME "original"
+#elif defined(USE_TTABLE_AES)
+#define AES_NAME "ttable"
+#elif defined(USE_BITSLICE_AES)
+#define AES_NAME "bitslice"
+#else
+#define AES_NAME "ideetron"
+#endif
+
+#if defined(USE_AESNI_AES)
+u1_t lmic_aesni_available (void);
+#endif
+
+// Not used, but needed to link the rest of LMIC
+void os_getArtEui (u1_t* buf) { }
+void os_getDevEui (u1_t* buf) { }
+void os_getDevKey (u1_t* buf) { }
+void onEvent (ev_t ev) { }
+
+static const u1_t KEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+
+static int check () {
+    static const u1_t msg[40] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+    };
+    static const u1_t fips[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    static const u1_t fipskey[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    static const u1_t fipsout[16] = { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+    static const u4_t macs[] = { 0xbb1d6929, 0x070a16b4, 0xdfa66747 };
+    static const u1_t lens[] = { 0, 16, 40 };
+    aes_key_t key;
+    u1_t block[16];
+    int ok = 1;
+
+    lmic_aes_setkey(&key, fipskey);
+    memcpy(block, fips, 16);
+    lmic_aes_ecb(&key, block, 16);
+    ok &= memcmp(block, fipsout, 16) == 0;
+
+    lmic_aes_setkey(&key, KEY);
+    for (u1_t i = 0; i < sizeof(lens); i++) {
+        lmic_aes_cmac_t cmac;
+        lmic_aes_cmac_init(&cmac, &key);
+        lmic_aes_cmac_update(&cmac, msg, lens[i]);
+        ok &= lmic_aes_cmac_final(&cmac) == macs[i];
+    }
+    return ok;
+}
+
+struct sample {
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+static void start (struct sample* s) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#if defined(HAVE_TSC)
+    s->cycles = __rdtsc();
+#endif
+}
+
+// Print the time per operation, and the throughput when every
+// operation processes the given number of bytes
+static void report (const char* what, struct sample* s, unsigned count, unsigned bytes) {
+    struct sample end;
+    start(&end);
+    printf("  %-28s %8.1f ns", what, (double)(end.ns - s->ns) / count);
+#if defined(HAVE_TSC)
+    printf(" %8.0f cycles", (double)(end.cycles - s->cycles) / count);
+#endif
+    if (bytes)
+        printf(" %8.1f MB/s", (double)bytes * count * 1000 / (end.ns - s->ns));
+    printf("\n");
+}
+
+#define ROUNDS 200000
+#define BATCH  64
+
+int main () {
+    static u1_t frame[51], payload[242];
+    aes_key_t key;
+    struct sample s;
+    volatile u4_t sink = 0;
+
+#if defined(USE_AESNI_AES)
+    printf("AES implementation: %s\n", lmic_aesni_available() ? "AES-NI" : AES_NAME " (no AES-NI)");
+#else
+    printf("AES implementation: %s\n", AES_NAME);
+#endif
+    if (!check()) {
+        printf("Test vectors FAILED\n");
+        return 1;
+    }
+
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        lmic_aes_setkey(&key, KEY);
+        sink += key.rk[0];
+    }
+    report("key expansion", &s, ROUNDS, 0);
+
+    lmic_aes_setkey(&key, KEY);
+    lmic_aes_cmac_prepare(&key);
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS; i++)
+        lmic_aes_ecb(&key, frame, 16);
+    report("block", &s, ROUNDS, 16);
+
+    // A 51-byte uplink (38 bytes of payload), like buildDataFrame
+    // produces: CTR over the payload and CMAC over B0 and the frame.
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        u1_t ctrblock[16] = { 1 };
+        lmic_aes_ctr_t ctr;
+        lmic_aes_cmac_t cmac;
+        lmic_aes_ctr_init(&ctr, &key, ctrblock);
+        lmic_aes_ctr_crypt(&ctr, frame + 9, 38);
+        lmic_aes_cmac_init(&cmac, &key);
+        lmic_aes_cmac_update(&cmac, ctrblock, 16);
+        lmic_aes_cmac_update(&cmac, frame, 47);
+        sink += lmic_aes_cmac_final(&cmac);
+    }
+    report("51-byte frame (CTR + MIC)", &s, ROUNDS, 51);
+
+    // Throughput of the modes on their own, for a maximum size payload
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        u1_t ctrblock[16] = { 1 };
+        lmic_aes_ctr_t ctr;
+        lmic_aes_ctr_init(&ctr, &key, ctrblock);
+        lmic_aes_ctr_crypt(&ctr, payload, sizeof(payload));
+    }
+    report("CTR (242 bytes)", &s, ROUNDS, sizeof(payload));
+
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS; i++) {
+        lmic_aes_cmac_t cmac;
+        lmic_aes_cmac_init(&cmac, &key);
+        lmic_aes_cmac_update(&cmac, payload, sizeof(payload));
+        sink += lmic_aes_cmac_final(&cmac);
+    }
+    report("CMAC (242 bytes)", &s, ROUNDS, sizeof(payload));
+
+    // Many 51-byte frames with different keys, one by one and batched
+    // through LMIC_frameCiphers and LMIC_frameMics. Batching only helps
+    // with AES-NI or the bitsliced implementation; the table-based ones
+    // still encrypt block by block and come out about even.
+    static aes_key_t keys[BATCH];
+    static u1_t frames[BATCH][51];
+    lmic_frame_t batch[BATCH];
+    u4_t mics[BATCH];
+    for (unsigned i = 0; i < BATCH; i++) {
+        u1_t raw[16];
+        memcpy(raw, KEY, 16);
+        raw[0] = i;
+        lmic_aes_setkey(&keys[i], raw);
+        lmic_aes_cmac_prepare(&keys[i]);
+        batch[i].key = &keys[i];
+        batch[i].devaddr = i;
+        batch[i].seqno = 1;
+        batch[i].dndir = 0;
+    }
+
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS / BATCH; i++) {
+        for (unsigned j = 0; j < BATCH; j++) {
+            u1_t ctrblock[16] = { 1 };
+            lmic_aes_ctr_t ctr;
+            lmic_aes_cmac_t cmac;
+            lmic_aes_ctr_init(&ctr, &keys[j], ctrblock);
+            lmic_aes_ctr_crypt(&ctr, frames[j] + 9, 38);
+            lmic_aes_cmac_init(&cmac, &keys[j]);
+            lmic_aes_cmac_update(&cmac, ctrblock, 16);
+            lmic_aes_cmac_update(&cmac, frames[j], 47);
+            sink += lmic_aes_cmac_final(&cmac);
+        }
+    }
+    report("51-byte frames, one by one", &s, ROUNDS / BATCH * BATCH, 51);
+
+    start(&s);
+    for (unsigned i = 0; i < ROUNDS / BATCH; i++) {
+        for (unsigned j = 0; j < BATCH; j++) {
+            batch[j].buf = frames[j] + 9;
+            batch[j].len = 38;
+        }
+        LMIC_frameCiphers(batch, BATCH);
+        for (unsigned j = 0; j < BATCH; j++) {
+            batch[j].buf = frames[j];
+            batch[j].len = 47;
+        }
+        LMIC_frameMics(batch, mics, BATCH);
+        sink += mics[0];
+    }
+    report("51-byte frames, batched", &s, ROUNDS / BATCH * BATCH, 51);
+    (void)sink;
+    return 0;
+}
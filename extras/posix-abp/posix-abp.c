@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Thomas Telkamp and Matthijs Kooijman
+ *
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This is the ttn-abp example, ported to run as a normal process on a
+ * Linux (or other POSIX) host using the POSIX HAL. Instead of a real
+ * radio, it talks to the simulated radio from hal/radio_sim.h, so
+ * every uplink is printed instead of transmitted, and both receive
+ * windows time out.
+ *
+ * This is not an Arduino sketch. Compile it from the library directory
+ * with something like:
+ *
+ *   gcc -std=gnu99 -O2 -fwrapv -Isrc -o posix-abp extras/posix-abp/posix-abp.c \
+ *       $(find src -name '*.c')
+ *
+ * The Ideetron AES implementation is C++, so either select another
+ * implementation (e.g. add -DUSE_TTABLE_AES), or compile and link
+ * src/aes/ideetron/AES-128_V10.cpp with g++ as well. On x86-64, adding
+ * -DUSE_AESNI_AES makes it use the AES-NI instructions when available.
+ *
+ * Run it with the number of packets to send as an argument, it exits
+ * after the last one completed (or runs forever without an argument).
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <lmic.h>
+#include <hal/hal.h>
+
+// LoRaWAN NwkSKey, network session key
+static const u1_t NWKSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+
+// LoRaWAN AppSKey, application session key
+static const u1_t APPSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+
+// LoRaWAN end-device address (DevAddr)
+static const u4_t DEVADDR = 0x03FF0001;
+
+// These callbacks are only used in over-the-air activation, so they are
+// left empty here.
+void os_getArtEui (u1_t* buf) { }
+void os_getDevEui (u1_t* buf) { }
+void os_getDevKey (u1_t* buf) { }
+
+static uint8_t mydata[] = "Hello, world!";
+static osjob_t sendjob;
+
+// Schedule TX every this many seconds (might become longer due to duty
+// cycle limitations).
+static const unsigned TX_INTERVAL = 10;
+
+// Number of packets still to send, or -1 to keep sending
+static int remaining = -1;
+
+static void do_send (osjob_t* j);
+
+static void printPower () {
+    struct hal_posix_power power;
+    hal_posix_getPower(&power);
+    printf("Asleep %.1f s of %.1f s (%.1f%%)\n",
+           (double)power.asleep / OSTICKS_PER_SEC,
+           (double)power.total / OSTICKS_PER_SEC,
+           power.total ? 100.0 * power.asleep / power.total : 0.0);
+}
+
+// Called by the simulated radio for every transmitted frame
+static void ontx (struct radio_sim* radio, const struct radio_sim_frame* frame) {
+    printf("%lu: radio: TX %d bytes at %lu Hz, SF%d, airtime %lu us\n",
+           (unsigned long)frame->start, frame->len, (unsigned long)frame->freq,
+           getSf(frame->rps) == FSK ? 0 : getSf(frame->rps) + 6,
+           (unsigned long)osticks2us(frame->end - frame->start));
+}
+
+void onEvent (ev_t ev) {
+    printf("%lu: ", (unsigned long)os_getTime());
+    switch(ev) {
+        case EV_JOINING:
+            printf("EV_JOINING\n");
+            break;
+        case EV_JOINED:
+            printf("EV_JOINED\n");
+            break;
+        case EV_JOIN_FAILED:
+            printf("EV_JOIN_FAILED\n");
+            break;
+        case EV_TXCOMPLETE:
+            printf("EV_TXCOMPLETE (includes waiting for RX windows)\n");
+            if (LMIC.txrxFlags & TXRX_ACK)
+                printf("Received ack\n");
+            if (LMIC.dataLen)
+                printf("Received %d bytes of payload\n", LMIC.dataLen);
+            printPower();
+            if (remaining > 0 && --remaining == 0)
+                exit(0);
+            // Schedule next transmission
+            os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(TX_INTERVAL), do_send);
+            break;
+        case EV_RESET:
+            printf("EV_RESET\n");
+            break;
+        case EV_RXCOMPLETE:
+            printf("EV_RXCOMPLETE\n");
+            break;
+        case EV_LINK_DEAD:
+            printf("EV_LINK_DEAD\n");
+            break;
+        case EV_LINK_ALIVE:
+            printf("EV_LINK_ALIVE\n");
+            break;
+        default:
+            printf("Event %d\n", ev);
+            break;
+    }
+}
+
+static void do_send (osjob_t* j) {
+    // Check if there is not a current TX/RX job running
+    if (LMIC.opmode & OP_TXRXPEND) {
+        printf("OP_TXRXPEND, not sending\n");
+    } else {
+        // Prepare upstream data transmission at the next possible time.
+        LMIC_setTxData2(1, mydata, sizeof(mydata)-1, 0);
+        printf("Packet queued\n");
+    }
+    // Next TX is scheduled after TX_COMPLETE event.
+}
+
+int main (int argc, char** argv) {
+    if (argc > 1)
+        remaining = atoi(argv[1]);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Starting\n");
+
+    // LMIC init
+    os_init();
+    hal_posix_radio()->ontx = ontx;
+    // Reset the MAC state. Session and pending data transfers will be discarded.
+    LMIC_reset();
+
+    // Set static session parameters.
+    LMIC_setSession (0x1, DEVADDR, (xref2u1_t)NWKSKEY, (xref2u1_t)APPSKEY);
+
+    #if defined(CFG_eu868)
+    // Set up the channels used by the Things Network (see ttn-abp)
+    LMIC_setupChannel(0, 868100000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(1, 868300000, DR_RANGE_MAP(DR_SF12, DR_SF7B), BAND_CENTI);      // g-band
+    LMIC_setupChannel(2, 868500000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(3, 867100000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(4, 867300000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(5, 867500000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(6, 867700000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(7, 867900000, DR_RANGE_MAP(DR_SF12, DR_SF7),  BAND_CENTI);      // g-band
+    LMIC_setupChannel(8, 868800000, DR_RANGE_MAP(DR_FSK,  DR_FSK),  BAND_MILLI);      // g2-band
+    #elif defined(CFG_us915)
+    LMIC_selectSubBand(1);
+    #endif
+
+    // Disable link check validation
+    LMIC_setLinkCheckMode(0);
+
+    // TTN uses SF9 for its RX2 window.
+    LMIC.dn2Dr = DR_SF9;
+
+    // Set data rate and transmit power for uplink
+    LMIC_setDrTxpow(DR_SF7,14);
+
+    // Start job
+    do_send(&sendjob);
+
+    while (1)
+        os_runloop_once();
+}
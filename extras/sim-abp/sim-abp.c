@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ *
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This runs many ABP nodes, each sending a small unconfirmed uplink at a
+ * fixed average interval, against a single gateway using the
+ * simulation HAL. Time is virtual, so a day of traffic takes only as
+ * long as it takes to run the LMIC code for all those uplinks. At the
+ * end, it prints how many uplinks the gateway received, and how many
+ * were lost to collisions.
+ *
+ * This is not an Arduino sketch. Compile it from the library directory
+ * with something like:
+ *
+ *   gcc -std=gnu99 -O2 -fwrapv -DLMIC_SIMULATION -Isrc -o sim-abp \
+ *       extras/sim-abp/sim-abp.c $(find src -name '*.c')
+ *
+ * (see extras/posix-abp for a note about the AES implementation) and
+ * run it as:
+ *
+ *   ./sim-abp [nodes] [hours] [interval in seconds] [datarate]
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <lmic.h>
+#include <hal/hal.h>
+
+// All nodes share the same session keys, only the DevAddr differs
+static const u1_t NWKSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u1_t APPSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u4_t DEVADDR_BASE = 0x03FF0000;
+
+// These callbacks are only used in over-the-air activation.
+void os_getArtEui (u1_t* buf) { }
+void os_getDevEui (u1_t* buf) { }
+void os_getDevKey (u1_t* buf) { }
+
+struct app_node {
+    struct sim_node sim;  // must be first
+    osjob_t         sendjob;
+};
+
+static uint8_t mydata[] = "Hello, world!";
+static unsigned interval = 600;
+static dr_t datarate = DR_SF7;
+
+static struct app_node* current () {
+    return (struct app_node*)sim_current();
+}
+
+// Uniformly random delay between 0.5 and 1.5 times the interval, so
+// nodes do not stay in lockstep.
+static ostime_t nextDelay () {
+    return sec2osticks(interval) / 2 + (ostime_t)(((int64_t)sec2osticks(interval) * os_getRndU2()) >> 16);
+}
+
+static void do_send (osjob_t* j) {
+    if (!(LMIC.opmode & OP_TXRXPEND))
+        LMIC_setTxData2(1, mydata, sizeof(mydata)-1, 0);
+}
+
+void onEvent (ev_t ev) {
+    if (ev == EV_TXCOMPLETE)
+        os_setTimedCallback(&current()->sendjob, os_getTime() + nextDelay(), do_send);
+}
+
+int main (int argc, char** argv) {
+    u4_t count = argc > 1 ? atoi(argv[1]) : 100;
+    u4_t hours = argc > 2 ? atoi(argv[2]) : 24;
+    if (argc > 3) interval = atoi(argv[3]);
+    if (argc > 4) datarate = atoi(argv[4]);
+
+    struct app_node* nodes = (struct app_node*)calloc(count, sizeof(*nodes));
+    if (!nodes) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    clock_t begin = clock();
+    for (u4_t i = 0; i < count; i++) {
+        sim_node_init(&nodes[i].sim, i);
+        LMIC_reset();
+        LMIC_setSession(0x1, DEVADDR_BASE + i, (xref2u1_t)NWKSKEY, (xref2u1_t)APPSKEY);
+        LMIC_setLinkCheckMode(0);
+        LMIC.dn2Dr = DR_SF9;
+        LMIC_setDrTxpow(datarate, 14);
+        // Start at a random moment within the first interval
+        os_setTimedCallback(&nodes[i].sendjob, os_getTime() + nextDelay() - sec2osticks(interval) / 2, do_send);
+    }
+
+    sim_run((simtime_t)hours * 3600 * OSTICKS_PER_SEC);
+
+    struct sim_stats stats;
+    sim_getStats(&stats);
+    double secs = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    printf("nodes:      %lu\n", (unsigned long)count);
+    printf("simulated:  %lu hours\n", (unsigned long)hours);
+    printf("uplinks:    %lu\n", (unsigned long)stats.uplinks);
+    printf("delivered:  %lu (%.2f%%)\n", (unsigned long)stats.delivered,
+           stats.uplinks ? 100.0 * stats.delivered / stats.uplinks : 0.0);
+    printf("collided:   %lu\n", (unsigned long)stats.collided);
+    printf("airtime:    %.1f s\n", (double)stats.airtime / OSTICKS_PER_SEC);
+    printf("asleep:     %.3f%%\n", 100.0 * stats.asleep / ((double)count * hours * 3600 * OSTICKS_PER_SEC));
+    printf("runtime:    %.2f s\n", secs);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,254 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ *
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This runs a few class C ABP nodes against a gateway that sends them
+ * downlinks on RX2 (at SF9) at random moments, using the simulation
+ * HAL. Each node sends an unconfirmed uplink every minute, which the
+ * gateway can answer in RX2 as well, so downlinks also arrive around
+ * the uplinks: while transmitting, in the continuous rx between RX1 and
+ * RX2, and in the RX2 window itself. Like a real gateway, it holds back
+ * class C downlinks that would still be on the air when a reply is due.
+ *
+ * At the end, it prints how many class C downlinks and RX2 replies were
+ * sent and received and, with LMIC_AUTO_CLOCK_ERROR, the clock error
+ * estimate of every node. It exits with status 1 when too few class C
+ * downlinks or replies were received, or when the clock error estimate
+ * grew even though the simulated clocks are perfect.
+ *
+ * This is not an Arduino sketch. Compile it from the library directory
+ * with something like:
+ *
+ *   gcc -std=gnu99 -O2 -fwrapv -DLMIC_SIMULATION -DLMIC_CLASSC -Isrc \
+ *       -o sim-classc extras/sim-classc/sim-classc.c $(find src -name '*.c')
+ *
+ * adding -DLMIC_AUTO_CLOCK_ERROR to check the clock error estimate, and
+ * run it as:
+ *
+ *   ./sim-classc [nodes] [minutes] [reply]
+ *
+ * where reply is 1 (the default) to answer every uplink in RX2, or 0
+ * to only send class C downlinks.
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <lmic.h>
+#include <hal/hal.h>
+
+#if !defined(LMIC_CLASSC)
+#error "Compile with -DLMIC_CLASSC"
+#endif
+
+// All nodes share the same session keys, only the DevAddr differs
+static const u1_t NWKSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u1_t APPSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u4_t DEVADDR_BASE = 0x03FF0000;
+
+// Payload of class C downlinks and of RX2 replies
+#define PAYLOAD_CLASSC 0xC0
+#define PAYLOAD_REPLY  0x2E
+
+// Pass criteria: the share of class C downlinks received (the others
+// arrive while the node is busy with an uplink), the share of replies
+// received, and the highest clock error estimate (in MAX_CLOCK_ERROR
+// units) that a perfect clock may end up with.
+#define MIN_RECEIVED_PERCENT 80
+#define MIN_RX2_PERCENT      95
+#define MAX_CLOCK_ERROR_SEEN 100
+
+// The simulated radio only holds one frame, so the gateway offers a
+// reply this long before it starts, and the next class C downlink this
+// long after it ended.
+#define REPLY_LEAD ms2osticks(50)
+
+// These callbacks are only used in over-the-air activation.
+void os_getArtEui (u1_t* buf) { }
+void os_getDevEui (u1_t* buf) { }
+void os_getDevKey (u1_t* buf) { }
+
+struct app_node {
+    struct sim_node sim;      // must be first
+    osjob_t         sendjob;
+    osjob_t         dnjob;    // sends the next class C downlink
+    osjob_t         replyjob; // offers the next RX2 reply
+    ostime_t        replyBeg; // when the last reply starts
+    ostime_t        replyEnd; // ... and ends
+    u4_t            dnfcnt;   // next downlink frame counter
+    u4_t            sent;     // class C downlinks sent
+    u4_t            received; // ... and received
+    u4_t            replies;  // RX2 replies sent
+    u4_t            rx2;      // ... and received in RX2
+};
+
+static uint8_t mydata[] = "Hello, world!";
+static int reply = 1;
+static simtime_t until;
+static aes_key_t nwkskey, appskey;
+
+static struct app_node* current () {
+    return (struct app_node*)sim_current();
+}
+
+static void do_send (osjob_t* j) {
+    if (!(LMIC.opmode & OP_TXRXPEND))
+        LMIC_setTxData2(1, mydata, sizeof(mydata)-1, 0);
+}
+
+// Airtime of the downlinks below
+static ostime_t downlinkAirTime (struct app_node* node) {
+    return calcAirTime(dndr2rps(node->sim.ctx.lmic.dn2Dr), OFF_DAT_OPTS + 6);
+}
+
+// Offer a downlink with a single payload byte on FPort 1 in RX2,
+// starting at the given time.
+static void downlink (struct app_node* node, u1_t payload, u4_t start) {
+    const struct lmic_t* lmic = &node->sim.ctx.lmic;
+    struct radio_sim_frame dn = { 0 };
+    dn.freq = lmic->dn2Freq;
+    dn.rps = dndr2rps(lmic->dn2Dr);
+    dn.start = start;
+    dn.snr = 5;
+    dn.rssi = -50;
+
+    u4_t devaddr = DEVADDR_BASE + node->sim.id;
+    u1_t* b = dn.data;
+    b[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+    os_wlsbf4(b + OFF_DAT_ADDR, devaddr);
+    b[OFF_DAT_FCT] = 0;
+    os_wlsbf2(b + OFF_DAT_SEQNO, node->dnfcnt);
+    b[OFF_DAT_OPTS] = 1;
+    b[OFF_DAT_OPTS+1] = payload;
+    lmic_frame_t frame = { &appskey, devaddr, node->dnfcnt, 1, b + OFF_DAT_OPTS + 1, 1 };
+    LMIC_frameCiphers(&frame, 1);
+    frame.key = &nwkskey;
+    frame.buf = b;
+    frame.len = OFF_DAT_OPTS + 2;
+    u4_t mic;
+    LMIC_frameMics(&frame, &mic, 1);
+    os_wmsbf4(b + frame.len, mic);
+    dn.len = frame.len + 4;
+    dn.end = dn.start + downlinkAirTime(node);
+
+    node->dnfcnt++;
+    sim_downlink(&node->sim, &dn);
+}
+
+// The gateway's class C downlinks, every 3 to 12 seconds. They are
+// timed by a job on the node's own scheduler, which is as good as any
+// timer in the simulation.
+static void do_downlink (osjob_t* j) {
+    struct app_node* node = current();
+    if (sim_time() + sec2osticks(10) > until)
+        return;
+    ostime_t start = os_getTime() + ms2osticks(5);
+    if (start + downlinkAirTime(node) - (node->replyBeg - REPLY_LEAD) > 0
+        && start - (node->replyEnd + REPLY_LEAD) < 0) {
+        // Wait until the node received the reply
+        os_setTimedCallback(j, node->replyEnd + REPLY_LEAD, do_downlink);
+        return;
+    }
+    downlink(node, PAYLOAD_CLASSC, start);
+    node->sent++;
+    os_setTimedCallback(j, os_getTime() + ms2osticks(3000 + os_getRndU2() % 9000), do_downlink);
+}
+
+static void do_reply (osjob_t* j) {
+    struct app_node* node = current();
+    downlink(node, PAYLOAD_REPLY, node->replyBeg);
+    node->replies++;
+}
+
+// Answer an uplink right at the start of RX2. The gateway receives the
+// uplink before the node handles the end of its transmission, so the
+// job queued here is picked up in time.
+static void onUplink (struct sim_node* sim, const struct radio_sim_frame* up) {
+    struct app_node* node = (struct app_node*)sim;
+    if (!reply)
+        return;
+    node->replyBeg = up->end + sec2osticks(sim->ctx.lmic.rxDelay + DELAY_EXTDNW2);
+    node->replyEnd = node->replyBeg + downlinkAirTime(node);
+    os_setTimedCallback_ctx(&sim->ctx, &node->replyjob, node->replyBeg - REPLY_LEAD, do_reply);
+}
+
+void onEvent (ev_t ev) {
+    struct app_node* node = current();
+    if (ev != EV_RXCOMPLETE && ev != EV_TXCOMPLETE)
+        return;
+    if (LMIC.dataLen == 1) {
+        u1_t payload = LMIC.frame[LMIC.dataBeg];
+        if (payload == PAYLOAD_CLASSC && (LMIC.txrxFlags & TXRX_DNC))
+            node->received++;
+        if (payload == PAYLOAD_REPLY && (LMIC.txrxFlags & TXRX_DNW2))
+            node->rx2++;
+    }
+    if (ev == EV_TXCOMPLETE)
+        os_setTimedCallback(&node->sendjob, os_getTime() + sec2osticks(60), do_send);
+}
+
+int main (int argc, char** argv) {
+    u4_t count = argc > 1 ? atoi(argv[1]) : 4;
+    simtime_t minutes = argc > 2 ? atoi(argv[2]) : 60;
+    if (argc > 3) reply = atoi(argv[3]);
+
+    struct app_node* nodes = (struct app_node*)calloc(count, sizeof(*nodes));
+    if (!nodes) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    lmic_aes_setkey(&nwkskey, NWKSKEY);
+    lmic_aes_cmac_prepare(&nwkskey);
+    lmic_aes_setkey(&appskey, APPSKEY);
+    sim_setUplinkCallback(onUplink);
+    until = minutes * 60 * OSTICKS_PER_SEC;
+    for (u4_t i = 0; i < count; i++) {
+        sim_node_init(&nodes[i].sim, i);
+        LMIC_reset();
+        LMIC_setSession(0x1, DEVADDR_BASE + i, (xref2u1_t)NWKSKEY, (xref2u1_t)APPSKEY);
+        LMIC_setLinkCheckMode(0);
+        LMIC.dn2Dr = DR_SF9;
+        LMIC_setDrTxpow(DR_SF7, 14);
+        LMIC_setClassC(1);
+        os_setTimedCallback(&nodes[i].sendjob, os_getTime() + ms2osticks(100 + i * 3000), do_send);
+        os_setTimedCallback(&nodes[i].dnjob, os_getTime() + ms2osticks(1000 + i * 777), do_downlink);
+    }
+
+    sim_run(until);
+
+    u4_t sent = 0, received = 0, replies = 0, rx2 = 0;
+    int ok = 1;
+    for (u4_t i = 0; i < count; i++) {
+        struct app_node* n = &nodes[i];
+        sent += n->sent;
+        received += n->received;
+        replies += n->replies;
+        rx2 += n->rx2;
+        printf("node %lu: class C %lu/%lu, RX2 %lu/%lu",
+               (unsigned long)i, (unsigned long)n->received, (unsigned long)n->sent,
+               (unsigned long)n->rx2, (unsigned long)n->replies);
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+        u2_t clockError = n->sim.ctx.lmic.clockError;
+        printf(" clockError %u", clockError);
+        if (clockError > MAX_CLOCK_ERROR_SEEN)
+            ok = 0;
+#endif
+        printf("\n");
+    }
+    printf("class C:    %lu of %lu received (%.2f%%)\n", (unsigned long)received,
+           (unsigned long)sent, sent ? 100.0 * received / sent : 0.0);
+    printf("RX2:        %lu of %lu received\n", (unsigned long)rx2, (unsigned long)replies);
+    if (received * 100 < sent * MIN_RECEIVED_PERCENT)
+        ok = 0;
+    if (rx2 * 100 < replies * MIN_RX2_PERCENT)
+        ok = 0;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    free(nodes);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ *
+ * Permission is hereby granted, free of charge, to anyone
+ * obtaining a copy of this document and accompanying files,
+ * to do whatever they want with them without any restriction,
+ * including, but not limited to, copying, modification and redistribution.
+ * NO WARRANTY OF ANY KIND IS PROVIDED.
+ *
+ * This runs a few ABP nodes against a gateway that answers every uplink
+ * it receives with a downlink, exactly at the start of RX1 or RX2, using
+ * the simulation HAL. It exercises the receive side of LMIC: opening the
+ * rx windows in time, decoding the frames and, depending on the
+ * configuration, the RX timer (LMIC_RX_TIMER), the learned radio timing
+ * (LMIC_CALIBRATE) and the clock error estimate (LMIC_AUTO_CLOCK_ERROR).
+ * At the end, it prints how many downlinks were sent and received, and
+ * the state of the timing estimates for every node. Since the simulated
+ * clocks are perfect, the estimated clock error should stay small.
+ *
+ * This is not an Arduino sketch. Compile it from the library directory
+ * with something like:
+ *
+ *   gcc -std=gnu99 -O2 -fwrapv -DLMIC_SIMULATION -Isrc -o sim-downlink \
+ *       extras/sim-downlink/sim-downlink.c $(find src -name '*.c')
+ *
+ * adding -DLMIC_RX_TIMER, -DLMIC_CALIBRATE or -DLMIC_AUTO_CLOCK_ERROR
+ * for the corresponding features, and run it as:
+ *
+ *   ./sim-downlink [nodes] [minutes] [window] [datarate]
+ *
+ * where window is 1 or 2 to answer in that window only, or 0 (the
+ * default) to alternate between them.
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <lmic.h>
+#include <hal/hal.h>
+
+// All nodes share the same session keys, only the DevAddr differs
+static const u1_t NWKSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u1_t APPSKEY[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+static const u4_t DEVADDR_BASE = 0x03FF0000;
+
+// These callbacks are only used in over-the-air activation.
+void os_getArtEui (u1_t* buf) { }
+void os_getDevEui (u1_t* buf) { }
+void os_getDevKey (u1_t* buf) { }
+
+struct app_node {
+    struct sim_node sim;  // must be first
+    osjob_t         sendjob;
+    u4_t            dnfcnt;     // next downlink frame counter
+    u4_t            answered;   // uplinks answered by the gateway
+    u4_t            received;   // downlinks received by LMIC
+    u4_t            rx[2];      // of which in RX1 and RX2
+};
+
+static uint8_t mydata[] = "Hello, world!";
+static unsigned interval = 30;
+static unsigned window = 0;
+static simtime_t until;
+static aes_key_t nwkskey, appskey;
+
+static struct app_node* current () {
+    return (struct app_node*)sim_current();
+}
+
+static void do_send (osjob_t* j) {
+    // Stop in time for the last downlink to arrive before the end
+    if (sim_time() + sec2osticks(10) > until)
+        return;
+    if (!(LMIC.opmode & OP_TXRXPEND))
+        LMIC_setTxData2(1, mydata, sizeof(mydata)-1, 0);
+}
+
+void onEvent (ev_t ev) {
+    if (ev != EV_TXCOMPLETE)
+        return;
+    struct app_node* node = current();
+    if (LMIC.dataLen == 2 && LMIC.frame[LMIC.dataBeg] == 0x5A) {
+        node->received++;
+        node->rx[(LMIC.txrxFlags & TXRX_DNW2) ? 1 : 0]++;
+    }
+    // Add some jitter, so the nodes do not stay in lockstep
+    os_setTimedCallback(&node->sendjob, os_getTime() + sec2osticks(interval) + (os_getRndU2() & 0x3FFF), do_send);
+}
+
+// Answer an uplink with an unconfirmed downlink on FPort 1, carrying
+// two bytes, starting right when the rx window opens.
+static void onUplink (struct sim_node* sim, const struct radio_sim_frame* up) {
+    struct app_node* node = (struct app_node*)sim;
+    const struct lmic_t* lmic = &sim->ctx.lmic;
+    u1_t rx2 = window ? window == 2 : node->answered & 1;
+    struct radio_sim_frame dn = { 0 };
+    if (rx2) {
+        dn.freq = lmic->dn2Freq;
+        dn.rps = dndr2rps(lmic->dn2Dr);
+        dn.start = up->end + sec2osticks(lmic->rxDelay + DELAY_EXTDNW2);
+    } else {
+        dn.freq = up->freq;
+        dn.rps = setNocrc(up->rps, 1);
+        dn.start = up->end + sec2osticks(lmic->rxDelay);
+    }
+    dn.snr = 5;
+    dn.rssi = -50;
+
+    u4_t devaddr = DEVADDR_BASE + sim->id;
+    u1_t* b = dn.data;
+    b[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+    os_wlsbf4(b + OFF_DAT_ADDR, devaddr);
+    b[OFF_DAT_FCT] = 0;
+    os_wlsbf2(b + OFF_DAT_SEQNO, node->dnfcnt);
+    b[OFF_DAT_OPTS] = 1;
+    b[OFF_DAT_OPTS+1] = 0x5A;
+    b[OFF_DAT_OPTS+2] = 0xA5;
+    lmic_frame_t frame = { &appskey, devaddr, node->dnfcnt, 1, b + OFF_DAT_OPTS + 1, 2 };
+    LMIC_frameCiphers(&frame, 1);
+    frame.key = &nwkskey;
+    frame.buf = b;
+    frame.len = OFF_DAT_OPTS + 3;
+    u4_t mic;
+    LMIC_frameMics(&frame, &mic, 1);
+    os_wmsbf4(b + frame.len, mic);
+    dn.len = frame.len + 4;
+    dn.end = dn.start + calcAirTime(dn.rps, dn.len);
+
+    node->dnfcnt++;
+    node->answered++;
+    sim_downlink(sim, &dn);
+}
+
+int main (int argc, char** argv) {
+    u4_t count = argc > 1 ? atoi(argv[1]) : 4;
+    simtime_t minutes = argc > 2 ? atoi(argv[2]) : 60;
+    if (argc > 3) window = atoi(argv[3]);
+    dr_t datarate = argc > 4 ? atoi(argv[4]) : DR_SF7;
+
+    struct app_node* nodes = (struct app_node*)calloc(count, sizeof(*nodes));
+    if (!nodes) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    lmic_aes_setkey(&nwkskey, NWKSKEY);
+    lmic_aes_cmac_prepare(&nwkskey);
+    lmic_aes_setkey(&appskey, APPSKEY);
+    sim_setUplinkCallback(onUplink);
+    for (u4_t i = 0; i < count; i++) {
+        sim_node_init(&nodes[i].sim, i);
+        LMIC_reset();
+        LMIC_setSession(0x1, DEVADDR_BASE + i, (xref2u1_t)NWKSKEY, (xref2u1_t)APPSKEY);
+        LMIC_setLinkCheckMode(0);
+        LMIC.dn2Dr = DR_SF9;
+        LMIC_setDrTxpow(datarate, 14);
+        os_setTimedCallback(&nodes[i].sendjob, os_getTime() + ms2osticks(100 + i * 3000), do_send);
+    }
+
+    until = minutes * 60 * OSTICKS_PER_SEC;
+    sim_run(until);
+
+    u4_t answered = 0, received = 0;
+    for (u4_t i = 0; i < count; i++) {
+        struct app_node* n = &nodes[i];
+        answered += n->answered;
+        received += n->received;
+        printf("node %lu: answered %lu received %lu (rx1 %lu rx2 %lu)",
+               (unsigned long)i, (unsigned long)n->answered, (unsigned long)n->received,
+               (unsigned long)n->rx[0], (unsigned long)n->rx[1]);
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+        printf(" clockError %u", n->sim.ctx.lmic.clockError);
+#endif
+        printf("\n");
+#if defined(LMIC_CALIBRATE)
+        struct lmic_calib_t calib;
+        LMIC_getCalibration_ctx(&n->sim.ctx, &calib);
+        printf("  rxdone BW125 SF7-SF12:");
+        for (u1_t sf = 0; sf <= SF12 - SF7; sf++)
+            printf(" %u", calib.rxdone[sf][BW125]);
+        printf("\n");
+#endif
+    }
+    printf("downlinks:  %lu\n", (unsigned long)answered);
+    printf("received:   %lu (%.2f%%)\n", (unsigned long)received,
+           answered ? 100.0 * received / answered : 0.0);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * AES-128 encryption using the x86-64 AES-NI instructions, for builds
+ * that run on a host (POSIX or simulation HAL). Whether the processor
+ * supports these is checked at runtime, aes/other.c uses this code
+ * when it does and the selected portable implementation otherwise.
+ *
+ * The round keys are stored as 11 consecutive 16-byte blocks, in the
+ * same byte order as the key itself. Since aes/other.c decides between
+ * this and the portable code the same way for every key, the layout
+ * never gets mixed up.
+ *
+ * The functions are compiled for the AES instructions through the
+ * target attribute, so no special compiler flags are needed.
+ *******************************************************************************/
+
+#include "../lmic/oslmic.h"
+
+#if defined(USE_AESNI_AES)
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+#define AESNI __attribute__((target("aes,sse2")))
+
+u1_t lmic_aesni_available (void) {
+    // -1 until checked. Checking twice does no harm, so this needs no
+    // locking.
+    static s1_t available = -1;
+    if (available < 0) {
+        unsigned a, b, c, d;
+        available = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES);
+    }
+    return available;
+}
+
+// Calculate the next round key from the previous one and the output of
+// aeskeygenassist on it (which applies RotWord, SubWord and Rcon).
+static inline AESNI __m128i expand_step (__m128i key, __m128i gen) {
+    gen = _mm_shuffle_epi32(gen, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, gen);
+}
+
+// The round constant must be an immediate, hence the macro
+#define EXPAND(i, rcon) \
+    rk[i] = expand_step(rk[i-1], _mm_aeskeygenassist_si128(rk[i-1], rcon))
+
+AESNI void lmic_aesni_expandkey (u1_t* roundkeys, const u1_t* key) {
+    __m128i rk[11];
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    EXPAND(1, 0x01);
+    EXPAND(2, 0x02);
+    EXPAND(3, 0x04);
+    EXPAND(4, 0x08);
+    EXPAND(5, 0x10);
+    EXPAND(6, 0x20);
+    EXPAND(7, 0x40);
+    EXPAND(8, 0x80);
+    EXPAND(9, 0x1b);
+    EXPAND(10, 0x36);
+    for (u1_t i = 0; i < 11; i++)
+        _mm_storeu_si128((__m128i*)roundkeys + i, rk[i]);
+}
+
+// Encrypt up to four 16-byte blocks in place, block i with the round
+// keys k[i]. The blocks are interleaved, so the latency of
+// one aesenc is hidden behind the others. With less than four blocks,
+// the first one is encrypted in the unused lanes as well, which keeps
+// everything in registers.
+static inline AESNI void encrypt4 (u1_t* const* blocks, u1_t n, const __m128i* const* k) {
+    __m128i *p0 = (__m128i*)blocks[0], *p1 = (__m128i*)blocks[n > 1], *p2 = (__m128i*)blocks[n > 2 ? 2 : 0], *p3 = (__m128i*)blocks[n > 3 ? 3 : 0];
+    const __m128i *k0 = k[0], *k1 = n > 1 ? k[1] : k0, *k2 = n > 2 ? k[2] : k0, *k3 = n > 3 ? k[3] : k0;
+    __m128i b0 = _mm_loadu_si128(p0);
+    __m128i b1 = _mm_loadu_si128(p1);
+    __m128i b2 = _mm_loadu_si128(p2);
+    __m128i b3 = _mm_loadu_si128(p3);
+    b0 = _mm_xor_si128(b0, _mm_loadu_si128(k0));
+    b1 = _mm_xor_si128(b1, _mm_loadu_si128(k1));
+    b2 = _mm_xor_si128(b2, _mm_loadu_si128(k2));
+    b3 = _mm_xor_si128(b3, _mm_loadu_si128(k3));
+    for (u1_t r = 1; r < 10; r++) {
+        b0 = _mm_aesenc_si128(b0, _mm_loadu_si128(k0 + r));
+        b1 = _mm_aesenc_si128(b1, _mm_loadu_si128(k1 + r));
+        b2 = _mm_aesenc_si128(b2, _mm_loadu_si128(k2 + r));
+        b3 = _mm_aesenc_si128(b3, _mm_loadu_si128(k3 + r));
+    }
+    b0 = _mm_aesenclast_si128(b0, _mm_loadu_si128(k0 + 10));
+    b1 = _mm_aesenclast_si128(b1, _mm_loadu_si128(k1 + 10));
+    b2 = _mm_aesenclast_si128(b2, _mm_loadu_si128(k2 + 10));
+    b3 = _mm_aesenclast_si128(b3, _mm_loadu_si128(k3 + 10));
+    // Unused lanes store to the first block, so store that one last
+    _mm_storeu_si128(p3, b3);
+    _mm_storeu_si128(p2, b2);
+    _mm_storeu_si128(p1, b1);
+    _mm_storeu_si128(p0, b0);
+}
+
+// Encrypt n consecutive 16-byte blocks in place
+AESNI void lmic_aesni_encrypt_blocks (u1_t* buf, u2_t n, const u1_t* roundkeys) {
+    const __m128i* rk = (const __m128i*)roundkeys;
+    const __m128i* k[4] = { rk, rk, rk, rk };
+    while (n) {
+        u1_t todo = n < 4 ? n : 4;
+        u1_t* blocks[4] = { buf, buf + 16, buf + 32, buf + 48 };
+        encrypt4(blocks, todo, k);
+        buf += 16 * todo;
+        n -= todo;
+    }
+}
+
+// Encrypt the 16-byte blocks blocks[i] in place, each with the round
+// keys roundkeys[i]
+AESNI void lmic_aesni_encrypt_multi (u1_t* const* blocks, u1_t n, const u1_t* const* roundkeys) {
+    while (n) {
+        u1_t todo = n < 4 ? n : 4;
+        encrypt4(blocks, todo, (const __m128i* const*)roundkeys);
+        blocks += todo;
+        roundkeys += todo;
+        n -= todo;
+    }
+}
+
+#endif // defined(USE_AESNI_AES)
@@ -0,0 +1,315 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Bitsliced AES-128 encryption. The state of several blocks is spread
+ * over eight words, one for every bit of a byte, so all steps become a
+ * fixed sequence of logic operations on whole words. There are no
+ * table lookups or branches that depend on the key or data, so the
+ * timing does not leak anything through caches.
+ *
+ * A word holds one bit of every byte of W/16 blocks, where W is the
+ * native word size: four blocks on 64-bit hosts, two on 32-bit
+ * processors and one on 8/16-bit ones. Within a word, the bit for row r
+ * and column c of lane (block) l is at r*W/4 + c*W/16 + l, so ShiftRows
+ * rotates within groups of bits and MixColumns rotates whole rows.
+ *
+ * The S-box inverts in GF(2^8) by mapping to GF((2^4)^2), using
+ * GF(2^4) = GF(2)[y]/(y^4+y+1) and X^2+X+8 over that. The linear maps
+ * into the tower field and back (the latter combined with the affine
+ * transformation) are precalculated.
+ *
+ * The CMAC and CTR modes and os_aes() are implemented on top of this
+ * by aes/other.c, which uses lmic_aes_encrypt_blocks() to encrypt
+ * multiple CTR blocks at once, and lmic_aes_encrypt_multi() for the
+ * blocks of independent messages in the multi-buffer functions.
+ *******************************************************************************/
+
+#include "../lmic/oslmic.h"
+
+#if defined(USE_BITSLICE_AES)
+
+typedef uintptr_t slice_t;
+
+#define W         (8 * sizeof(slice_t))
+#define LANES     (W / 16)               // blocks per word
+#define RB        (W / 4)                // bits per row
+#define ROW_MASK  (((slice_t)1 << RB) - 1)
+
+#define ror(x,n)  ((x) >> (n) | (x) << (W - (n)))
+
+// -----------------------------------------------------------------------------
+// S-box
+
+static void gf16_mul (const slice_t* a, const slice_t* b, slice_t* r) {
+    slice_t c4, c5, c6;
+    r[0] = a[0] & b[0];
+    r[1] = (a[0] & b[1]) ^ (a[1] & b[0]);
+    r[2] = (a[0] & b[2]) ^ (a[1] & b[1]) ^ (a[2] & b[0]);
+    r[3] = (a[0] & b[3]) ^ (a[1] & b[2]) ^ (a[2] & b[1]) ^ (a[3] & b[0]);
+    c4   = (a[1] & b[3]) ^ (a[2] & b[2]) ^ (a[3] & b[1]);
+    c5   = (a[2] & b[3]) ^ (a[3] & b[2]);
+    c6   = a[3] & b[3];
+    // y^4 = y+1, y^5 = y^2+y, y^6 = y^3+y^2
+    r[0] ^= c4;
+    r[1] ^= c4 ^ c5;
+    r[2] ^= c5 ^ c6;
+    r[3] ^= c6;
+}
+
+static void gf16_sq (const slice_t* a, slice_t* r) {
+    r[0] = a[0] ^ a[2];
+    r[1] = a[2];
+    r[2] = a[1] ^ a[3];
+    r[3] = a[3];
+}
+
+static void sbox (slice_t* x) {
+    slice_t al[4], ah[4], d[4], d2[4], d4[4], d8[4], t[4], o[8];
+
+    // Into the tower field, al + ah*X
+    al[0] = x[0] ^ x[5] ^ x[7];
+    al[1] = x[2];
+    al[2] = x[2] ^ x[3] ^ x[4] ^ x[5] ^ x[6] ^ x[7];
+    al[3] = x[3] ^ x[4];
+    ah[0] = x[4] ^ x[5] ^ x[6];
+    ah[1] = x[1] ^ x[4] ^ x[6] ^ x[7];
+    ah[2] = x[2] ^ x[3] ^ x[5] ^ x[7];
+    ah[3] = x[5] ^ x[7];
+
+    // d = ah^2*8 + ah*al + al^2
+    gf16_mul(ah, al, d);
+    gf16_sq(al, t);
+    d[0] ^= t[0] ^ ah[2];
+    d[1] ^= t[1] ^ ah[1] ^ ah[2] ^ ah[3];
+    d[2] ^= t[2] ^ ah[1];
+    d[3] ^= t[3] ^ ah[0] ^ ah[2] ^ ah[3];
+
+    // d^-1 = d^14 = d^2 * d^4 * d^8
+    gf16_sq(d, d2);
+    gf16_sq(d2, d4);
+    gf16_sq(d4, d8);
+    gf16_mul(d2, d4, t);
+    gf16_mul(t, d8, d);
+
+    // The inverse is (al+ah)*d^-1 + ah*d^-1*X
+    gf16_mul(ah, d, o+4);
+    for (u1_t i = 0; i < 4; i++)
+        t[i] = al[i] ^ ah[i];
+    gf16_mul(t, d, o);
+
+    // Back to the AES field, combined with the affine transformation
+    x[0] = ~(o[0] ^ o[2] ^ o[6]);
+    x[1] = ~(o[0] ^ o[1] ^ o[2] ^ o[3] ^ o[4] ^ o[5]);
+    x[2] = o[0] ^ o[3] ^ o[5] ^ o[6];
+    x[3] = o[0] ^ o[2] ^ o[5];
+    x[4] = o[0] ^ o[1] ^ o[3] ^ o[4] ^ o[5];
+    x[5] = ~(o[1] ^ o[2] ^ o[3] ^ o[5] ^ o[6] ^ o[7]);
+    x[6] = ~(o[4] ^ o[6] ^ o[7]);
+    x[7] = o[1] ^ o[2];
+}
+
+// -----------------------------------------------------------------------------
+// Rounds
+
+static void shiftrows (slice_t* q) {
+    for (u1_t b = 0; b < 8; b++) {
+        slice_t x = q[b], r = x & ROW_MASK;
+        for (u1_t row = 1; row < 4; row++) {
+            slice_t g = (x >> (row * RB)) & ROW_MASK;
+            g = (g >> (row * LANES) | g << (RB - row * LANES)) & ROW_MASK;
+            r |= g << (row * RB);
+        }
+        q[b] = r;
+    }
+}
+
+static void mixcolumns (slice_t* q) {
+    // s'[r] = 2*(s[r] + s[r+1]) + s[r+1] + s[r+2] + s[r+3]
+    slice_t t[8], s1[8];
+    for (u1_t b = 0; b < 8; b++) {
+        s1[b] = ror(q[b], RB);
+        t[b] = q[b] ^ s1[b];
+        q[b] = s1[b] ^ ror(q[b], 2*RB) ^ ror(q[b], 3*RB);
+    }
+    // Multiply t by 2, i.e. shift left and reduce by 0x1b
+    q[0] ^= t[7];
+    q[1] ^= t[0] ^ t[7];
+    q[2] ^= t[1];
+    q[3] ^= t[2] ^ t[7];
+    q[4] ^= t[3] ^ t[7];
+    q[5] ^= t[4];
+    q[6] ^= t[5];
+    q[7] ^= t[6];
+}
+
+static void addroundkey (slice_t* q, const slice_t* rk) {
+    for (u1_t b = 0; b < 8; b++)
+        q[b] ^= rk[b];
+}
+
+// -----------------------------------------------------------------------------
+// Conversion from and to bytes
+
+#define SWAPMOVE(a, b, mask, n) do {        \
+        slice_t t = (((a) >> (n)) ^ (b)) & (mask); \
+        (b) ^= t;                          \
+        (a) ^= t << (n);                   \
+    } while (0)
+
+// Transpose the 8x8 bit matrices formed by the same byte of all eight
+// words, so that bit b of byte k of word j becomes bit j of byte k of
+// word b. This is its own inverse.
+static void ortho (slice_t* q) {
+    const slice_t m1 = (slice_t)-1 / 3, m2 = (slice_t)-1 / 5, m4 = (slice_t)-1 / 17;
+    SWAPMOVE(q[0], q[1], m1, 1);
+    SWAPMOVE(q[2], q[3], m1, 1);
+    SWAPMOVE(q[4], q[5], m1, 1);
+    SWAPMOVE(q[6], q[7], m1, 1);
+    SWAPMOVE(q[0], q[2], m2, 2);
+    SWAPMOVE(q[1], q[3], m2, 2);
+    SWAPMOVE(q[4], q[6], m2, 2);
+    SWAPMOVE(q[5], q[7], m2, 2);
+    SWAPMOVE(q[0], q[4], m4, 4);
+    SWAPMOVE(q[1], q[5], m4, 4);
+    SWAPMOVE(q[2], q[6], m4, 4);
+    SWAPMOVE(q[3], q[7], m4, 4);
+}
+
+// Position of byte i of lane l within the words. Byte i is row i%4 of
+// column i/4.
+#define POS(i, l) (((i) & 3) * RB + ((i) >> 2) * LANES + (l))
+
+// Spread n (at most LANES) blocks over the eight words. The bytes are
+// first put in place (bit position pos of every word stands for the
+// byte at bit pos&7 of byte pos/8 of word pos%8 beforehand), and then
+// ortho() moves every bit into the word for its bit number.
+static void pack (const u1_t* buf, u1_t n, slice_t* q) {
+    for (u1_t b = 0; b < 8; b++)
+        q[b] = 0;
+    for (u1_t l = 0; l < n; l++) {
+        for (u1_t i = 0; i < 16; i++) {
+            u1_t pos = POS(i, l);
+            q[pos & 7] |= (slice_t)*buf++ << (pos & ~7);
+        }
+    }
+    ortho(q);
+}
+
+static void unpack (slice_t* q, u1_t n, u1_t* buf) {
+    ortho(q);
+    for (u1_t l = 0; l < n; l++) {
+        for (u1_t i = 0; i < 16; i++) {
+            u1_t pos = POS(i, l);
+            *buf++ = q[pos & 7] >> (pos & ~7);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Apply the S-box to all bytes of w, without table lookups
+static void subbytes (u1_t* w, u1_t len) {
+    slice_t q[8];
+    for (u1_t b = 0; b < 8; b++) {
+        q[b] = 0;
+        for (u1_t i = 0; i < len; i++)
+            q[b] |= (slice_t)((w[i] >> b) & 1) << i;
+    }
+    sbox(q);
+    for (u1_t i = 0; i < len; i++) {
+        w[i] = 0;
+        for (u1_t b = 0; b < 8; b++)
+            w[i] |= ((q[b] >> i) & 1) << b;
+    }
+}
+
+// Expand key into 11 round keys, each bitsliced into 8 words with the
+// round key in every lane (roundkeys must be slice_t aligned)
+void lmic_aes_expandkey (u1_t* roundkeys, const u1_t* key) {
+    slice_t* rk = (slice_t*)roundkeys;
+    u1_t k[16], lanes[16 * LANES];
+    u1_t rcon = 1;
+
+    os_copyMem(k, key, 16);
+    for (u1_t r = 0; r < 11; r++) {
+        if (r) {
+            // w0 ^= SubWord(RotWord(w3)) ^ Rcon, w[i] ^= w[i-1]
+            u1_t t[4] = { k[13], k[14], k[15], k[12] };
+            subbytes(t, 4);
+            t[0] ^= rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x1b);
+            for (u1_t i = 0; i < 16; i++)
+                k[i] ^= i < 4 ? t[i] : k[i-4];
+        }
+        for (u1_t l = 0; l < LANES; l++)
+            os_copyMem(lanes + 16 * l, k, 16);
+        pack(lanes, LANES, rk + 8 * r);
+    }
+}
+
+// Encrypt n (at most LANES) consecutive 16-byte blocks in place
+static void encrypt_lanes (u1_t* buf, u1_t n, const slice_t* rk) {
+    slice_t q[8];
+    pack(buf, n, q);
+    addroundkey(q, rk);
+    for (u1_t r = 1; r < 10; r++) {
+        sbox(q);
+        shiftrows(q);
+        mixcolumns(q);
+        addroundkey(q, rk + 8 * r);
+    }
+    sbox(q);
+    shiftrows(q);
+    addroundkey(q, rk + 80);
+    unpack(q, n, buf);
+}
+
+// Encrypt n consecutive 16-byte blocks in place, LANES at a time
+void lmic_aes_encrypt_blocks (u1_t* buf, u2_t n, const u1_t* roundkeys) {
+    while (n) {
+        u1_t todo = n < LANES ? n : LANES;
+        encrypt_lanes(buf, todo, (const slice_t*)roundkeys);
+        buf += 16 * todo;
+        n -= todo;
+    }
+}
+
+// Encrypt the block blocks[i] with the round keys roundkeys[i]. Every
+// key has the same round keys in all lanes, so the round keys for a set
+// of blocks are made by taking the bits of every lane from its own key.
+void lmic_aes_encrypt_multi (u1_t* const* blocks, u1_t n, const u1_t* const* roundkeys) {
+    const slice_t lane0 = (slice_t)-1 / ((1u << LANES) - 1);
+    while (n) {
+        u1_t todo = n < LANES ? n : LANES;
+        if (todo == 1) {
+            encrypt_lanes(blocks[0], 1, (const slice_t*)roundkeys[0]);
+        } else {
+            slice_t rk[11 * 8];
+            u1_t buf[16 * LANES];
+            for (u1_t w = 0; w < 11 * 8; w++) {
+                rk[w] = 0;
+                for (u1_t l = 0; l < todo; l++)
+                    rk[w] |= ((const slice_t*)roundkeys[l])[w] & (lane0 << l);
+            }
+            for (u1_t l = 0; l < todo; l++)
+                os_copyMem(buf + 16 * l, blocks[l], 16);
+            encrypt_lanes(buf, todo, rk);
+            for (u1_t l = 0; l < todo; l++)
+                os_copyMem(blocks[l], buf + 16 * l, 16);
+        }
+        blocks += todo;
+        roundkeys += todo;
+        n -= todo;
+    }
+}
+
+// Encrypt a single 16-byte block in place
+void lmic_aes_encrypt_expanded (u1_t* buf, const u1_t* roundkeys) {
+    lmic_aes_encrypt_blocks(buf, 1, roundkeys);
+}
+
+#endif // defined(USE_BITSLICE_AES)
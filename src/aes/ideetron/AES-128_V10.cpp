@@ -40,6 +40,10 @@
 //  - Tabs were converted to 2 spaces
 //  - An #include and #if guard was added
 //  - S_Table is now stored in PROGMEM
+//  - lmic_aes_expandkey and lmic_aes_encrypt_expanded were added, to
+//    allow expanding a key once and using it for many blocks
+//  - State is now a local variable passed to the round functions, so
+//    encryption is reentrant
 
 #include "../../lmic/oslmic.h"
 
@@ -51,8 +55,6 @@
 ********************************************************************************************
 */
 
-static unsigned char State[4][4];
-
 static CONST_TABLE(unsigned char, S_Table)[16][16] = {
   {0x63,0x7C,0x77,0x7B,0xF2,0x6B,0x6F,0xC5,0x30,0x01,0x67,0x2B,0xFE,0xD7,0xAB,0x76},
   {0xCA,0x82,0xC9,0x7D,0xFA,0x59,0x47,0xF0,0xAD,0xD4,0xA2,0xAF,0x9C,0xA4,0x72,0xC0},
@@ -73,12 +75,14 @@ static CONST_TABLE(unsigned char, S_Table)[16][16] = {
 };
 
 extern "C" void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key);
-static void AES_Add_Round_Key(unsigned char *Round_Key);
+extern "C" void lmic_aes_expandkey(unsigned char *Round_Keys, const unsigned char *Key);
+extern "C" void lmic_aes_encrypt_expanded(unsigned char *Data, const unsigned char *Round_Keys);
+static void AES_Encrypt(unsigned char *Data, unsigned char *Round_Key, unsigned char Expanded);
+static void AES_Add_Round_Key(unsigned char State[4][4], const unsigned char *Round_Key);
 static unsigned char AES_Sub_Byte(unsigned char Byte);
-static void AES_Shift_Rows();
-static void AES_Mix_Collums();
+static void AES_Shift_Rows(unsigned char State[4][4]);
+static void AES_Mix_Collums(unsigned char State[4][4]);
 static void AES_Calculate_Round_Key(unsigned char Round, unsigned char *Round_Key);
-static void Send_State();
 
 /*
 *****************************************************************************************
@@ -91,9 +95,76 @@ static void Send_State();
 void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
 {
   unsigned char i;
+  unsigned char Round_Key[16];
+
+  //Copy key to round key
+  for(i = 0; i < 16; i++)
+  {
+    Round_Key[i] = Key[i];
+  }
+
+  AES_Encrypt(Data, Round_Key, 0);
+}
+
+/*
+*****************************************************************************************
+* Description : Function for expanding a key into all 11 round keys, for use with
+*               lmic_aes_encrypt_expanded
+*
+* Arguments   : *Round_Keys   176 byte long array to store the round keys in
+*               *Key          Key to expand is a 16 byte long arry
+*****************************************************************************************
+*/
+void lmic_aes_expandkey(unsigned char *Round_Keys, const unsigned char *Key)
+{
+  unsigned char i;
+  unsigned char Round;
+
+  //The first round key is the key itself
+  for(i = 0; i < 16; i++)
+  {
+    Round_Keys[i] = Key[i];
+  }
+
+  //Every next round key is calculated from the previous one
+  for(Round = 1; Round <= 10; Round++)
+  {
+    for(i = 0; i < 16; i++)
+    {
+      Round_Keys[(16*Round) + i] = Round_Keys[(16*(Round-1)) + i];
+    }
+    AES_Calculate_Round_Key(Round, &Round_Keys[16*Round]);
+  }
+}
+
+/*
+*****************************************************************************************
+* Description : Function for encrypting data using AES-128 with an expanded key
+*
+* Arguments   : *Data         Data to encrypt is a 16 byte long arry
+*               *Round_Keys   Round keys from lmic_aes_expandkey
+*****************************************************************************************
+*/
+void lmic_aes_encrypt_expanded(unsigned char *Data, const unsigned char *Round_Keys)
+{
+  AES_Encrypt(Data, (unsigned char *)Round_Keys, 1);
+}
+
+/*
+*****************************************************************************************
+* Description : Function that does the actual encryption
+*
+* Arguments   : *Data         Data to encrypt is a 16 byte long arry
+*               *Round_Key    If Expanded, all 11 round keys. Otherwise the 16 byte
+*                             key, which is overwritten with the next round keys
+*               Expanded      Whether Round_Key holds all round keys
+*****************************************************************************************
+*/
+static void AES_Encrypt(unsigned char *Data, unsigned char *Round_Key, unsigned char Expanded)
+{
   unsigned char Row,Collum;
   unsigned char Round = 0x00;
-  unsigned char Round_Key[16];
+  unsigned char State[4][4];
 
   //Copy input to State arry
   for(Collum = 0; Collum < 4; Collum++)
@@ -104,14 +175,8 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
     }
   }
 
-  //Copy key to round key
-  for(i = 0; i < 16; i++)
-  {
-    Round_Key[i] = Key[i];
-  }
-
   //Add round key
-  AES_Add_Round_Key(Round_Key);
+  AES_Add_Round_Key(State, Round_Key);
 
   //Preform 9 full rounds
   for(Round = 1; Round < 10; Round++)
@@ -126,16 +191,19 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
     }
 
     //Preform Row Shift
-    AES_Shift_Rows();
+    AES_Shift_Rows(State);
 
     //Mix Collums
-    AES_Mix_Collums();
+    AES_Mix_Collums(State);
 
-    //Calculate new round key
-    AES_Calculate_Round_Key(Round,Round_Key);
+    //Calculate new round key, or skip to the next precalculated one
+    if(Expanded)
+      Round_Key += 16;
+    else
+      AES_Calculate_Round_Key(Round,Round_Key);
 
     //Add round key
-    AES_Add_Round_Key(Round_Key);
+    AES_Add_Round_Key(State, Round_Key);
   }
 
   //Last round whitout mix collums
@@ -149,13 +217,16 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
   }
 
   //Shift rows
-  AES_Shift_Rows();
+  AES_Shift_Rows(State);
 
   //Calculate new round key
-  AES_Calculate_Round_Key(Round,Round_Key);
+  if(Expanded)
+    Round_Key += 16;
+  else
+    AES_Calculate_Round_Key(Round,Round_Key);
 
   //Add round Key
-  AES_Add_Round_Key(Round_Key);
+  AES_Add_Round_Key(State, Round_Key);
 
   //Copy the State into the data array
   for(Collum = 0; Collum < 4; Collum++)
@@ -175,7 +246,7 @@ void lmic_aes_encrypt(unsigned char *Data, unsigned char *Key)
 * Arguments   : *Round_Key    16 byte long array holding the Round Key
 *****************************************************************************************
 */
-static void AES_Add_Round_Key(unsigned char *Round_Key)
+static void AES_Add_Round_Key(unsigned char State[4][4], const unsigned char *Round_Key)
 {
   unsigned char Row,Collum;
 
@@ -217,7 +288,7 @@ static unsigned char AES_Sub_Byte(unsigned char Byte)
 * Description : Function that preforms the shift row operation described in the AES standard
 *****************************************************************************************
 */
-static void AES_Shift_Rows()
+static void AES_Shift_Rows(unsigned char State[4][4])
 {
   unsigned char Buffer;
 
@@ -253,7 +324,7 @@ static void AES_Shift_Rows()
 * Description : Function that preforms the Mix Collums operation described in the AES standard
 *****************************************************************************************
 */
-static void AES_Mix_Collums()
+static void AES_Mix_Collums(unsigned char State[4][4])
 {
   unsigned char Row,Collum;
   unsigned char a[4], b[4];
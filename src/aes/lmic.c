@@ -13,8 +13,6 @@
 
 #if defined(USE_ORIGINAL_AES)
 
-#define AES_MICSUB 0x30 // internal use only
-
 static CONST_TABLE(u4_t, AES_RCON)[10] = {
     0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000,
     0x20000000, 0x40000000, 0x80000000, 0x1B000000, 0x36000000
@@ -179,7 +177,7 @@ static CONST_TABLE(u4_t, AES_E4)[256] = {
   0x4141C382, 0x9999B029, 0x2D2D775A, 0x0F0F111E, 0xB0B0CB7B, 0x5454FCA8, 0xBBBBD66D, 0x16163A2C,
 };
 
-#define msbf4_read(p)    ((p)[0]<<24 | (p)[1]<<16 | (p)[2]<<8 | (p)[3])
+#define msbf4_read(p)    ((u4_t)(p)[0]<<24 | (u4_t)(p)[1]<<16 | (p)[2]<<8 | (p)[3])
 #define msbf4_write(p,v) (p)[0]=(v)>>24,(p)[1]=(v)>>16,(p)[2]=(v)>>8,(p)[3]=(v)
 #define swapmsbf(x)      ( (x&0xFF)<<24 | (x&0xFF00)<<8 | (x&0xFF0000)>>8 | (x>>24) )
 
@@ -201,21 +199,17 @@ static CONST_TABLE(u4_t, AES_E4)[256] = {
                                    a ^= ((u4_t)TABLE_GET_U1(AES_S, u1(r2>> 8))<< 8); \
                                    a ^=  (u4_t)TABLE_GET_U1(AES_S, u1(r3)    )
 
-// global area for passing parameters (aux, key) and for storing round keys
-u4_t AESAUX[16/sizeof(u4_t)];
-u4_t AESKEY[11*16/sizeof(u4_t)];
-
 // generate 1+10 roundkeys for encryption with 128-bit key
-// read 128-bit key from AESKEY in MSBF, generate roundkey words in place
-static void aesroundkeys () {
+// read 128-bit key from rk in MSBF, generate roundkey words in place
+static void aesroundkeys (u4_t* rk) {
     int i;
     u4_t b;
 
     for( i=0; i<4; i++) {
-        AESKEY[i] = swapmsbf(AESKEY[i]);
+        rk[i] = swapmsbf(rk[i]);
     }
 
-    b = AESKEY[3];
+    b = rk[3];
     for( ; i<44; i++ ) {
         if( i%4==0 ) {
             // b = SubWord(RotWord(b)) xor Rcon[i/4]
@@ -225,146 +219,60 @@ static void aesroundkeys () {
                 ((u4_t)TABLE_GET_U1(AES_S,    b >> 24 )      ) ^
                  TABLE_GET_U4(AES_RCON, (i-4)/4);
         }
-        AESKEY[i] = b ^= AESKEY[i-4];
+        rk[i] = b ^= rk[i-4];
     }
 }
 
-u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
-
-        aesroundkeys();
-
-        if( mode & AES_MICNOAUX ) {
-            AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
-        } else {
-            AESAUX[0] = swapmsbf(AESAUX[0]);
-            AESAUX[1] = swapmsbf(AESAUX[1]);
-            AESAUX[2] = swapmsbf(AESAUX[2]);
-            AESAUX[3] = swapmsbf(AESAUX[3]);
-        }
+// The CMAC and CTR modes and os_aes() are implemented on top of these
+// two functions by aes/other.c.
 
-        while( (signed char)len > 0 ) {
-            u4_t a0, a1, a2, a3;
-            u4_t t0, t1, t2, t3;
-            u4_t *ki, *ke;
-
-            // load input block
-            if( (mode & AES_CTR) || ((mode & AES_MIC) && (mode & AES_MICNOAUX)==0) ) { // load CTR block or first MIC block
-                a0 = AESAUX[0];
-                a1 = AESAUX[1];
-                a2 = AESAUX[2];
-                a3 = AESAUX[3];
-            }
-            else if( (mode & AES_MIC) && len <= 16 ) { // last MIC block
-                a0 = a1 = a2 = a3 = 0; // load null block
-                mode |= ((len == 16) ? 1 : 2) << 4; // set MICSUB: CMAC subkey K1 or K2
-            } else
-        LOADDATA: { // load data block (partially)
-                for(t0=0; t0<16; t0++) {
-                    t1 = (t1<<8) | ((t0<len) ? buf[t0] : (t0==len) ? 0x80 : 0x00);
-                    if((t0&3)==3) {
-                        a0 = a1;
-                        a1 = a2;
-                        a2 = a3;
-                        a3 = t1;
-                    }
-                }
-                if( mode & AES_MIC ) {
-                    a0 ^= AESAUX[0];
-                    a1 ^= AESAUX[1];
-                    a2 ^= AESAUX[2];
-                    a3 ^= AESAUX[3];
-                }
-            }
-
-            // perform AES encryption on block in a0-a3
-            ki = AESKEY;
-            ke = ki + 8*4;
-            a0 ^= ki[0];
-            a1 ^= ki[1];
-            a2 ^= ki[2];
-            a3 ^= ki[3];
-            do {
-                AES_key4 (t1,t2,t3,t0,4);
-                AES_expr4(t1,t2,t3,t0,a0);
-                AES_expr4(t2,t3,t0,t1,a1);
-                AES_expr4(t3,t0,t1,t2,a2);
-                AES_expr4(t0,t1,t2,t3,a3);
+// expand key into the 44 roundkey words (roundkeys must be u4_t aligned)
+void lmic_aes_expandkey (u1_t* roundkeys, const u1_t* key) {
+    u4_t* rk = (u4_t*)roundkeys;
+    os_copyMem(rk, key, 16);
+    aesroundkeys(rk);
+}
 
-                AES_key4 (a1,a2,a3,a0,8);
-                AES_expr4(a1,a2,a3,a0,t0);
-                AES_expr4(a2,a3,a0,a1,t1);
-                AES_expr4(a3,a0,a1,a2,t2);
-                AES_expr4(a0,a1,a2,a3,t3);
-            } while( (ki+=8) < ke );
+// encrypt a single 16-byte block in place
+void lmic_aes_encrypt_expanded (u1_t* buf, const u1_t* roundkeys) {
+    const u4_t *ki = (const u4_t*)roundkeys;
+    const u4_t *ke = ki + 8*4;
+    u4_t a0, a1, a2, a3;
+    u4_t t0, t1, t2, t3;
 
-            AES_key4 (t1,t2,t3,t0,4);
-            AES_expr4(t1,t2,t3,t0,a0);
-            AES_expr4(t2,t3,t0,t1,a1);
-            AES_expr4(t3,t0,t1,t2,a2);
-            AES_expr4(t0,t1,t2,t3,a3);
+    a0 = msbf4_read(buf+0)  ^ ki[0];
+    a1 = msbf4_read(buf+4)  ^ ki[1];
+    a2 = msbf4_read(buf+8)  ^ ki[2];
+    a3 = msbf4_read(buf+12) ^ ki[3];
+    do {
+        AES_key4 (t1,t2,t3,t0,4);
+        AES_expr4(t1,t2,t3,t0,a0);
+        AES_expr4(t2,t3,t0,t1,a1);
+        AES_expr4(t3,t0,t1,t2,a2);
+        AES_expr4(t0,t1,t2,t3,a3);
 
-            AES_expr(a0,t0,t1,t2,t3,8);
-            AES_expr(a1,t1,t2,t3,t0,9);
-            AES_expr(a2,t2,t3,t0,t1,10);
-            AES_expr(a3,t3,t0,t1,t2,11);
-            // result of AES encryption in a0-a3
+        AES_key4 (a1,a2,a3,a0,8);
+        AES_expr4(a1,a2,a3,a0,t0);
+        AES_expr4(a2,a3,a0,a1,t1);
+        AES_expr4(a3,a0,a1,a2,t2);
+        AES_expr4(a0,a1,a2,a3,t3);
+    } while( (ki+=8) < ke );
 
-            if( mode & AES_MIC ) {
-                if( (t1 = (mode & AES_MICSUB) >> 4) != 0 ) { // last block
-                    do {
-                        // compute CMAC subkey K1 and K2
-                        t0 = a0 >> 31; // save MSB
-                        a0 = (a0 << 1) | (a1 >> 31);
-                        a1 = (a1 << 1) | (a2 >> 31);
-                        a2 = (a2 << 1) | (a3 >> 31);
-                        a3 = (a3 << 1);
-                        if( t0 ) a3 ^= 0x87;
-                    } while( --t1 );
+    AES_key4 (t1,t2,t3,t0,4);
+    AES_expr4(t1,t2,t3,t0,a0);
+    AES_expr4(t2,t3,t0,t1,a1);
+    AES_expr4(t3,t0,t1,t2,a2);
+    AES_expr4(t0,t1,t2,t3,a3);
 
-                    AESAUX[0] ^= a0;
-                    AESAUX[1] ^= a1;
-                    AESAUX[2] ^= a2;
-                    AESAUX[3] ^= a3;
-                    mode &= ~AES_MICSUB;
-                    goto LOADDATA;
-                } else {
-                    // save cipher block as new iv
-                    AESAUX[0] = a0;
-                    AESAUX[1] = a1;
-                    AESAUX[2] = a2;
-                    AESAUX[3] = a3;
-                }
-            } else { // CIPHER
-                if( mode & AES_CTR ) { // xor block (partially)
-                    t0 = (len > 16) ? 16: len;
-                    for(t1=0; t1<t0; t1++) {
-                        buf[t1] ^= (a0>>24);
-                        a0 <<= 8;
-                        if((t1&3)==3) {
-                            a0 = a1;
-                            a1 = a2;
-                            a2 = a3;
-                        }
-                    }
-                    // update counter
-                    AESAUX[3]++;
-                } else { // ECB
-                    // store block
-                    msbf4_write(buf+0,  a0);
-                    msbf4_write(buf+4,  a1);
-                    msbf4_write(buf+8,  a2);
-                    msbf4_write(buf+12, a3);
-                }
-            }
+    AES_expr(a0,t0,t1,t2,t3,8);
+    AES_expr(a1,t1,t2,t3,t0,9);
+    AES_expr(a2,t2,t3,t0,t1,10);
+    AES_expr(a3,t3,t0,t1,t2,11);
 
-            // update block state
-            if( (mode & AES_MIC)==0 || (mode & AES_MICNOAUX) ) {
-                buf += 16;
-                len -= 16;
-            }
-            mode |= AES_MICNOAUX;
-        }
-        return AESAUX[0];
+    msbf4_write(buf+0,  a0);
+    msbf4_write(buf+4,  a1);
+    msbf4_write(buf+8,  a2);
+    msbf4_write(buf+12, a3);
 }
 
 #endif
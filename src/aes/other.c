@@ -13,133 +13,355 @@
  *******************************************************************************/
 
 /*
- * The original LMIC AES implementation integrates raw AES encryption
- * with CMAC and AES-CTR in a single piece of code. Most other AES
- * implementations (only) offer raw single block AES encryption, so this
- * file contains an implementation of CMAC and AES-CTR, and offers the
- * same API through the os_aes() function as the original AES
- * implementation. This file assumes that there is an encryption
- * function available with this signature:
+ * Most AES implementations (only) offer raw single block AES
+ * encryption, so this file contains an implementation of CMAC and
+ * AES-CTR on top of that, offered through the lmic_aes_* API (see
+ * oslmic.h). It also offers the os_aes() function of the original LMIC
+ * AES implementation, on top of that same API. This file assumes that
+ * the selected AES implementation offers these functions:
  *
- *      extern "C" void lmic_aes_encrypt(u1_t *data, u1_t *key);
+ *      extern "C" void lmic_aes_expandkey(u1_t *roundkeys, const u1_t *key);
+ *      extern "C" void lmic_aes_encrypt_expanded(u1_t *data, const u1_t *roundkeys);
  *
- *  That takes a single 16-byte buffer and encrypts it wit the given
- *  16-byte key.
+ *  The first expands a 16-byte key into the round keys (in whatever
+ *  layout suits the implementation, see aes_key_t), which the second
+ *  uses to encrypt a single 16-byte buffer in place. Implementations
+ *  that can encrypt multiple blocks at once (currently only the
+ *  bitsliced one) offer this as well:
+ *
+ *      extern "C" void lmic_aes_encrypt_blocks(u1_t *data, u2_t n, const u1_t *roundkeys);
+ *
+ * and, for the multi-buffer functions, encrypts the block blocks[i] with
+ * the round keys roundkeys[i]:
+ *
+ *      extern "C" void lmic_aes_encrypt_multi(u1_t* const* blocks, u1_t n, const u1_t* const* roundkeys);
+ *
+ * With USE_AESNI_AES, aes/aesni.c is used instead of all of these when
+ * the processor supports it.
  */
 
 #include "../lmic/oslmic.h"
 
-#if !defined(USE_ORIGINAL_AES)
+// These should be defined elsewhere
+void lmic_aes_expandkey(u1_t *roundkeys, const u1_t *key);
+void lmic_aes_encrypt_expanded(u1_t *data, const u1_t *roundkeys);
+#if defined(USE_BITSLICE_AES)
+void lmic_aes_encrypt_blocks(u1_t *data, u2_t n, const u1_t *roundkeys);
+void lmic_aes_encrypt_multi(u1_t* const* blocks, u1_t n, const u1_t* const* roundkeys);
+#endif
+#if defined(USE_AESNI_AES)
+u1_t lmic_aesni_available(void);
+void lmic_aesni_expandkey(u1_t *roundkeys, const u1_t *key);
+void lmic_aesni_encrypt_blocks(u1_t *data, u2_t n, const u1_t *roundkeys);
+void lmic_aesni_encrypt_multi(u1_t* const* blocks, u1_t n, const u1_t* const* roundkeys);
+#endif
 
-// This should be defined elsewhere
-void lmic_aes_encrypt(u1_t *data, u1_t *key);
+// Number of CTR blocks to prepare and encrypt at once
+#if defined(USE_BITSLICE_AES) || defined(USE_AESNI_AES)
+#define CTR_BATCH 4
+#else
+#define CTR_BATCH 1
+#endif
 
-// global area for passing parameters (aux, key)
+// global area for passing parameters (aux, key) to os_aes
 u4_t AESAUX[16/sizeof(u4_t)];
 u4_t AESKEY[16/sizeof(u4_t)];
 
-// Shift the given buffer left one bit
-static void shift_left(xref2u1_t buf, u1_t len) {
-    while (len--) {
-        u1_t next = len ? buf[1] : 0;
+static void encrypt_block(const aes_key_t* key, xref2u1_t block) {
+#if defined(USE_AESNI_AES)
+    if (lmic_aesni_available()) {
+        lmic_aesni_encrypt_blocks(block, 1, (const u1_t*)key->rk);
+        return;
+    }
+#endif
+    lmic_aes_encrypt_expanded(block, (const u1_t*)key->rk);
+}
 
-        u1_t val = (*buf << 1);
-        if (next & 0x80)
-            val |= 1;
-        *buf++ = val;
+// Encrypt n consecutive blocks
+static void encrypt_blocks(const aes_key_t* key, xref2u1_t data, u2_t n) {
+#if defined(USE_AESNI_AES)
+    if (lmic_aesni_available()) {
+        lmic_aesni_encrypt_blocks(data, n, (const u1_t*)key->rk);
+        return;
     }
+#endif
+#if defined(USE_BITSLICE_AES)
+    lmic_aes_encrypt_blocks(data, n, (const u1_t*)key->rk);
+#else
+    for (; n; n--, data += 16)
+        encrypt_block(key, data);
+#endif
 }
 
-// Apply RFC4493 CMAC, using AESKEY as the key. If prepend_aux is true,
-// AESAUX is prepended to the message. AESAUX is used as working memory
-// in any case. The CMAC result is returned in AESAUX as well.
-static void os_aes_cmac(xref2u1_t buf, u2_t len, u1_t prepend_aux) {
-    if (prepend_aux)
-        lmic_aes_encrypt(AESaux, AESkey);
+// Encrypt n (at most AES_MULTI) blocks in place, blocks[i] with keys[i].
+// Without AES-NI or bitslicing, this is no faster than n single calls.
+static void encrypt_multi(const aes_key_t* const* keys, u1_t* const* blocks, u1_t n) {
+#if defined(USE_AESNI_AES) || defined(USE_BITSLICE_AES)
+    const u1_t* rk[AES_MULTI];
+    for (u1_t i = 0; i < n; i++)
+        rk[i] = (const u1_t*)keys[i]->rk;
+#endif
+#if defined(USE_AESNI_AES)
+    if (lmic_aesni_available()) {
+        lmic_aesni_encrypt_multi(blocks, n, rk);
+        return;
+    }
+#endif
+#if defined(USE_BITSLICE_AES)
+    lmic_aes_encrypt_multi(blocks, n, rk);
+#else
+    for (u1_t i = 0; i < n; i++)
+        encrypt_block(keys[i], blocks[i]);
+#endif
+}
+
+void lmic_aes_setkey (aes_key_t* key, xref2cu1_t raw) {
+#if defined(USE_AESNI_AES)
+    if (lmic_aesni_available())
+        lmic_aesni_expandkey((u1_t*)key->rk, raw);
     else
-        memset (AESaux, 0, 16);
-
-    while (len > 0) {
-        u1_t need_padding = 0;
-        for (u1_t i = 0; i < 16; ++i, ++buf, --len) {
-            if (len == 0) {
-                // The message is padded with 0x80 and then zeroes.
-                // Since zeroes are no-op for xor, we can just skip them
-                // and leave AESAUX unchanged for them.
-                AESaux[i] ^= 0x80;
-                need_padding = 1;
-                break;
-            }
-            AESaux[i] ^= *buf;
+#endif
+    lmic_aes_expandkey((u1_t*)key->rk, raw);
+    key->k1valid = 0;
+}
+
+void lmic_aes_ecb (const aes_key_t* key, xref2u1_t buf, u2_t len) {
+    ASSERT((len & 15) == 0);
+    encrypt_blocks(key, buf, len / 16);
+}
+
+// Shift the given block left one bit, and apply the CMAC constant if a
+// bit was shifted out. This derives K1 from L, and K2 from K1.
+static void cmac_subkey(xref2u1_t buf) {
+    u1_t msb = buf[0] & 0x80;
+    for (u1_t i = 0; i < 16; ++i) {
+        u1_t next = i < 15 ? buf[i+1] : 0;
+        buf[i] = (buf[i] << 1) | (next >> 7);
+    }
+    if (msb)
+        buf[15] ^= 0x87;
+}
+
+// K1 is calculated by encrypting the all-zeroes block and then applying
+// some shifts and xor on that.
+static void cmac_k1(const aes_key_t* key, xref2u1_t k1) {
+    os_clearMem(k1, 16);
+    encrypt_block(key, k1);
+    cmac_subkey(k1);
+}
+
+void lmic_aes_cmac_prepare (aes_key_t* key) {
+    cmac_k1(key, key->k1);
+    key->k1valid = 1;
+}
+
+void lmic_aes_cmac_init (lmic_aes_cmac_t* ctx, const aes_key_t* key) {
+    ctx->key = key;
+    os_clearMem(ctx->x, sizeof(ctx->x));
+    ctx->n = 0;
+}
+
+void lmic_aes_cmac_update (lmic_aes_cmac_t* ctx, xref2cu1_t buf, u2_t len) {
+    while (len--) {
+        // A complete block is only encrypted once more data follows,
+        // since the final block is treated differently.
+        if (ctx->n == 16) {
+            encrypt_block(ctx->key, ctx->x);
+            ctx->n = 0;
         }
+        ctx->x[ctx->n++] ^= *buf++;
+    }
+}
 
-        if (len == 0) {
-            // Final block, xor with K1 or K2. K1 and K2 are calculated
-            // by encrypting the all-zeroes block and then applying some
-            // shifts and xor on that.
-            u1_t final_key[16];
-            memset(final_key, 0, sizeof(final_key));
-            lmic_aes_encrypt(final_key, AESkey);
-
-            // Calculate K1
-            u1_t msb = final_key[0] & 0x80;
-            shift_left(final_key, sizeof(final_key));
-            if (msb)
-                final_key[sizeof(final_key)-1] ^= 0x87;
-
-            // If the final block was not complete, calculate K2 from K1
-            if (need_padding) {
-                msb = final_key[0] & 0x80;
-                shift_left(final_key, sizeof(final_key));
-                if (msb)
-                    final_key[sizeof(final_key)-1] ^= 0x87;
-            }
+// Prepare the final block, so only its encryption remains
+static void cmac_finish (lmic_aes_cmac_t* ctx) {
+    // The final block is xored with K1 or K2 (which is derived from K1)
+    u1_t final_key[16];
+    if (ctx->key->k1valid)
+        os_copyMem(final_key, ctx->key->k1, sizeof(final_key));
+    else
+        cmac_k1(ctx->key, final_key);
+
+    // If the final block is not complete, it is padded with 0x80 and
+    // then zeroes, and K2 is used instead. Since zeroes are no-op for
+    // xor, they can just be skipped.
+    if (ctx->n < 16) {
+        ctx->x[ctx->n] ^= 0x80;
+        cmac_subkey(final_key);
+    }
+
+    for (u1_t i = 0; i < sizeof(final_key); ++i)
+        ctx->x[i] ^= final_key[i];
+    ctx->n = 0;
+}
+
+u4_t lmic_aes_cmac_final (lmic_aes_cmac_t* ctx) {
+    cmac_finish(ctx);
+    encrypt_block(ctx->key, ctx->x);
+    // MSB because of internal structure of AES
+    return os_rmsbf4(ctx->x);
+}
 
-            // Xor with K1 or K2
-            for (u1_t i = 0; i < sizeof(final_key); ++i)
-                AESaux[i] ^= final_key[i];
+void lmic_aes_cmac_update_multi (lmic_aes_cmac_t* ctx, xref2cu1_t const* bufs, const u2_t* lens, u2_t n) {
+    for (u2_t base = 0; base < n; base += AES_MULTI) {
+        u1_t lanes = n - base < AES_MULTI ? n - base : AES_MULTI;
+        xref2cu1_t buf[AES_MULTI];
+        u2_t len[AES_MULTI];
+        for (u1_t i = 0; i < lanes; i++) {
+            buf[i] = bufs[base + i];
+            len[i] = lens[base + i];
         }
 
-        lmic_aes_encrypt(AESaux, AESkey);
+        while (1) {
+            // Like lmic_aes_cmac_update, absorb data into every context
+            // until its block is full and more data follows, and then
+            // encrypt all those blocks at once.
+            const aes_key_t* keys[AES_MULTI];
+            u1_t* blocks[AES_MULTI];
+            u1_t m = 0;
+            for (u1_t i = 0; i < lanes; i++) {
+                lmic_aes_cmac_t* c = &ctx[base + i];
+                if (c->n == 0 && len[i] >= 16) {
+                    // Whole block at once (which compilers vectorize)
+                    for (u1_t k = 0; k < 16; k++)
+                        c->x[k] ^= buf[i][k];
+                    c->n = 16;
+                    buf[i] += 16;
+                    len[i] -= 16;
+                }
+                for (; len[i] && c->n < 16; len[i]--)
+                    c->x[c->n++] ^= *buf[i]++;
+                if (len[i]) {
+                    keys[m] = c->key;
+                    blocks[m++] = c->x;
+                    c->n = 0;
+                }
+            }
+            if (!m)
+                break;
+            encrypt_multi(keys, blocks, m);
+        }
     }
 }
 
-// Run AES-CTR using the key in AESKEY and using AESAUX as the
-// counter block. The last byte of the counter block will be incremented
-// for every block. The given buffer will be encrypted in place.
-static void os_aes_ctr (xref2u1_t buf, u2_t len) {
-    u1_t ctr[16];
+void lmic_aes_cmac_final_multi (lmic_aes_cmac_t* ctx, u4_t* mics, u2_t n) {
+    for (u2_t base = 0; base < n; base += AES_MULTI) {
+        u1_t lanes = n - base < AES_MULTI ? n - base : AES_MULTI;
+        const aes_key_t* keys[AES_MULTI];
+        u1_t* blocks[AES_MULTI];
+        for (u1_t i = 0; i < lanes; i++) {
+            cmac_finish(&ctx[base + i]);
+            keys[i] = ctx[base + i].key;
+            blocks[i] = ctx[base + i].x;
+        }
+        encrypt_multi(keys, blocks, lanes);
+        for (u1_t i = 0; i < lanes; i++)
+            mics[base + i] = os_rmsbf4(ctx[base + i].x);
+    }
+}
+
+void lmic_aes_ctr_init (lmic_aes_ctr_t* ctx, const aes_key_t* key, xref2cu1_t ctr) {
+    ctx->key = key;
+    os_copyMem(ctx->ctr, ctr, sizeof(ctx->ctr));
+}
+
+void lmic_aes_ctr_crypt (lmic_aes_ctr_t* ctx, xref2u1_t buf, u2_t len) {
+    u1_t block[16 * CTR_BATCH];
     while (len) {
-        // Encrypt the counter block with the selected key
-        memcpy(ctr, AESaux, sizeof(ctr));
-        lmic_aes_encrypt(ctr, AESkey);
+        // Prepare as many counter blocks as needed (up to CTR_BATCH),
+        // incrementing the block index byte for each
+        u1_t n = 0;
+        do {
+            os_copyMem(block + 16 * n, ctx->ctr, 16);
+            ctx->ctr[15]++;
+            n++;
+        } while (n < CTR_BATCH && 16 * n < len);
+
+        // Encrypt them with the selected key
+        encrypt_blocks(ctx->key, block, n);
 
         // Xor the payload with the resulting ciphertext
-        for (u1_t i = 0; i < 16 && len > 0; i++, len--, buf++)
-            *buf ^= ctr[i];
+        for (u1_t i = 0; i < 16 * n && len > 0; i++, len--, buf++)
+            *buf ^= block[i];
+    }
+}
 
-        // Increment the block index byte
-        AESaux[15]++;
+void lmic_aes_ctr_crypt_multi (lmic_aes_ctr_t* ctx, xref2u1_t const* bufs, const u2_t* lens, u2_t n) {
+    for (u2_t base = 0; base < n; base += AES_MULTI) {
+        u1_t lanes = n - base < AES_MULTI ? n - base : AES_MULTI;
+        xref2u1_t buf[AES_MULTI];
+        u2_t len[AES_MULTI];
+        for (u1_t i = 0; i < lanes; i++) {
+            buf[i] = bufs[base + i];
+            len[i] = lens[base + i];
+        }
+
+        while (1) {
+            // Take the next counter block of every context that still
+            // has data, and encrypt them all at once
+            const aes_key_t* keys[AES_MULTI];
+            u1_t stream[AES_MULTI][16], lane[AES_MULTI], m = 0;
+            u1_t* blocks[AES_MULTI];
+            for (u1_t i = 0; i < lanes; i++) {
+                lmic_aes_ctr_t* c = &ctx[base + i];
+                if (len[i]) {
+                    keys[m] = c->key;
+                    os_copyMem(stream[m], c->ctr, 16);
+                    blocks[m] = stream[m];
+                    c->ctr[15]++;
+                    lane[m++] = i;
+                }
+            }
+            if (!m)
+                break;
+            encrypt_multi(keys, blocks, m);
+            for (u1_t j = 0; j < m; j++) {
+                u1_t i = lane[j];
+                if (len[i] >= 16) {
+                    for (u1_t k = 0; k < 16; k++)
+                        buf[i][k] ^= stream[j][k];
+                    buf[i] += 16;
+                    len[i] -= 16;
+                } else {
+                    for (u1_t k = 0; k < len[i]; k++)
+                        buf[i][k] ^= stream[j][k];
+                    len[i] = 0;
+                }
+            }
+        }
     }
 }
 
+// Compatibility with the original LMIC AES implementation, which passes
+// the key and aux block through AESKEY and AESAUX.
 u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
+    aes_key_t key;
+    lmic_aes_setkey(&key, AESkey);
+
     switch (mode & ~AES_MICNOAUX) {
-        case AES_MIC:
-            os_aes_cmac(buf, len, /* prepend_aux */ !(mode & AES_MICNOAUX));
-            return os_rmsbf4(AESaux);
+        case AES_MIC: {
+            lmic_aes_cmac_t cmac;
+            lmic_aes_cmac_init(&cmac, &key);
+            if (!(mode & AES_MICNOAUX))
+                lmic_aes_cmac_update(&cmac, AESaux, 16);
+            lmic_aes_cmac_update(&cmac, buf, len);
+            u4_t mic = lmic_aes_cmac_final(&cmac);
+            // The CMAC result is returned in AESAUX as well
+            os_copyMem(AESaux, cmac.x, 16);
+            return mic;
+        }
 
         case AES_ENC:
-            // TODO: Check / handle when len is not a multiple of 16
-            for (u1_t i = 0; i < len; i += 16)
-                lmic_aes_encrypt(buf+i, AESkey);
+            lmic_aes_ecb(&key, buf, len);
             break;
 
-        case AES_CTR:
-            os_aes_ctr(buf, len);
+        case AES_CTR: {
+            lmic_aes_ctr_t ctr;
+            lmic_aes_ctr_init(&ctr, &key, AESaux);
+            lmic_aes_ctr_crypt(&ctr, buf, len);
+            os_copyMem(AESaux, ctr.ctr, 16);
             break;
+        }
     }
     return 0;
 }
-
-#endif // !defined(USE_ORIGINAL_AES)
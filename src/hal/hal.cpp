@@ -8,8 +8,23 @@
  * This the HAL to run LMIC on top of the Arduino environment.
  *******************************************************************************/
 
+#include "../lmic/config.h"
+
+#if defined(USE_ARDUINO_HAL)
+
 #include <Arduino.h>
 #include <SPI.h>
+#if defined(LMIC_IDLE_SLEEP) && defined(__AVR__)
+#include <avr/sleep.h>
+#endif
+#if defined(LMIC_USE_INTERRUPTS) && defined(LMIC_MULTI_INSTANCE)
+// The interrupt handlers cannot tell which instance they belong to
+#error "LMIC_USE_INTERRUPTS cannot be combined with LMIC_MULTI_INSTANCE"
+#endif
+#if defined(LMIC_IDLE_SLEEP) && defined(LMIC_MULTI_INSTANCE)
+// Sleeping for one instance would block all others
+#error "LMIC_IDLE_SLEEP cannot be combined with LMIC_MULTI_INSTANCE"
+#endif
 #include "../lmic.h"
 #include "hal.h"
 #define _GNU_SOURCE 1 // For fopencookie
@@ -19,11 +34,59 @@
 // -----------------------------------------------------------------------------
 // I/O
 
+#if defined(LMIC_MULTI_INSTANCE)
+// Use the pins and state of the radio of the current instance
+#define lmic_pins  (*((lmic_hal_t*)lmic_ctx->hal)->pins)
+#define dio_states (((lmic_hal_t*)lmic_ctx->hal)->dio_states)
+#elif !defined(LMIC_USE_INTERRUPTS)
+static bool dio_states[NUM_DIO] = {0};
+#endif
+
+#if defined(LMIC_USE_INTERRUPTS)
+// Time of the last rising edge on each DIO pin (as returned by micros()),
+// and a bitmask of edges that were not handled yet. Set by the interrupt
+// handlers.
+static volatile uint32_t interrupt_time[NUM_DIO];
+static volatile uint8_t interrupt_pending;
+
+// Only note the time, all SPI work is left to hal_io_check, which runs
+// outside of the interrupt handler. This does not call hal_ticks, which
+// must not be interrupted by itself (see ticks_at).
+template <uint8_t dio>
+static void hal_isr () {
+    if (!(interrupt_pending & (1 << dio))) {
+        interrupt_time[dio] = micros();
+        interrupt_pending |= (1 << dio);
+    }
+}
+
+static void (* const isrs[NUM_DIO])() = { hal_isr<0>, hal_isr<1>, hal_isr<2> };
+
+static void hal_interrupt_init () {
+    for (uint8_t i = 0; i < NUM_DIO; ++i) {
+        if (lmic_pins.dio[i] == LMIC_UNUSED_PIN)
+            continue;
+        // All used DIO pins must support interrupts
+        ASSERT(digitalPinToInterrupt(lmic_pins.dio[i]) != NOT_AN_INTERRUPT);
+        attachInterrupt(digitalPinToInterrupt(lmic_pins.dio[i]), isrs[i], RISING);
+    }
+}
+#endif // defined(LMIC_USE_INTERRUPTS)
+
 static void hal_io_init () {
+#if defined(CFG_sx1261_radio) || defined(CFG_sx1262_radio)
+    // NSS, BUSY and DIO1 are required, the other DIO pins are not used
+    ASSERT(lmic_pins.nss != LMIC_UNUSED_PIN);
+    ASSERT(lmic_pins.busy != LMIC_UNUSED_PIN);
+    ASSERT(lmic_pins.dio[1] != LMIC_UNUSED_PIN);
+
+    pinMode(lmic_pins.busy, INPUT);
+#else
     // NSS and DIO0 are required, DIO1 is required for LoRa, DIO2 for FSK
     ASSERT(lmic_pins.nss != LMIC_UNUSED_PIN);
     ASSERT(lmic_pins.dio[0] != LMIC_UNUSED_PIN);
     ASSERT(lmic_pins.dio[1] != LMIC_UNUSED_PIN || lmic_pins.dio[2] != LMIC_UNUSED_PIN);
+#endif
 
     pinMode(lmic_pins.nss, OUTPUT);
     if (lmic_pins.rxtx != LMIC_UNUSED_PIN)
@@ -31,11 +94,16 @@ static void hal_io_init () {
     if (lmic_pins.rst != LMIC_UNUSED_PIN)
         pinMode(lmic_pins.rst, OUTPUT);
 
-    pinMode(lmic_pins.dio[0], INPUT);
+    if (lmic_pins.dio[0] != LMIC_UNUSED_PIN)
+        pinMode(lmic_pins.dio[0], INPUT);
     if (lmic_pins.dio[1] != LMIC_UNUSED_PIN)
         pinMode(lmic_pins.dio[1], INPUT);
     if (lmic_pins.dio[2] != LMIC_UNUSED_PIN)
         pinMode(lmic_pins.dio[2], INPUT);
+
+#if defined(LMIC_USE_INTERRUPTS)
+    hal_interrupt_init();
+#endif
 }
 
 // val == 1  => tx 1
@@ -57,8 +125,33 @@ void hal_pin_rst (u1_t val) {
     }
 }
 
-static bool dio_states[NUM_DIO] = {0};
+#if defined(LMIC_USE_INTERRUPTS)
+static u4_t ticks_at (uint32_t us);
 
+static void hal_io_check() {
+    noInterrupts();
+    uint8_t pending = interrupt_pending;
+    uint32_t times[NUM_DIO];
+    for (uint8_t i = 0; i < NUM_DIO; ++i)
+        times[i] = interrupt_time[i];
+    interrupt_pending = 0;
+    interrupts();
+
+    if (!pending)
+        return;
+    // Convert the edge times to ticks by going back from now, in scaled
+    // micros() units, which wrap at 32 - US_PER_OSTICK_EXPONENT bits.
+    uint32_t us = micros();
+    u4_t now = ticks_at(us);
+    const uint32_t mask = 0xFFFFFFFF >> US_PER_OSTICK_EXPONENT;
+    for (uint8_t i = 0; i < NUM_DIO; ++i) {
+        if (pending & (1 << i)) {
+            uint32_t age = ((us >> US_PER_OSTICK_EXPONENT) - (times[i] >> US_PER_OSTICK_EXPONENT)) & mask;
+            radio_irq_handler_at(i, now - age);
+        }
+    }
+}
+#else // defined(LMIC_USE_INTERRUPTS)
 static void hal_io_check() {
     uint8_t i;
     for (i = 0; i < NUM_DIO; ++i) {
@@ -72,6 +165,7 @@ static void hal_io_check() {
         }
     }
 }
+#endif // defined(LMIC_USE_INTERRUPTS)
 
 // -----------------------------------------------------------------------------
 // SPI
@@ -82,28 +176,54 @@ static void hal_spi_init () {
     SPI.begin();
 }
 
-void hal_pin_nss (u1_t val) {
-    if (!val)
-        SPI.beginTransaction(settings);
-    else
-        SPI.endTransaction();
+static void hal_spi_select () {
+    SPI.beginTransaction(settings);
+    digitalWrite(lmic_pins.nss, 0);
+}
 
-    //Serial.println(val?">>":"<<");
-    digitalWrite(lmic_pins.nss, val);
+static void hal_spi_deselect () {
+    digitalWrite(lmic_pins.nss, 1);
+    SPI.endTransaction();
 }
 
-// perform SPI transaction with radio
-u1_t hal_spi (u1_t out) {
-    u1_t res = SPI.transfer(out);
-/*
-    Serial.print(">");
-    Serial.print(out, HEX);
-    Serial.print("<");
-    Serial.println(res, HEX);
-    */
-    return res;
+#if !defined(CFG_sx1261_radio) && !defined(CFG_sx1262_radio)
+void hal_spi_write (u1_t cmd, const u1_t* buf, u1_t len) {
+    hal_spi_select();
+    SPI.transfer(cmd);
+    for (u1_t i = 0; i < len; i++)
+        SPI.transfer(buf[i]);
+    hal_spi_deselect();
 }
 
+void hal_spi_read (u1_t cmd, u1_t* buf, u1_t len) {
+    hal_spi_select();
+    SPI.transfer(cmd);
+    // The radio ignores what is written while reading, so let the
+    // block transfer overwrite the zeroed buffer in place.
+    memset(buf, 0, len);
+    SPI.transfer(buf, len);
+    hal_spi_deselect();
+}
+#else
+void hal_spi_cmd (const u1_t* cmd, u1_t cmdlen, u1_t* buf, u1_t len, bit_t read) {
+    hal_spi_select();
+    // Selecting the radio wakes it from sleep, it raises BUSY until it
+    // is ready to accept the command
+    while (digitalRead(lmic_pins.busy))
+        ;
+    for (u1_t i = 0; i < cmdlen; i++)
+        SPI.transfer(cmd[i]);
+    if (read) {
+        memset(buf, 0, len);
+        SPI.transfer(buf, len);
+    } else {
+        for (u1_t i = 0; i < len; i++)
+            SPI.transfer(buf[i]);
+    }
+    hal_spi_deselect();
+}
+#endif
+
 // -----------------------------------------------------------------------------
 // TIME
 
@@ -111,7 +231,12 @@ static void hal_time_init () {
     // Nothing to do
 }
 
-u4_t hal_ticks () {
+// Returns the ticks for the given micros() value, which must not be
+// older than any value passed before. This updates the overflow state
+// with a read-modify-write, so it must never run from an interrupt
+// handler, which could interrupt another call and apply an overflow
+// twice.
+static u4_t ticks_at (uint32_t us) {
     // Because micros() is scaled down in this function, micros() will
     // overflow before the tick timer should, causing the tick timer to
     // miss a significant part of its values if not corrected. To fix
@@ -135,7 +260,7 @@ u4_t hal_ticks () {
 
     // Scaled down timestamp. The top US_PER_OSTICK_EXPONENT bits are 0,
     // the others will be the lower bits of our return value.
-    uint32_t scaled = micros() >> US_PER_OSTICK_EXPONENT;
+    uint32_t scaled = us >> US_PER_OSTICK_EXPONENT;
     // Most significant byte of scaled
     uint8_t msb = scaled >> 24;
     // Mask pointing to the overlapping bit in msb and overflow.
@@ -156,6 +281,10 @@ u4_t hal_ticks () {
     static_assert(US_PER_OSTICK_EXPONENT > 0 && US_PER_OSTICK_EXPONENT < 8, "Invalid US_PER_OSTICK_EXPONENT value");
 }
 
+u4_t hal_ticks () {
+    return ticks_at(micros());
+}
+
 // Returns the number of ticks until time. Negative values indicate that
 // time has already passed.
 static s4_t delta_time(u4_t time) {
@@ -174,21 +303,77 @@ void hal_waitUntil (u4_t time) {
         delayMicroseconds(delta * US_PER_OSTICK);
 }
 
+#if defined(LMIC_IDLE_SLEEP)
+// Target of the timer set up by hal_checkTimer, used by hal_sleep
+static u4_t wakeup;
+static bool wakeup_armed;
+#endif
+
+#if defined(LMIC_RX_TIMER)
+#if defined(LMIC_MULTI_INSTANCE)
+#define rxtimer       (((lmic_hal_t*)lmic_ctx->hal)->rxtimer)
+#define rxtimer_armed (((lmic_hal_t*)lmic_ctx->hal)->rxtimer_armed)
+#else
+static u4_t rxtimer;
+static bool rxtimer_armed;
+#endif
+
+// There is no hardware timer to spare, so the timer is polled like the
+// DIO pins (see hal_enableIRQs). hal_sleep stops sleeping when it gets
+// close.
+void hal_setRxTimer (u4_t time) {
+    rxtimer = time;
+    rxtimer_armed = true;
+}
+
+void hal_clearRxTimer () {
+    rxtimer_armed = false;
+}
+
+static void hal_rxtimer_check () {
+    if (rxtimer_armed && delta_time(rxtimer) <= 0) {
+        rxtimer_armed = false;
+        radio_rxtimer_handler();
+    }
+}
+#endif
+
 // check and rewind for target time
 u1_t hal_checkTimer (u4_t time) {
-    // No need to schedule wakeup, since we're not sleeping
-    return delta_time(time) <= 0;
+    if (delta_time(time) <= 0) {
+#if defined(LMIC_IDLE_SLEEP)
+        wakeup_armed = false;
+#endif
+        return 1;
+    }
+#if defined(LMIC_IDLE_SLEEP)
+    // There is no separate wakeup timer, the timer interrupt of the
+    // Arduino core wakes up hal_sleep often enough to check this.
+    wakeup = time;
+    wakeup_armed = true;
+#endif
+    return 0;
 }
 
 static uint8_t irqlevel = 0;
+#if defined(LMIC_OS_STATS)
+static u4_t irqoff_start;
+#endif
 
 void hal_disableIRQs () {
     noInterrupts();
+#if defined(LMIC_OS_STATS)
+    if(irqlevel == 0)
+        irqoff_start = hal_ticks();
+#endif
     irqlevel++;
 }
 
 void hal_enableIRQs () {
     if(--irqlevel == 0) {
+#if defined(LMIC_OS_STATS)
+        os_noteIrqOff(hal_ticks() - irqoff_start);
+#endif
         interrupts();
 
         // Instead of using proper interrupts (which are a bit tricky
@@ -199,14 +384,126 @@ void hal_enableIRQs () {
         //
         // As an additional bonus, this prevents the can of worms that
         // we would otherwise get for running SPI transfers inside ISRs
+        //
+        // With LMIC_USE_INTERRUPTS, this handles the edges that the
+        // interrupt handlers recorded instead.
         hal_io_check();
+#if defined(LMIC_RX_TIMER)
+        hal_rxtimer_check();
+#endif
+    }
+}
+
+#if defined(LMIC_IDLE_SLEEP)
+// Do not sleep when the next job is this close, since waking up again
+// can take up to a timer tick (about 1ms at 16Mhz, 2ms at 8Mhz) and
+// LMIC only starts the RX windows a little early.
+#define SLEEP_MARGIN ms2osticks(3)
+
+static bool hal_io_changed () {
+#if defined(LMIC_USE_INTERRUPTS)
+    return interrupt_pending != 0;
+#else
+    for (uint8_t i = 0; i < NUM_DIO; ++i) {
+        if (lmic_pins.dio[i] != LMIC_UNUSED_PIN && dio_states[i] != digitalRead(lmic_pins.dio[i]))
+            return true;
     }
+    return false;
+#endif
 }
+#endif
 
 void hal_sleep () {
-    // Not implemented
+#if defined(LMIC_IDLE_SLEEP)
+    // Called with interrupts disabled. Keep the CPU in idle mode until
+    // the wakeup time set by hal_checkTimer is close, or a DIO pin
+    // changes (which is handled by hal_io_check once interrupts are
+    // enabled again). Timers keep running in idle mode, so micros()
+    // stays accurate, and the millis() interrupt wakes us up at
+    // least once every timer tick to check.
+    while (!wakeup_armed || delta_time(wakeup) > SLEEP_MARGIN) {
+        if (hal_io_changed())
+            break;
+#if defined(LMIC_RX_TIMER)
+        if (rxtimer_armed && delta_time(rxtimer) <= SLEEP_MARGIN)
+            break;
+#endif
+#if defined(__AVR__)
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sleep_enable();
+        // The instruction after sei is always executed before any
+        // interrupt, so an interrupt cannot slip in before sleeping.
+        sei();
+        sleep_cpu();
+        cli();
+        sleep_disable();
+#elif defined(__arm__)
+        // wfi also returns for interrupts that are disabled, let the
+        // handler run afterwards.
+        __asm__ volatile ("wfi");
+        interrupts();
+        noInterrupts();
+#else
+        // No known way to sleep, just let the handlers run
+        interrupts();
+        noInterrupts();
+#endif
+    }
+    wakeup_armed = false;
+#endif
+#if defined(LMIC_OS_STATS)
+    // Interrupts were enabled while sleeping
+    irqoff_start = hal_ticks();
+#endif
 }
 
+#if defined(LMIC_SAVE_RAND_SEED)
+// -----------------------------------------------------------------------------
+// RANDOM SEED
+
+// On AVR, the .noinit section is not cleared on reset, so the seed
+// survives a reset (but not a power cycle, which is caught by the check
+// value). Elsewhere, nothing is saved by default. In both cases, a
+// sketch can replace these functions, e.g. to keep the seed in RTC
+// memory.
+#if defined(__AVR__)
+static struct {
+    u1_t seed[16];
+    u2_t check;
+} saved_seed __attribute__((section(".noinit")));
+
+static u2_t seed_check (const u1_t* seed) {
+    u1_t a = 0x5a, b = 0xa5;
+    for (u1_t i = 0; i < 16; i++) {
+        a += seed[i];
+        b += a;
+    }
+    return (a << 8) | b;
+}
+
+__attribute__((weak)) bit_t hal_loadRandSeed (u1_t* seed) {
+    if (saved_seed.check != seed_check(saved_seed.seed))
+        return 0;
+    memcpy(seed, saved_seed.seed, 16);
+    return 1;
+}
+
+__attribute__((weak)) void hal_saveRandSeed (const u1_t* seed) {
+    memcpy(saved_seed.seed, seed, 16);
+    saved_seed.check = seed_check(seed);
+}
+#else // defined(__AVR__)
+__attribute__((weak)) bit_t hal_loadRandSeed (u1_t* seed) {
+    (void)seed;
+    return 0;
+}
+
+__attribute__((weak)) void hal_saveRandSeed (const u1_t* seed) {
+    (void)seed;
+}
+#endif // defined(__AVR__)
+#endif // defined(LMIC_SAVE_RAND_SEED)
+
 // -----------------------------------------------------------------------------
 
 #if defined(LMIC_PRINTF_TO)
@@ -259,6 +556,9 @@ void hal_printf_init() {
 void hal_init () {
     // configure radio I/O and interrupt handler
     hal_io_init();
+#if defined(LMIC_RX_TIMER)
+    rxtimer_armed = false;
+#endif
     // configure radio SPI
     hal_spi_init();
     // configure timer and interrupt handler
@@ -280,3 +580,5 @@ void hal_failed (const char *file, u2_t line) {
     hal_disableIRQs();
     while(1);
 }
+
+#endif // defined(USE_ARDUINO_HAL)
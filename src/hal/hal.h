@@ -10,6 +10,36 @@
 #ifndef _hal_hal_h_
 #define _hal_hal_h_
 
+#if defined(USE_SIM_HAL)
+#include "sim.h"
+
+#elif defined(USE_POSIX_HAL)
+#include "radio_sim.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// The simulated radio driven by the POSIX HAL. The application can set
+// its ontx callback to see transmitted frames and use
+// radio_sim_receive() to offer downlinks to it.
+struct radio_sim* hal_posix_radio (void);
+
+// Power accounting of the POSIX HAL, in ticks since hal_init(). Time
+// that LMIC spends busy-waiting or running code counts as awake, only
+// time in hal_sleep() counts as asleep.
+struct hal_posix_power {
+    uint64_t total;
+    uint64_t asleep;
+};
+void hal_posix_getPower (struct hal_posix_power* power);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#else // Arduino HAL
+
 static const int NUM_DIO = 3;
 
 struct lmic_pinmap {
@@ -17,12 +47,32 @@ struct lmic_pinmap {
     u1_t rxtx;
     u1_t rst;
     u1_t dio[NUM_DIO];
+#if defined(CFG_sx1261_radio) || defined(CFG_sx1262_radio)
+    // The SX126x signals all interrupts on DIO1 and needs its BUSY pin
+    u1_t busy;
+#endif
 };
 
 // Use this for any unused pins.
 const u1_t LMIC_UNUSED_PIN = 0xff;
 
+#if defined(LMIC_MULTI_INSTANCE)
+// With multiple instances, every instance drives its own radio. Point
+// the hal member of each lmic_ctx_t to one of these, with pins set to
+// the pinmap of its radio.
+struct lmic_hal_t {
+    const lmic_pinmap* pins;
+    bool dio_states[NUM_DIO];
+#if defined(LMIC_RX_TIMER)
+    u4_t rxtimer;
+    bool rxtimer_armed;
+#endif
+};
+#else
 // Declared here, to be defined an initialized by the application
 extern const lmic_pinmap lmic_pins;
+#endif
+
+#endif // defined(USE_SIM_HAL) / defined(USE_POSIX_HAL)
 
 #endif // _hal_hal_h_
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * This the HAL to run LMIC as a normal process on a POSIX (e.g. Linux)
+ * host. Instead of a real radio, the SPI and DIO lines are connected to
+ * an in-process model of the radio (see radio_sim.h).
+ *******************************************************************************/
+
+#include "../lmic/config.h"
+
+#if defined(USE_POSIX_HAL)
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime and nanosleep
+#include <time.h>
+#include <stdlib.h>
+#include "../lmic.h"
+#include "hal.h"
+
+// Longest time hal_sleep() blocks when no job or radio event is
+// pending, so the application still gets to run its own code in
+// between calls to os_runloop_once().
+#define MAX_SLEEP_TICKS ms2osticks(10)
+
+// State of a single radio and its I/O lines
+struct posix_hal {
+    struct radio_sim  radio;
+    u1_t              dio_states;
+    u1_t              rst_asserted;
+    u1_t              irqlevel;
+#if defined(LMIC_OS_STATS)
+    u4_t              irqoff_start;
+#endif
+    // Target of the timer set up by hal_checkTimer, used by hal_sleep
+    u4_t              wakeup;
+    u1_t              wakeup_armed;
+#if defined(LMIC_RX_TIMER)
+    // Timer set up by hal_setRxTimer
+    u4_t              rxtimer;
+    u1_t              rxtimer_armed;
+#endif
+    // Power accounting, see hal_posix_getPower()
+    uint64_t          start;
+    uint64_t          asleep;
+#if defined(LMIC_SAVE_RAND_SEED)
+    // Only kept in memory, so it survives os_init() but not a restart
+    // of the process
+    u1_t              rand_seed[16];
+    u1_t              rand_seed_valid;
+#endif
+};
+
+#if defined(LMIC_MULTI_INSTANCE)
+// Every instance has its own radio, allocated on first use unless the
+// application set lmic_ctx->hal itself.
+#define HAL (*(struct posix_hal*)lmic_ctx->hal)
+#else
+static struct posix_hal state;
+#define HAL state
+#endif
+
+#define radio        (HAL.radio)
+#define dio_states   (HAL.dio_states)
+#define rst_asserted (HAL.rst_asserted)
+#define irqlevel     (HAL.irqlevel)
+#define wakeup       (HAL.wakeup)
+#define wakeup_armed (HAL.wakeup_armed)
+#define rxtimer       (HAL.rxtimer)
+#define rxtimer_armed (HAL.rxtimer_armed)
+
+struct radio_sim* hal_posix_radio () {
+    return &radio;
+}
+
+// -----------------------------------------------------------------------------
+// I/O
+
+static void hal_io_init () {
+    radio_sim_reset(&radio, hal_ticks());
+}
+
+// val == 1  => tx 1
+void hal_pin_rxtx (u1_t val) {
+    // The antenna switch is not modeled
+    (void)val;
+}
+
+// set radio RST pin to given value (or keep floating!)
+void hal_pin_rst (u1_t val) {
+    // Driving the pin starts a reset, releasing it ends it. The pin
+    // polarity differs between the SX1272 and SX1276, but radio.c only
+    // ever drives it to its active level.
+    if (val == 0 || val == 1) {
+        rst_asserted = 1;
+    } else if (rst_asserted) {
+        rst_asserted = 0;
+        radio_sim_reset(&radio, hal_ticks());
+        dio_states = 0;
+    }
+}
+
+static void hal_io_check () {
+    // Like a real edge interrupt, timestamp DIO changes with the time
+    // the model raised them, not the time they are noticed.
+    u4_t ticks = hal_ticks(), when = ticks;
+    if (!radio_sim_nextEvent(&radio, &when) || (s4_t)(ticks - when) < 0)
+        when = ticks;
+    u1_t now = radio_sim_update(&radio, ticks);
+    u1_t rising = now & ~dio_states;
+    dio_states = now;
+    for (u1_t i = 0; i < 3; ++i) {
+        if (rising & (1 << i))
+            radio_irq_handler_at(i, when);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SPI
+
+#if !defined(CFG_sx126x_radio)
+void hal_spi_write (u1_t cmd, const u1_t* buf, u1_t len) {
+    u4_t now = hal_ticks();
+    radio_sim_nss(&radio, 0, now);
+    radio_sim_spi(&radio, cmd, now);
+    for (u1_t i = 0; i < len; i++)
+        radio_sim_spi(&radio, buf[i], now);
+    radio_sim_nss(&radio, 1, now);
+}
+
+void hal_spi_read (u1_t cmd, u1_t* buf, u1_t len) {
+    u4_t now = hal_ticks();
+    radio_sim_nss(&radio, 0, now);
+    radio_sim_spi(&radio, cmd, now);
+    for (u1_t i = 0; i < len; i++)
+        buf[i] = radio_sim_spi(&radio, 0x00, now);
+    radio_sim_nss(&radio, 1, now);
+}
+#else
+void hal_spi_cmd (const u1_t* cmd, u1_t cmdlen, u1_t* buf, u1_t len, bit_t read) {
+    u4_t until;
+    radio_sim_nss(&radio, 0, hal_ticks());
+    if (radio_sim_busy(&radio, hal_ticks(), &until))
+        hal_waitUntil(until);
+    u4_t now = hal_ticks();
+    for (u1_t i = 0; i < cmdlen; i++)
+        radio_sim_spi(&radio, cmd[i], now);
+    for (u1_t i = 0; i < len; i++) {
+        if (read)
+            buf[i] = radio_sim_spi(&radio, 0x00, now);
+        else
+            radio_sim_spi(&radio, buf[i], now);
+    }
+    radio_sim_nss(&radio, 1, now);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// TIME
+
+static struct timespec epoch;
+static u1_t epoch_set;
+
+static void hal_time_init () {
+    // All instances share the same clock
+    if (!epoch_set)
+        clock_gettime(CLOCK_MONOTONIC, &epoch);
+    epoch_set = 1;
+}
+
+// Like hal_ticks, but without wrapping around
+static uint64_t ticks64 () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t us = (int64_t)(ts.tv_sec - epoch.tv_sec) * 1000000
+               + (ts.tv_nsec - epoch.tv_nsec) / 1000;
+    return (uint64_t)us >> US_PER_OSTICK_EXPONENT;
+}
+
+u4_t hal_ticks () {
+    return (u4_t)ticks64();
+}
+
+// Returns the number of ticks until time. Negative values indicate that
+// time has already passed.
+static s4_t delta_time (u4_t time) {
+    return (s4_t)(time - hal_ticks());
+}
+
+static void sleep_ticks (s4_t ticks) {
+    if (ticks <= 0)
+        return;
+    int64_t us = (int64_t)ticks << US_PER_OSTICK_EXPONENT;
+    struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) != 0)
+        ; // Interrupted by a signal, sleep the remainder
+}
+
+void hal_waitUntil (u4_t time) {
+    sleep_ticks(delta_time(time));
+}
+
+// check and rewind for target time
+u1_t hal_checkTimer (u4_t time) {
+    if (delta_time(time) <= 0) {
+        wakeup_armed = 0;
+        return 1;
+    }
+    wakeup = time;
+    wakeup_armed = 1;
+    return 0;
+}
+
+#if defined(LMIC_RX_TIMER)
+void hal_setRxTimer (u4_t time) {
+    rxtimer = time;
+    rxtimer_armed = 1;
+}
+
+void hal_clearRxTimer () {
+    rxtimer_armed = 0;
+}
+
+static void hal_rxtimer_check () {
+    if (rxtimer_armed && delta_time(rxtimer) <= 0) {
+        rxtimer_armed = 0;
+        radio_rxtimer_handler();
+    }
+}
+#endif
+
+void hal_disableIRQs () {
+#if defined(LMIC_OS_STATS)
+    if (irqlevel == 0)
+        HAL.irqoff_start = hal_ticks();
+#endif
+    irqlevel++;
+}
+
+void hal_enableIRQs () {
+    if (--irqlevel == 0) {
+#if defined(LMIC_OS_STATS)
+        os_noteIrqOff(hal_ticks() - HAL.irqoff_start);
+#endif
+        // There are no real interrupts, so poll the radio model on
+        // every outermost enable, just like the Arduino HAL polls the
+        // DIO pins.
+        hal_io_check();
+#if defined(LMIC_RX_TIMER)
+        hal_rxtimer_check();
+#endif
+    }
+}
+
+void hal_sleep () {
+#if defined(LMIC_MULTI_INSTANCE)
+    // Other instances might need to run before this one wakes up, so
+    // leave sleeping to the application.
+    wakeup_armed = 0;
+#else
+    // Sleep until the timer set by hal_checkTimer expires or the radio
+    // model has something to report, whichever comes first.
+    s4_t ticks = MAX_SLEEP_TICKS;
+    u4_t event;
+    if (wakeup_armed && delta_time(wakeup) < ticks)
+        ticks = delta_time(wakeup);
+    if (radio_sim_nextEvent(&radio, &event) && delta_time(event) < ticks)
+        ticks = delta_time(event);
+#if defined(LMIC_RX_TIMER)
+    if (rxtimer_armed && delta_time(rxtimer) < ticks)
+        ticks = delta_time(rxtimer);
+#endif
+    wakeup_armed = 0;
+    uint64_t before = ticks64();
+    sleep_ticks(ticks);
+    HAL.asleep += ticks64() - before;
+#endif
+#if defined(LMIC_OS_STATS)
+    // Not counted as time with interrupts disabled
+    HAL.irqoff_start = hal_ticks();
+#endif
+}
+
+void hal_posix_getPower (struct hal_posix_power* power) {
+    power->total = ticks64() - HAL.start;
+    power->asleep = HAL.asleep;
+}
+
+#if defined(LMIC_SAVE_RAND_SEED)
+// -----------------------------------------------------------------------------
+// RANDOM SEED
+
+bit_t hal_loadRandSeed (u1_t* seed) {
+    if (!HAL.rand_seed_valid)
+        return 0;
+    os_copyMem(seed, HAL.rand_seed, 16);
+    return 1;
+}
+
+void hal_saveRandSeed (const u1_t* seed) {
+    os_copyMem(HAL.rand_seed, seed, 16);
+    HAL.rand_seed_valid = 1;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+void hal_init () {
+#if defined(LMIC_MULTI_INSTANCE)
+    if (!lmic_ctx->hal)
+        lmic_ctx->hal = calloc(1, sizeof(struct posix_hal));
+    ASSERT(lmic_ctx->hal != NULL);
+#endif
+    // configure radio I/O
+    hal_io_init();
+#if defined(LMIC_RX_TIMER)
+    rxtimer_armed = 0;
+#endif
+    // configure timer
+    hal_time_init();
+    HAL.start = ticks64();
+    HAL.asleep = 0;
+}
+
+void hal_failed (const char *file, u2_t line) {
+    fprintf(stderr, "FAILURE %s:%u\n", file, line);
+    fflush(stdout);
+    abort();
+}
+
+#endif // defined(USE_POSIX_HAL)
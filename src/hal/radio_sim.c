@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Parts of the radio model that do not depend on the chip: what the
+ * receiver picks up, the noise generator and the event queue.
+ *******************************************************************************/
+
+#include "../lmic/config.h"
+
+#if defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
+
+#include "radio_sim.h"
+
+// Number of preamble symbols in a LoRaWAN frame and the number of them
+// the receiver needs to lock on.
+#define PREAMBLE_SYMS 8
+#define LOCK_SYMS     4
+// Likewise for FSK, in bytes
+#define FSK_PREAMBLE_BYTES 5
+#define FSK_LOCK_BYTES     2
+
+// The SX127x frequency registers have a resolution of 61Hz
+static bit_t sameFreq (u4_t a, u4_t b) {
+    return (a > b ? a - b : b - a) < 62;
+}
+
+bit_t radio_sim_locks (struct radio_sim* radio, u4_t freq, rps_t rps, ostime_t sym, u4_t timeout, bit_t continuous) {
+    bit_t fsk = getSf(rps) == FSK;
+
+    if (!radio->rxpending
+        || !sameFreq(radio->rxframe.freq, freq)
+        || !sameSfBw(radio->rxframe.rps, rps))
+        return 0;
+    // The receiver locks onto the preamble after a few symbols,
+    // provided enough of the preamble is left when it starts.
+    u4_t from = (s4_t)(radio->rxstart - radio->rxframe.start) > 0 ? radio->rxstart : radio->rxframe.start;
+    u4_t lock = from + sym * (fsk ? FSK_LOCK_BYTES : LOCK_SYMS);
+    u4_t last = radio->rxframe.start + sym * (fsk ? FSK_PREAMBLE_BYTES : PREAMBLE_SYMS);
+    return (s4_t)(lock - last) <= 0
+        && (continuous || (s4_t)(lock - timeout) <= 0);
+}
+
+// xorshift32, only used to produce noise for the wideband RSSI register
+u1_t radio_sim_noise (struct radio_sim* radio) {
+    u4_t x = radio->rnd;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    radio->rnd = x;
+    return (u1_t)x;
+}
+
+bit_t radio_sim_nextEvent (struct radio_sim* radio, u4_t* time) {
+    if (radio->event == SIM_EV_NONE)
+        return 0;
+    *time = radio->eventTime;
+    return 1;
+}
+
+#endif // defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
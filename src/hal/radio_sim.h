@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * In-process model of the radio, used by the host HALs in place of a
+ * real one. Like the radio driver, the model is selected at compile
+ * time: sx127x_sim.c models the SX1272/SX1276 register interface,
+ * sx126x_sim.c the SX1261/SX1262 command interface.
+ *******************************************************************************/
+#ifndef _hal_radio_sim_h_
+#define _hal_radio_sim_h_
+
+#include "../lmic/radio.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+struct radio_sim;
+
+// A frame on the air, as transmitted or received by the model.
+struct radio_sim_frame {
+    u4_t   freq;   // carrier frequency in Hz
+    rps_t  rps;    // radio parameters (FSK or LoRa SF/BW/CR)
+    u4_t   start;  // start of the preamble (ticks)
+    u4_t   end;    // end of the last symbol (ticks)
+    s1_t   snr;    // SNR in dB (RX only)
+    s2_t   rssi;   // RSSI in dBm (RX only)
+    u1_t   len;
+    u1_t   data[256];
+};
+
+// Called when the model starts transmitting a frame. Since the airtime
+// is known up front, frame->end is already filled in.
+typedef void (*radio_sim_txcb_t) (struct radio_sim* radio, const struct radio_sim_frame* frame);
+
+// Events scheduled inside the model
+enum { SIM_EV_NONE = 0, SIM_EV_TXDONE, SIM_EV_RXDONE, SIM_EV_RXTOUT };
+
+struct radio_sim {
+#if defined(CFG_sx126x_radio)
+    u1_t  cmd[258];        // opcode and arguments of the current command
+    u2_t  pos;             // bytes clocked in the current transaction
+    u1_t  sleeping;        // in sleep mode, woken by NSS going low
+    u1_t  mode;            // chip mode, as reported in the status byte
+    u4_t  busyUntil;       // BUSY is high until then (ticks)
+    u1_t  packetType;
+    u4_t  frf;             // SetRfFrequency argument
+    u1_t  modParams[8];    // SetModulationParams arguments
+    u1_t  pktParams[9];    // SetPacketParams arguments
+    u2_t  irq;             // interrupt flags
+    u2_t  irqMask;
+    u2_t  dio1Mask;
+    u1_t  symbTimeout;     // SetLoRaSymbNumTimeout argument
+    u4_t  rxTimeout;       // SetRx argument
+    u1_t  txBase;          // buffer base addresses
+    u1_t  rxBase;
+    u1_t  rxLen;           // length of the last received frame
+    u1_t  pktStatus[3];    // GetPacketStatus result for it
+    u1_t  regs[0x400];     // registers 0x0600-0x09FF
+    u1_t  buffer[256];     // data buffer
+#else
+    u1_t  regs[128];       // register file
+    u1_t  fifo[256];       // packet fifo
+    u1_t  fskptr;          // fifo pointer in FSK mode
+    u1_t  addr;            // current SPI address (auto-incremented)
+    u1_t  first;           // next SPI byte is the address byte
+#endif
+    u1_t  selected;        // NSS is low
+    u1_t  dio;             // DIO line levels, bit n is DIOn
+    u1_t  event;           // pending SIM_EV_xxx
+    u4_t  eventTime;       // when the pending event fires (ticks)
+    u4_t  rxstart;         // when the receiver was started (ticks)
+    u4_t  rnd;             // state of the wideband RSSI noise generator
+    bit_t rxpending;       // rxframe holds a frame waiting to be received
+    struct radio_sim_frame rxframe;
+    radio_sim_txcb_t ontx; // optional transmit callback
+    void* user;            // free for use by the owner of the model
+};
+
+// Put the model in its power-on state. Callbacks and user data are kept.
+void radio_sim_reset (struct radio_sim* radio, u4_t now);
+
+// SPI access, mirroring the pins driven by the HAL.
+void radio_sim_nss (struct radio_sim* radio, u1_t val, u4_t now);
+u1_t radio_sim_spi (struct radio_sim* radio, u1_t out, u4_t now);
+
+// Returns 1 and stores when the BUSY line goes low if it is high at the
+// given time. The SX127x has no BUSY line, so it always returns 0.
+bit_t radio_sim_busy (struct radio_sim* radio, u4_t now, u4_t* until);
+
+// Fire any events that are due at the given time and update the DIO
+// levels. Returns the DIO levels.
+u1_t radio_sim_update (struct radio_sim* radio, u4_t now);
+
+// Returns 1 and stores the time of the next internal event if there is
+// one pending.
+bit_t radio_sim_nextEvent (struct radio_sim* radio, u4_t* time);
+
+// Offer a frame to the receiver. The frame is received when the radio
+// is listening on the same frequency and SF/BW in time for its
+// preamble. The frame stays queued until it was received or a newer
+// frame is offered.
+void radio_sim_receive (struct radio_sim* radio, const struct radio_sim_frame* frame);
+
+// Decode the current frequency and radio parameters from the model
+// state. plen is used for implicit header mode only.
+u4_t  radio_sim_freq (struct radio_sim* radio);
+rps_t radio_sim_rps (struct radio_sim* radio, u1_t plen);
+
+// Shared by the chip models (radio_sim.c)
+
+// Decide whether a receiver that was started at radio->rxstart with the
+// given frequency and radio parameters picks up the queued frame. sym
+// is the duration of a symbol (LoRa) or byte (FSK). A single rx gives
+// up at timeout, a continuous one keeps listening.
+bit_t radio_sim_locks (struct radio_sim* radio, u4_t freq, rps_t rps, ostime_t sym, u4_t timeout, bit_t continuous);
+
+// Next byte of wideband RSSI noise
+u1_t radio_sim_noise (struct radio_sim* radio);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _hal_radio_sim_h_
@@ -0,0 +1,456 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * This the HAL for simulation builds (LMIC_SIMULATION). Every node has
+ * its own LMIC instance and simulated radio. Nodes are kept in a heap
+ * ordered by the next time they need to run, and the virtual clock
+ * jumps straight from one wakeup to the next, so no time is spent
+ * waiting.
+ *
+ * All uplinks go to a single gateway that hears every node. Uplinks
+ * that overlap in time on the same frequency and SF/BW are lost.
+ *******************************************************************************/
+
+#include "../lmic/config.h"
+
+#if defined(USE_SIM_HAL)
+
+#include <stdlib.h>
+#include "../lmic.h"
+#include "hal.h"
+
+#define NODE ((struct sim_node*)lmic_ctx->hal)
+
+static simtime_t simtime;
+
+// Nodes, as a binary min-heap on their wake time
+static struct sim_node** heap;
+static u4_t heapn, heapcap;
+
+// Uplinks currently on the air
+struct airframe {
+    struct sim_node*        node;
+    simtime_t               start;
+    simtime_t               end;
+    bit_t                   collided;
+    struct radio_sim_frame frame;
+};
+static struct airframe* air;
+static u4_t airn, aircap;
+
+static struct sim_stats stats;
+static sim_uplinkcb_t onuplink;
+
+// -----------------------------------------------------------------------------
+// Node heap
+
+static bit_t earlier (u4_t a, u4_t b) {
+    return heap[a]->wake < heap[b]->wake;
+}
+
+static void swap (u4_t a, u4_t b) {
+    struct sim_node* n = heap[a];
+    heap[a] = heap[b];
+    heap[b] = n;
+    heap[a]->heapidx = a;
+    heap[b]->heapidx = b;
+}
+
+static void siftUp (u4_t i) {
+    while (i > 0 && earlier(i, (i-1)/2)) {
+        swap(i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void siftDown (u4_t i) {
+    while (1) {
+        u4_t min = i, l = 2*i+1, r = 2*i+2;
+        if (l < heapn && earlier(l, min)) min = l;
+        if (r < heapn && earlier(r, min)) min = r;
+        if (min == i)
+            return;
+        swap(i, min);
+        i = min;
+    }
+}
+
+static void setWake (struct sim_node* node, simtime_t wake) {
+    simtime_t old = node->wake;
+    node->wake = wake < simtime ? simtime : wake;
+    if (node->wake < old)
+        siftUp(node->heapidx);
+    else
+        siftDown(node->heapidx);
+}
+
+// Convert a 32-bit LMIC timestamp near the node's current time
+static simtime_t toSimtime (struct sim_node* node, u4_t time) {
+    return node->now + (s4_t)(time - (u4_t)node->now);
+}
+
+// Wake the node for whatever comes first: its timer or its radio
+static void reschedule (struct sim_node* node) {
+    simtime_t wake = node->timerArmed ? node->timer : SIM_NEVER;
+    u4_t event;
+    if (radio_sim_nextEvent(&node->radio, &event) && toSimtime(node, event) < wake)
+        wake = toSimtime(node, event);
+#if defined(LMIC_RX_TIMER)
+    if (node->rxTimerArmed && node->rxTimer < wake)
+        wake = node->rxTimer;
+#endif
+    setWake(node, wake);
+}
+
+// -----------------------------------------------------------------------------
+// Gateway
+
+static void ontx (struct radio_sim* radio, const struct radio_sim_frame* frame) {
+    struct sim_node* node = (struct sim_node*)radio->user;
+    simtime_t start = toSimtime(node, frame->start);
+    simtime_t end = start + (u4_t)(frame->end - frame->start);
+    bit_t collided = 0;
+
+    for (u4_t i = 0; i < airn; i++) {
+        struct airframe* a = &air[i];
+        if (a->start < end && start < a->end
+            && a->frame.freq == frame->freq
+            && sameSfBw(a->frame.rps, frame->rps)) {
+            a->collided = 1;
+            collided = 1;
+        }
+    }
+
+    if (airn == aircap) {
+        aircap = aircap ? 2 * aircap : 16;
+        air = (struct airframe*)realloc(air, aircap * sizeof(*air));
+        ASSERT(air != NULL);
+    }
+    air[airn].node = node;
+    air[airn].start = start;
+    air[airn].end = end;
+    air[airn].collided = collided;
+    air[airn].frame = *frame;
+    airn++;
+
+    stats.uplinks++;
+    stats.airtime += end - start;
+    node->stats.uplinks++;
+    node->stats.airtime += end - start;
+}
+
+// Finish receiving all uplinks that ended at or before the given time
+static void gatewayUpdate (simtime_t until) {
+    for (u4_t i = 0; i < airn; ) {
+        struct airframe a = air[i];
+        if (a.end > until) {
+            i++;
+            continue;
+        }
+        air[i] = air[--airn];
+        if (a.collided) {
+            stats.collided++;
+            a.node->stats.collided++;
+        } else {
+            stats.delivered++;
+            a.node->stats.delivered++;
+            if (onuplink)
+                onuplink(a.node, &a.frame);
+        }
+    }
+}
+
+void sim_downlink (struct sim_node* node, const struct radio_sim_frame* frame) {
+    stats.downlinks++;
+    node->stats.downlinks++;
+    radio_sim_receive(&node->radio, frame);
+    reschedule(node);
+}
+
+void sim_setUplinkCallback (sim_uplinkcb_t cb) {
+    onuplink = cb;
+}
+
+void sim_getStats (struct sim_stats* s) {
+    // Uplinks still on the air are counted once they end
+    *s = stats;
+}
+
+// -----------------------------------------------------------------------------
+// Simulation
+
+simtime_t sim_time () {
+    return simtime;
+}
+
+// Bring the node's clock up to the simulation time. If it went to sleep
+// at node->now, it has been sleeping ever since.
+static void catchUp (struct sim_node* node) {
+    if (node->now >= simtime)
+        return;
+    if (node->sleeping) {
+        stats.asleep += simtime - node->now;
+        node->stats.asleep += simtime - node->now;
+    }
+    node->now = simtime;
+}
+
+void sim_select (struct sim_node* node) {
+    lmic_ctx = &node->ctx;
+    catchUp(node);
+}
+
+struct sim_node* sim_current () {
+    return lmic_ctx ? NODE : NULL;
+}
+
+void sim_node_init (struct sim_node* node, u4_t id) {
+    node->id = id;
+    node->ctx.hal = node;
+    node->radio.user = node;
+    node->radio.ontx = ontx;
+    // Give every radio its own noise, so nodes get different random
+    // seeds in radio_init()
+    node->radio.rnd = (id + 1) * 2654435761u;
+    node->now = simtime;
+    node->wake = simtime;
+
+    if (heapn == heapcap) {
+        heapcap = heapcap ? 2 * heapcap : 64;
+        heap = (struct sim_node**)realloc(heap, heapcap * sizeof(*heap));
+        ASSERT(heap != NULL);
+    }
+    node->heapidx = heapn;
+    heap[heapn++] = node;
+    siftUp(node->heapidx);
+
+    sim_select(node);
+    os_init();
+}
+
+// Run the node until it has nothing left to do and goes to sleep
+static void step (struct sim_node* node) {
+    sim_select(node);
+    node->now = node->wake > node->now ? node->wake : node->now;
+    do {
+        node->sleeping = 0;
+        node->timerArmed = 0;
+        os_runloop_once();
+    } while (!node->sleeping);
+    reschedule(node);
+}
+
+void sim_run (simtime_t until) {
+    while (heapn && heap[0]->wake <= until) {
+        struct sim_node* node = heap[0];
+        gatewayUpdate(node->wake);
+        simtime = node->wake;
+        step(node);
+    }
+    gatewayUpdate(until);
+    if (simtime < until)
+        simtime = until;
+    // Account for the sleep up to now, so the stats are complete
+    for (u4_t i = 0; i < heapn; i++)
+        catchUp(heap[i]);
+}
+
+// -----------------------------------------------------------------------------
+// I/O
+
+// val == 1  => tx 1
+void hal_pin_rxtx (u1_t val) {
+    // The antenna switch is not modeled
+    (void)val;
+}
+
+// set radio RST pin to given value (or keep floating!)
+void hal_pin_rst (u1_t val) {
+    // See hal/posix.c
+    if (val == 0 || val == 1) {
+        NODE->rst = 1;
+    } else if (NODE->rst) {
+        NODE->rst = 0;
+        radio_sim_reset(&NODE->radio, (u4_t)NODE->now);
+        NODE->dio = 0;
+    }
+}
+
+static void hal_io_check () {
+    struct sim_node* node = NODE;
+    // Timestamp DIO changes with the time the model raised them, like
+    // an edge interrupt would (see hal/posix.c)
+    u4_t when;
+    if (!radio_sim_nextEvent(&node->radio, &when) || (s4_t)((u4_t)node->now - when) < 0)
+        when = (u4_t)node->now;
+    u1_t now = radio_sim_update(&node->radio, (u4_t)node->now);
+    u1_t rising = now & ~node->dio;
+    node->dio = now;
+    for (u1_t i = 0; i < 3; ++i) {
+        if (rising & (1 << i)) {
+            // Handling the interrupt usually makes a job runnable, so
+            // keep the node running
+            node->sleeping = 0;
+            radio_irq_handler_at(i, when);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SPI
+
+#if !defined(CFG_sx126x_radio)
+void hal_spi_write (u1_t cmd, const u1_t* buf, u1_t len) {
+    struct sim_node* node = NODE;
+    radio_sim_nss(&node->radio, 0, (u4_t)node->now);
+    radio_sim_spi(&node->radio, cmd, (u4_t)node->now);
+    for (u1_t i = 0; i < len; i++)
+        radio_sim_spi(&node->radio, buf[i], (u4_t)node->now);
+    radio_sim_nss(&node->radio, 1, (u4_t)node->now);
+}
+
+void hal_spi_read (u1_t cmd, u1_t* buf, u1_t len) {
+    struct sim_node* node = NODE;
+    radio_sim_nss(&node->radio, 0, (u4_t)node->now);
+    radio_sim_spi(&node->radio, cmd, (u4_t)node->now);
+    for (u1_t i = 0; i < len; i++)
+        buf[i] = radio_sim_spi(&node->radio, 0x00, (u4_t)node->now);
+    radio_sim_nss(&node->radio, 1, (u4_t)node->now);
+}
+#else
+void hal_spi_cmd (const u1_t* cmd, u1_t cmdlen, u1_t* buf, u1_t len, bit_t read) {
+    struct sim_node* node = NODE;
+    u4_t until;
+    radio_sim_nss(&node->radio, 0, (u4_t)node->now);
+    // Waiting for BUSY advances the clock like hal_waitUntil
+    if (radio_sim_busy(&node->radio, (u4_t)node->now, &until))
+        hal_waitUntil(until);
+    for (u1_t i = 0; i < cmdlen; i++)
+        radio_sim_spi(&node->radio, cmd[i], (u4_t)node->now);
+    for (u1_t i = 0; i < len; i++) {
+        if (read)
+            buf[i] = radio_sim_spi(&node->radio, 0x00, (u4_t)node->now);
+        else
+            radio_sim_spi(&node->radio, buf[i], (u4_t)node->now);
+    }
+    radio_sim_nss(&node->radio, 1, (u4_t)node->now);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// TIME
+
+u4_t hal_ticks () {
+    return (u4_t)(lmic_ctx ? NODE->now : simtime);
+}
+
+void hal_waitUntil (u4_t time) {
+    // Busy waiting only advances the clock of this node. Since waits
+    // are short, this does not noticeably upset the ordering of events
+    // between nodes.
+    struct sim_node* node = NODE;
+    s4_t delta = (s4_t)(time - (u4_t)node->now);
+    if (delta > 0)
+        node->now += delta;
+}
+
+// check and rewind for target time
+u1_t hal_checkTimer (u4_t time) {
+    struct sim_node* node = NODE;
+    if ((s4_t)(time - (u4_t)node->now) <= 0) {
+        node->timerArmed = 0;
+        return 1;
+    }
+    node->timer = toSimtime(node, time);
+    node->timerArmed = 1;
+    return 0;
+}
+
+#if defined(LMIC_RX_TIMER)
+void hal_setRxTimer (u4_t time) {
+    NODE->rxTimer = toSimtime(NODE, time);
+    NODE->rxTimerArmed = 1;
+}
+
+void hal_clearRxTimer () {
+    NODE->rxTimerArmed = 0;
+}
+
+static void hal_rxtimer_check () {
+    struct sim_node* node = NODE;
+    if (node->rxTimerArmed && node->rxTimer <= node->now) {
+        node->rxTimerArmed = 0;
+        radio_rxtimer_handler();
+    }
+}
+#endif
+
+void hal_disableIRQs () {
+#if defined(LMIC_OS_STATS)
+    if (NODE->irqlevel == 0)
+        NODE->irqoffStart = hal_ticks();
+#endif
+    NODE->irqlevel++;
+}
+
+void hal_enableIRQs () {
+    if (--NODE->irqlevel == 0) {
+#if defined(LMIC_OS_STATS)
+        os_noteIrqOff(hal_ticks() - NODE->irqoffStart);
+#endif
+        hal_io_check();
+#if defined(LMIC_RX_TIMER)
+        hal_rxtimer_check();
+#endif
+    }
+}
+
+void hal_sleep () {
+    // Return control to sim_run(), which wakes this node again at its
+    // timer or next radio event.
+    NODE->sleeping = 1;
+}
+
+#if defined(LMIC_SAVE_RAND_SEED)
+// -----------------------------------------------------------------------------
+// RANDOM SEED
+
+bit_t hal_loadRandSeed (u1_t* seed) {
+    if (!NODE->randSeedValid)
+        return 0;
+    os_copyMem(seed, NODE->randSeed, 16);
+    return 1;
+}
+
+void hal_saveRandSeed (const u1_t* seed) {
+    os_copyMem(NODE->randSeed, seed, 16);
+    NODE->randSeedValid = 1;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+void hal_init () {
+    struct sim_node* node = NODE;
+    node->irqlevel = 0;
+    node->dio = 0;
+    node->timerArmed = 0;
+#if defined(LMIC_RX_TIMER)
+    node->rxTimerArmed = 0;
+#endif
+    radio_sim_reset(&node->radio, (u4_t)node->now);
+}
+
+void hal_failed (const char *file, u2_t line) {
+    fprintf(stderr, "FAILURE %s:%u (node %lu at %llu)\n", file, line,
+            lmic_ctx ? (unsigned long)NODE->id : 0UL,
+            (unsigned long long)simtime);
+    fflush(stdout);
+    abort();
+}
+
+#endif // defined(USE_SIM_HAL)
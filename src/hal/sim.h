@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Discrete-event simulator that runs many LMIC instances in a single
+ * process, against a shared virtual clock and a single gateway.
+ *******************************************************************************/
+#ifndef _hal_sim_h_
+#define _hal_sim_h_
+
+#include "../lmic/lmic.h"
+#include "radio_sim.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// Virtual time is kept in 64-bit ticks, so it does not wrap. LMIC only
+// sees the lower 32 bits, like it would on real hardware.
+typedef uint64_t simtime_t;
+#define SIM_NEVER UINT64_MAX
+
+// Traffic counters, both global and per node. An uplink is delivered
+// when no other uplink overlapped it on the same frequency and SF/BW.
+struct sim_stats {
+    u4_t      uplinks;
+    u4_t      delivered;
+    u4_t      collided;
+    u4_t      downlinks;
+    simtime_t airtime;     // total uplink airtime (ticks)
+    simtime_t asleep;      // time spent in hal_sleep() (ticks)
+};
+
+struct sim_node {
+    lmic_ctx_t        ctx;         // the LMIC instance
+    struct radio_sim  radio;       // its radio
+    u4_t              id;
+    simtime_t         now;         // local time while running
+    simtime_t         wake;        // next time the node must run
+    simtime_t         timer;       // wakeup programmed through hal_checkTimer
+    u4_t              heapidx;
+    u1_t              irqlevel;
+#if defined(LMIC_OS_STATS)
+    u4_t              irqoffStart;
+#endif
+    u1_t              dio;
+    u1_t              sleeping;
+    u1_t              rst;
+    u1_t              timerArmed;
+#if defined(LMIC_RX_TIMER)
+    simtime_t         rxTimer;     // set through hal_setRxTimer
+    u1_t              rxTimerArmed;
+#endif
+    struct sim_stats  stats;
+#if defined(LMIC_SAVE_RAND_SEED)
+    // survives running os_init() again, which simulates a reboot
+    u1_t              randSeed[16];
+    u1_t              randSeedValid;
+#endif
+    void*             user;        // free for use by the application
+};
+
+// Called when a gateway finished receiving an uplink without collision.
+typedef void (*sim_uplinkcb_t) (struct sim_node* node, const struct radio_sim_frame* frame);
+
+// Prepare the node (allocated and zeroed by the caller) and run
+// os_init() for it. The node is selected afterwards, so the caller can
+// continue configuring it (LMIC_reset, LMIC_setSession, etc.). It first
+// runs at the current simulation time.
+void sim_node_init (struct sim_node* node, u4_t id);
+
+// Make the given node current, so LMIC refers to its state.
+void sim_select (struct sim_node* node);
+
+// The currently running (or selected) node.
+struct sim_node* sim_current (void);
+
+// Run all nodes until the given virtual time.
+void sim_run (simtime_t until);
+
+// Current virtual time
+simtime_t sim_time (void);
+
+// Offer a downlink frame to the node's radio (see radio_sim_receive).
+void sim_downlink (struct sim_node* node, const struct radio_sim_frame* frame);
+
+void sim_setUplinkCallback (sim_uplinkcb_t cb);
+void sim_getStats (struct sim_stats* stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _hal_sim_h_
@@ -0,0 +1,389 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * In-process model of the SX1261/SX1262 command interface. This models
+ * just enough of the chip for lmic/sx126x.c: the commands that set up
+ * the modem, the data buffer, the registers the driver uses, the chip
+ * modes, the interrupt flags on DIO1 and the BUSY line. Talking to the
+ * chip while it is busy fails an ASSERT, so this also checks that the
+ * HAL waits for BUSY. Airtime is taken from calcAirTime(), like in the
+ * SX127x model.
+ *******************************************************************************/
+
+#include "../lmic/config.h"
+
+#if defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
+
+#include "radio_sim.h"
+
+#if defined(CFG_sx126x_radio)
+
+// Commands used by the model (see lmic/sx126x.c)
+#define CMD_SET_SLEEP                   0x84
+#define CMD_SET_STANDBY                 0x80
+#define CMD_SET_TX                      0x83
+#define CMD_SET_RX                      0x82
+#define CMD_CALIBRATE                   0x89
+#define CMD_SET_DIO_IRQ_PARAMS          0x08
+#define CMD_GET_IRQ_STATUS              0x12
+#define CMD_CLR_IRQ_STATUS              0x02
+#define CMD_SET_RF_FREQUENCY            0x86
+#define CMD_SET_PACKET_TYPE             0x8A
+#define CMD_SET_MODULATION_PARAMS       0x8B
+#define CMD_SET_PACKET_PARAMS           0x8C
+#define CMD_SET_BUFFER_BASE_ADDRESS     0x8F
+#define CMD_SET_LORA_SYMB_NUM_TIMEOUT   0xA0
+#define CMD_GET_RX_BUFFER_STATUS        0x13
+#define CMD_GET_PACKET_STATUS           0x14
+#define CMD_GET_RSSI_INST               0x15
+#define CMD_WRITE_REGISTER              0x0D
+#define CMD_READ_REGISTER               0x1D
+#define CMD_WRITE_BUFFER                0x0E
+#define CMD_READ_BUFFER                 0x1E
+
+#define REG_FIRST                       0x0600 // first modeled register
+#define REG_IQ_POLARITY                 0x0736
+#define REG_LORA_SYNC_WORD              0x0740
+#define REG_RANDOM                      0x0819 // 4 bytes
+
+#define PACKET_TYPE_FSK                 0x00
+
+// Chip modes, as reported in bits 6:4 of the status byte
+#define MODE_STDBY_RC                   0x2
+#define MODE_RX                         0x5
+#define MODE_TX                         0x6
+
+#define IRQ_TXDONE                      0x0001
+#define IRQ_RXDONE                      0x0002
+#define IRQ_TIMEOUT                     0x0200
+
+#define RX_CONTINUOUS                   0xFFFFFF
+
+// How long BUSY stays high after releasing NRESET, after waking up from
+// sleep (with warm start) and for a full calibration
+#define BOOT_TICKS      us2osticks(3500)
+#define WAKE_TICKS      us2osticks(340)
+#define CALIBRATE_TICKS us2osticks(3500)
+
+static u1_t* reg (struct radio_sim* radio, u2_t addr) {
+    u2_t i = addr - REG_FIRST;
+    return i < sizeof(radio->regs) ? &radio->regs[i] : NULL;
+}
+
+void radio_sim_reset (struct radio_sim* radio, u4_t now) {
+    os_clearMem(radio->regs, sizeof(radio->regs));
+    os_clearMem(radio->buffer, sizeof(radio->buffer));
+    os_clearMem(radio->modParams, sizeof(radio->modParams));
+    os_clearMem(radio->pktParams, sizeof(radio->pktParams));
+    *reg(radio, REG_LORA_SYNC_WORD) = 0x14;
+    *reg(radio, REG_LORA_SYNC_WORD + 1) = 0x24;
+    *reg(radio, REG_IQ_POLARITY) = 0x0D;
+    radio->pos = 0;
+    radio->sleeping = 0;
+    radio->mode = MODE_STDBY_RC;
+    radio->busyUntil = now + BOOT_TICKS;
+    radio->packetType = PACKET_TYPE_FSK;
+    radio->frf = 0;
+    radio->irq = 0;
+    radio->irqMask = 0;
+    radio->dio1Mask = 0;
+    radio->symbTimeout = 0;
+    radio->rxTimeout = 0;
+    radio->txBase = 0;
+    radio->rxBase = 0;
+    radio->rxLen = 0;
+    radio->selected = 0;
+    radio->dio = 0;
+    radio->event = SIM_EV_NONE;
+    radio->rxpending = 0;
+    if (!radio->rnd)
+        radio->rnd = 0x2545F491;
+}
+
+static bit_t isLora (struct radio_sim* radio) {
+    return radio->packetType != PACKET_TYPE_FSK;
+}
+
+u4_t radio_sim_freq (struct radio_sim* radio) {
+    return (u4_t)(((uint64_t)radio->frf * 32000000 + (1 << 24)) >> 25);
+}
+
+rps_t radio_sim_rps (struct radio_sim* radio, u1_t plen) {
+    if (!isLora(radio))
+        return makeRps(FSK, BW125, CR_4_5, 0, 0);
+
+    sf_t sf = (sf_t)(radio->modParams[0] - 6);
+    bw_t bw = (bw_t)((radio->modParams[1] - 4) & 0x3);
+    cr_t cr = (cr_t)(radio->modParams[2] - 1);
+    int ih = radio->pktParams[2];
+    int crc = radio->pktParams[4];
+    return makeRps(sf, bw, cr, ih ? plen : 0, !crc);
+}
+
+// Duration of a single symbol (LoRa) or byte (FSK) in ticks
+static ostime_t symTime (struct radio_sim* radio, rps_t rps) {
+    if (getSf(rps) == FSK) {
+        u4_t br = ((u4_t)radio->modParams[0] << 16) | ((u4_t)radio->modParams[1] << 8) | radio->modParams[2];
+        // bit time is br/1024 μs
+        return us2osticksCeil(br * 8 / 1024);
+    }
+    return us2osticksCeil((1000 << (getSf(rps) + 6)) / (125 << getBw(rps)));
+}
+
+static void schedule (struct radio_sim* radio, u1_t ev, u4_t time) {
+    radio->event = ev;
+    radio->eventTime = time;
+}
+
+// Decide what happens to the receiver that was started at rxstart:
+// either the queued frame is received, or a single rx times out. The
+// LoRa symbol timeout only applies when SetRx has no timeout itself.
+static void scheduleRx (struct radio_sim* radio) {
+    rps_t rps = radio_sim_rps(radio, radio->rxframe.len);
+    ostime_t sym = symTime(radio, rps);
+    bit_t forever = radio->rxTimeout == RX_CONTINUOUS;
+    u4_t timeout = radio->rxstart;
+
+    if (!forever && radio->rxTimeout != 0)
+        timeout += us2osticks((uint64_t)radio->rxTimeout * 15625 / 1000);
+    else if (!forever && isLora(radio) && radio->symbTimeout != 0)
+        timeout += sym * radio->symbTimeout;
+    else
+        forever = 1;
+
+    if (radio_sim_locks(radio, radio_sim_freq(radio), rps, sym, timeout, forever)) {
+        schedule(radio, SIM_EV_RXDONE, radio->rxframe.end);
+        return;
+    }
+    if (!forever)
+        schedule(radio, SIM_EV_RXTOUT, timeout);
+    else
+        schedule(radio, SIM_EV_NONE, 0);
+}
+
+static void startTx (struct radio_sim* radio, u4_t now) {
+    struct radio_sim_frame tx;
+
+    tx.len = isLora(radio) ? radio->pktParams[3] : radio->pktParams[6];
+    for (u2_t i = 0; i < tx.len; i++)
+        tx.data[i] = radio->buffer[(u1_t)(radio->txBase + i)];
+    tx.freq = radio_sim_freq(radio);
+    tx.rps = radio_sim_rps(radio, tx.len);
+    tx.start = now;
+    tx.end = now + calcAirTime(tx.rps, tx.len);
+    tx.snr = 0;
+    tx.rssi = 0;
+    radio->mode = MODE_TX;
+    schedule(radio, SIM_EV_TXDONE, tx.end);
+    if (radio->ontx)
+        radio->ontx(radio, &tx);
+}
+
+// Only interrupts enabled in the IRQ mask are flagged
+static void setIrq (struct radio_sim* radio, u2_t flag) {
+    radio->irq |= flag & radio->irqMask;
+}
+
+static void fire (struct radio_sim* radio) {
+    u1_t ev = radio->event;
+    radio->event = SIM_EV_NONE;
+
+    switch (ev) {
+    case SIM_EV_TXDONE:
+        setIrq(radio, IRQ_TXDONE);
+        radio->mode = MODE_STDBY_RC;
+        break;
+    case SIM_EV_RXDONE: {
+        struct radio_sim_frame* f = &radio->rxframe;
+        radio->rxpending = 0;
+        for (u2_t i = 0; i < f->len; i++)
+            radio->buffer[(u1_t)(radio->rxBase + i)] = f->data[i];
+        radio->rxLen = f->len;
+        if (isLora(radio)) {
+            radio->pktStatus[0] = (u1_t)(-2 * f->rssi);
+            radio->pktStatus[1] = (u1_t)(f->snr * 4);
+            radio->pktStatus[2] = (u1_t)(-2 * f->rssi);
+        } else {
+            radio->pktStatus[0] = 0;
+            radio->pktStatus[1] = (u1_t)(-2 * f->rssi);
+            radio->pktStatus[2] = (u1_t)(-2 * f->rssi);
+        }
+        setIrq(radio, IRQ_RXDONE);
+        // Continuous mode keeps listening
+        if (radio->rxTimeout != RX_CONTINUOUS)
+            radio->mode = MODE_STDBY_RC;
+        break;
+    }
+    case SIM_EV_RXTOUT:
+        setIrq(radio, IRQ_TIMEOUT);
+        radio->mode = MODE_STDBY_RC;
+        break;
+    }
+}
+
+u1_t radio_sim_update (struct radio_sim* radio, u4_t now) {
+    if (radio->event != SIM_EV_NONE && (s4_t)(now - radio->eventTime) >= 0)
+        fire(radio);
+    radio->dio = (radio->irq & radio->dio1Mask) ? 1 << 1 : 0;
+    return radio->dio;
+}
+
+void radio_sim_receive (struct radio_sim* radio, const struct radio_sim_frame* frame) {
+    radio->rxframe = *frame;
+    radio->rxpending = 1;
+    // A receiver that is already listening might pick this frame up
+    if (radio->mode == MODE_RX && radio->event != SIM_EV_RXDONE)
+        scheduleRx(radio);
+}
+
+bit_t radio_sim_busy (struct radio_sim* radio, u4_t now, u4_t* until) {
+    if (!radio->sleeping && (s4_t)(now - radio->busyUntil) >= 0)
+        return 0;
+    // BUSY is high during sleep, until woken up by NSS
+    *until = radio->sleeping ? now + WAKE_TICKS : radio->busyUntil;
+    return 1;
+}
+
+static u1_t readRegister (struct radio_sim* radio, u2_t addr) {
+    if (addr >= REG_RANDOM && addr < REG_RANDOM + 4)
+        return radio_sim_noise(radio);
+    u1_t* r = reg(radio, addr);
+    return r ? *r : 0;
+}
+
+static u1_t status (struct radio_sim* radio) {
+    return radio->mode << 4;
+}
+
+// Data clocked out while the byte at pos is clocked in
+static u1_t response (struct radio_sim* radio, u2_t pos) {
+    if (pos == 0)
+        return 0;
+    switch (radio->cmd[0]) {
+    case CMD_GET_IRQ_STATUS:
+        if (pos == 2) return radio->irq >> 8;
+        if (pos == 3) return radio->irq;
+        break;
+    case CMD_GET_RX_BUFFER_STATUS:
+        if (pos == 2) return radio->rxLen;
+        if (pos == 3) return radio->rxBase;
+        break;
+    case CMD_GET_PACKET_STATUS:
+        if (pos >= 2 && pos <= 4) return radio->pktStatus[pos - 2];
+        break;
+    case CMD_GET_RSSI_INST:
+        if (pos == 2) return 2 * 110 + (radio_sim_noise(radio) & 0x7);
+        break;
+    case CMD_READ_REGISTER:
+        if (pos >= 4) return readRegister(radio, ((radio->cmd[1] << 8) | radio->cmd[2]) + pos - 4);
+        break;
+    case CMD_READ_BUFFER:
+        if (pos >= 3) return radio->buffer[(u1_t)(radio->cmd[1] + pos - 3)];
+        break;
+    }
+    return status(radio);
+}
+
+// Commands take effect when NSS goes high again
+static void execute (struct radio_sim* radio, u4_t now) {
+    u1_t* c = radio->cmd;
+    u2_t n = radio->pos;
+    if (n == 0)
+        return;
+
+    switch (c[0]) {
+    case CMD_SET_SLEEP:
+        radio->sleeping = 1;
+        radio->event = SIM_EV_NONE;
+        // the data buffer is lost, the configuration kept
+        os_clearMem(radio->buffer, sizeof(radio->buffer));
+        break;
+    case CMD_SET_STANDBY:
+        radio->mode = MODE_STDBY_RC;
+        radio->event = SIM_EV_NONE;
+        break;
+    case CMD_SET_TX:
+        startTx(radio, now);
+        break;
+    case CMD_SET_RX:
+        radio->rxTimeout = ((u4_t)c[1] << 16) | ((u4_t)c[2] << 8) | c[3];
+        radio->mode = MODE_RX;
+        radio->rxstart = now;
+        scheduleRx(radio);
+        break;
+    case CMD_CALIBRATE:
+        radio->busyUntil = now + CALIBRATE_TICKS;
+        break;
+    case CMD_SET_DIO_IRQ_PARAMS:
+        radio->irqMask = (c[1] << 8) | c[2];
+        radio->dio1Mask = (c[3] << 8) | c[4];
+        break;
+    case CMD_CLR_IRQ_STATUS:
+        radio->irq &= ~((c[1] << 8) | c[2]);
+        break;
+    case CMD_SET_RF_FREQUENCY:
+        radio->frf = ((u4_t)c[1] << 24) | ((u4_t)c[2] << 16) | ((u4_t)c[3] << 8) | c[4];
+        break;
+    case CMD_SET_PACKET_TYPE:
+        radio->packetType = c[1];
+        break;
+    case CMD_SET_MODULATION_PARAMS:
+        os_copyMem(radio->modParams, c + 1, n - 1 < 8 ? n - 1 : 8);
+        break;
+    case CMD_SET_PACKET_PARAMS:
+        os_copyMem(radio->pktParams, c + 1, n - 1 < 9 ? n - 1 : 9);
+        break;
+    case CMD_SET_BUFFER_BASE_ADDRESS:
+        radio->txBase = c[1];
+        radio->rxBase = c[2];
+        break;
+    case CMD_SET_LORA_SYMB_NUM_TIMEOUT:
+        radio->symbTimeout = c[1];
+        break;
+    case CMD_WRITE_REGISTER:
+        for (u2_t i = 3; i < n; i++) {
+            u1_t* r = reg(radio, ((c[1] << 8) | c[2]) + i - 3);
+            if (r)
+                *r = c[i];
+        }
+        break;
+    case CMD_WRITE_BUFFER:
+        for (u2_t i = 2; i < n; i++)
+            radio->buffer[(u1_t)(c[1] + i - 2)] = c[i];
+        break;
+    }
+}
+
+void radio_sim_nss (struct radio_sim* radio, u1_t val, u4_t now) {
+    if (!val) {
+        if (radio->sleeping) {
+            radio->sleeping = 0;
+            radio->mode = MODE_STDBY_RC;
+            radio->busyUntil = now + WAKE_TICKS;
+        }
+        radio->pos = 0;
+    } else if (radio->selected) {
+        execute(radio, now);
+    }
+    radio->selected = !val;
+}
+
+u1_t radio_sim_spi (struct radio_sim* radio, u1_t out, u4_t now) {
+    if (!radio->selected)
+        return 0;
+    // The HAL must wait for BUSY before talking to the chip
+    ASSERT((s4_t)(now - radio->busyUntil) >= 0);
+
+    u2_t pos = radio->pos++;
+    if (pos < sizeof(radio->cmd))
+        radio->cmd[pos] = out;
+    return response(radio, pos);
+}
+
+#endif // defined(CFG_sx126x_radio)
+
+#endif // defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
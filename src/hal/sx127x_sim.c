@@ -0,0 +1,407 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * In-process model of the SX1272/SX1276 register interface. This models
+ * just enough of the chip for lmic/sx127x.c: the register file, the FIFO,
+ * the operating modes and the interrupt flags with their DIO mapping.
+ * Airtime is taken from calcAirTime(), so TxDone, RxDone and RxTimeout
+ * happen when they would on a real radio, including the RxDone latency
+ * of LoRa frames that the driver corrects for.
+ *******************************************************************************/
+
+#include "../lmic/config.h"
+
+#if defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
+
+#include "radio_sim.h"
+
+#if defined(CFG_sx127x_radio)
+
+// Registers used by the model (see lmic/sx127x.c for the full map)
+#define RegFifo                     0x00
+#define RegOpMode                   0x01
+#define FSKRegBitrateMsb            0x02
+#define FSKRegBitrateLsb            0x03
+#define RegFrfMsb                   0x06
+#define RegFrfMid                   0x07
+#define RegFrfLsb                   0x08
+#define LORARegFifoAddrPtr          0x0D
+#define LORARegFifoTxBaseAddr       0x0E
+#define LORARegFifoRxBaseAddr       0x0F
+#define LORARegFifoRxCurrentAddr    0x10
+#define LORARegIrqFlagsMask         0x11
+#define LORARegIrqFlags             0x12
+#define LORARegRxNbBytes            0x13
+#define LORARegPktSnrValue          0x19
+#define LORARegPktRssiValue         0x1A
+#define LORARegRssiValue            0x1B
+#define LORARegModemConfig1         0x1D
+#define LORARegModemConfig2         0x1E
+#define LORARegSymbTimeoutLsb       0x1F
+#define FSKRegRxTimeout2            0x21
+#define LORARegPayloadLength        0x22
+#define LORARegRssiWideband         0x2C
+#define FSKRegPayloadLength         0x32
+#define FSKRegIrqFlags1             0x3E
+#define FSKRegIrqFlags2             0x3F
+#define RegDioMapping1              0x40
+#define RegVersion                  0x42
+
+#define OPMODE_LORA      0x80
+#define OPMODE_MASK      0x07
+#define OPMODE_TX        0x03
+#define OPMODE_RX        0x05
+#define OPMODE_RX_SINGLE 0x06
+
+#define IRQ_LORA_RXTOUT_MASK 0x80
+#define IRQ_LORA_RXDONE_MASK 0x40
+#define IRQ_LORA_TXDONE_MASK 0x08
+#define IRQ_LORA_CDDONE_MASK 0x04
+#define IRQ_LORA_FHSSCH_MASK 0x02
+#define IRQ_LORA_CDDETD_MASK 0x01
+#define IRQ_FSK1_TIMEOUT_MASK       0x04
+#define IRQ_FSK2_PACKETSENT_MASK    0x08
+#define IRQ_FSK2_PAYLOADREADY_MASK  0x04
+
+#ifdef CFG_sx1276_radio
+#define SIM_VERSION 0x12
+#elif CFG_sx1272_radio
+#define SIM_VERSION 0x22
+#endif
+
+static bit_t isLora (struct radio_sim* radio) {
+    return (radio->regs[RegOpMode] & OPMODE_LORA) != 0;
+}
+
+static u1_t mode (struct radio_sim* radio) {
+    return radio->regs[RegOpMode] & OPMODE_MASK;
+}
+
+void radio_sim_reset (struct radio_sim* radio, u4_t now) {
+    (void)now;
+    os_clearMem(radio->regs, sizeof(radio->regs));
+    os_clearMem(radio->fifo, sizeof(radio->fifo));
+    radio->regs[RegOpMode] = 0x09;
+    radio->regs[FSKRegBitrateMsb] = 0x1A;
+    radio->regs[FSKRegBitrateLsb] = 0x0B;
+    radio->regs[RegVersion] = SIM_VERSION;
+    radio->fskptr = 0;
+    radio->addr = 0;
+    radio->selected = 0;
+    radio->first = 0;
+    radio->dio = 0;
+    radio->event = SIM_EV_NONE;
+    radio->rxpending = 0;
+    if (!radio->rnd)
+        radio->rnd = 0x2545F491;
+}
+
+u4_t radio_sim_freq (struct radio_sim* radio) {
+    u4_t frf = ((u4_t)radio->regs[RegFrfMsb] << 16)
+             | ((u4_t)radio->regs[RegFrfMid] << 8)
+             | radio->regs[RegFrfLsb];
+    return (u4_t)(((uint64_t)frf * 32000000 + (1 << 18)) >> 19);
+}
+
+rps_t radio_sim_rps (struct radio_sim* radio, u1_t plen) {
+    if (!isLora(radio))
+        return makeRps(FSK, BW125, CR_4_5, 0, 0);
+
+    u1_t mc1 = radio->regs[LORARegModemConfig1];
+    u1_t mc2 = radio->regs[LORARegModemConfig2];
+    sf_t sf = (sf_t)((mc2 >> 4) - 6);
+#ifdef CFG_sx1276_radio
+    bw_t bw = (bw_t)(((mc1 >> 4) - 7) & 0x3);
+    cr_t cr = (cr_t)(((mc1 >> 1) & 0x7) - 1);
+    int ih = mc1 & 0x01;
+    int crc = mc2 & 0x04;
+#elif CFG_sx1272_radio
+    bw_t bw = (bw_t)(mc1 >> 6);
+    cr_t cr = (cr_t)(((mc1 >> 3) & 0x7) - 1);
+    int ih = mc1 & 0x04;
+    int crc = mc1 & 0x02;
+#endif
+    return makeRps(sf, bw, cr, ih ? plen : 0, !crc);
+}
+
+// Duration of a single symbol (LoRa) or byte (FSK) in ticks
+static ostime_t symTime (struct radio_sim* radio, rps_t rps) {
+    if (getSf(rps) == FSK) {
+        u4_t br = ((u4_t)radio->regs[FSKRegBitrateMsb] << 8) | radio->regs[FSKRegBitrateLsb];
+        // bit time is br/32 μs
+        return us2osticksCeil(br * 8 / 32);
+    }
+    return us2osticksCeil((1000 << (getSf(rps) + 6)) / (125 << getBw(rps)));
+}
+
+// How long after the end of a LoRa frame the chip raises RxDone, as
+// measured at BW125 (see LORA_RXDONE_FIXUP in lmic/sx127x.c). The other
+// bandwidths were not measured, so they have none.
+static const u2_t RXDONE_LATENCY_US[] = {
+    [SF7]  =     0,
+    [SF8]  =  1648,
+    [SF9]  =  3265,
+    [SF10] =  7049,
+    [SF11] = 13641,
+    [SF12] = 31189,
+};
+
+static ostime_t rxdoneLatency (rps_t rps) {
+    if (getSf(rps) == FSK || getBw(rps) != BW125)
+        return 0;
+    return us2osticks(RXDONE_LATENCY_US[getSf(rps)]);
+}
+
+static void schedule (struct radio_sim* radio, u1_t ev, u4_t time) {
+    radio->event = ev;
+    radio->eventTime = time;
+}
+
+// Decide what happens to the receiver that was started at rxstart:
+// either the queued frame is received, or (in single mode) it times out.
+static void scheduleRx (struct radio_sim* radio) {
+    rps_t rps = radio_sim_rps(radio, radio->rxframe.len);
+    ostime_t sym = symTime(radio, rps);
+    bit_t fsk = getSf(rps) == FSK;
+    u4_t timeout;
+
+    if (fsk)
+        timeout = radio->rxstart + us2osticks((u4_t)radio->regs[FSKRegRxTimeout2] * 16
+                    * (((u4_t)radio->regs[FSKRegBitrateMsb] << 8) | radio->regs[FSKRegBitrateLsb]) / 32);
+    else
+        timeout = radio->rxstart + sym * (radio->regs[LORARegSymbTimeoutLsb]
+                    | ((radio->regs[LORARegModemConfig2] & 0x3) << 8));
+
+    if (radio_sim_locks(radio, radio_sim_freq(radio), rps, sym, timeout, mode(radio) == OPMODE_RX)) {
+        schedule(radio, SIM_EV_RXDONE, radio->rxframe.end + rxdoneLatency(rps));
+        return;
+    }
+    if (mode(radio) == OPMODE_RX_SINGLE || fsk)
+        schedule(radio, SIM_EV_RXTOUT, timeout);
+    else
+        schedule(radio, SIM_EV_NONE, 0);
+}
+
+static void startTx (struct radio_sim* radio, u4_t now) {
+    struct radio_sim_frame tx;
+
+    if (isLora(radio)) {
+        tx.len = radio->regs[LORARegPayloadLength];
+        for (u2_t i = 0; i < tx.len; i++)
+            tx.data[i] = radio->fifo[(u1_t)(radio->regs[LORARegFifoTxBaseAddr] + i)];
+    } else {
+        // In variable length mode, the first fifo byte is the length
+        tx.len = radio->fifo[0];
+        os_copyMem(tx.data, radio->fifo + 1, tx.len);
+    }
+    tx.freq = radio_sim_freq(radio);
+    tx.rps = radio_sim_rps(radio, tx.len);
+    tx.start = now;
+    tx.end = now + calcAirTime(tx.rps, tx.len);
+    tx.snr = 0;
+    tx.rssi = 0;
+    schedule(radio, SIM_EV_TXDONE, tx.end);
+    if (radio->ontx)
+        radio->ontx(radio, &tx);
+}
+
+static void setOpMode (struct radio_sim* radio, u1_t val, u4_t now) {
+    radio->regs[RegOpMode] = val;
+    radio->fskptr = 0;
+    radio->event = SIM_EV_NONE;
+    if (!isLora(radio)) {
+        radio->regs[FSKRegIrqFlags1] = 0;
+        radio->regs[FSKRegIrqFlags2] = 0;
+    }
+
+    switch (mode(radio)) {
+    case OPMODE_TX:
+        startTx(radio, now);
+        break;
+    case OPMODE_RX:
+    case OPMODE_RX_SINGLE:
+        radio->rxstart = now;
+        scheduleRx(radio);
+        break;
+    }
+}
+
+static void setFlag (struct radio_sim* radio, u1_t flag) {
+    if (!(radio->regs[LORARegIrqFlagsMask] & flag))
+        radio->regs[LORARegIrqFlags] |= flag;
+}
+
+static void fire (struct radio_sim* radio) {
+    u1_t ev = radio->event;
+    radio->event = SIM_EV_NONE;
+
+    switch (ev) {
+    case SIM_EV_TXDONE:
+        if (isLora(radio))
+            setFlag(radio, IRQ_LORA_TXDONE_MASK);
+        else
+            radio->regs[FSKRegIrqFlags2] |= IRQ_FSK2_PACKETSENT_MASK;
+        radio->regs[RegOpMode] = (radio->regs[RegOpMode] & ~OPMODE_MASK) | 0x01;
+        break;
+    case SIM_EV_RXDONE: {
+        struct radio_sim_frame* f = &radio->rxframe;
+        radio->rxpending = 0;
+        if (isLora(radio)) {
+            u1_t base = radio->regs[LORARegFifoRxBaseAddr];
+            for (u2_t i = 0; i < f->len; i++)
+                radio->fifo[(u1_t)(base + i)] = f->data[i];
+            radio->regs[LORARegFifoRxCurrentAddr] = base;
+            radio->regs[LORARegRxNbBytes] = f->len;
+            radio->regs[LORARegPktSnrValue] = (u1_t)(f->snr * 4);
+            radio->regs[LORARegPktRssiValue] = (u1_t)(f->rssi + 157);
+            setFlag(radio, IRQ_LORA_RXDONE_MASK);
+            // Continuous mode keeps listening
+            if (mode(radio) == OPMODE_RX_SINGLE)
+                radio->regs[RegOpMode] = (radio->regs[RegOpMode] & ~OPMODE_MASK) | 0x01;
+        } else {
+            os_copyMem(radio->fifo, f->data, f->len);
+            radio->fskptr = 0;
+            radio->regs[FSKRegPayloadLength] = f->len;
+            radio->regs[FSKRegIrqFlags2] |= IRQ_FSK2_PAYLOADREADY_MASK;
+        }
+        break;
+    }
+    case SIM_EV_RXTOUT:
+        if (isLora(radio)) {
+            setFlag(radio, IRQ_LORA_RXTOUT_MASK);
+            radio->regs[RegOpMode] = (radio->regs[RegOpMode] & ~OPMODE_MASK) | 0x01;
+        } else {
+            radio->regs[FSKRegIrqFlags1] |= IRQ_FSK1_TIMEOUT_MASK;
+        }
+        break;
+    }
+}
+
+static u1_t dioLevels (struct radio_sim* radio) {
+    u1_t map = radio->regs[RegDioMapping1];
+    u1_t dio = 0;
+
+    if (isLora(radio)) {
+        static const u1_t dio0[] = { IRQ_LORA_RXDONE_MASK, IRQ_LORA_TXDONE_MASK, IRQ_LORA_CDDONE_MASK, 0 };
+        static const u1_t dio1[] = { IRQ_LORA_RXTOUT_MASK, IRQ_LORA_FHSSCH_MASK, IRQ_LORA_CDDETD_MASK, 0 };
+        static const u1_t dio2[] = { IRQ_LORA_FHSSCH_MASK, IRQ_LORA_FHSSCH_MASK, IRQ_LORA_FHSSCH_MASK, 0 };
+        u1_t flags = radio->regs[LORARegIrqFlags];
+        if (flags & dio0[(map >> 6) & 0x3]) dio |= 1 << 0;
+        if (flags & dio1[(map >> 4) & 0x3]) dio |= 1 << 1;
+        if (flags & dio2[(map >> 2) & 0x3]) dio |= 1 << 2;
+    } else {
+        if (((map >> 6) & 0x3) == 0
+            && (radio->regs[FSKRegIrqFlags2] & (IRQ_FSK2_PACKETSENT_MASK | IRQ_FSK2_PAYLOADREADY_MASK)))
+            dio |= 1 << 0;
+        if (((map >> 2) & 0x3) == 2
+            && (radio->regs[FSKRegIrqFlags1] & IRQ_FSK1_TIMEOUT_MASK))
+            dio |= 1 << 2;
+    }
+    return dio;
+}
+
+u1_t radio_sim_update (struct radio_sim* radio, u4_t now) {
+    if (radio->event != SIM_EV_NONE && (s4_t)(now - radio->eventTime) >= 0)
+        fire(radio);
+    radio->dio = dioLevels(radio);
+    return radio->dio;
+}
+
+void radio_sim_receive (struct radio_sim* radio, const struct radio_sim_frame* frame) {
+    radio->rxframe = *frame;
+    radio->rxpending = 1;
+    // A receiver that is already listening might pick this frame up
+    u1_t m = mode(radio);
+    if ((m == OPMODE_RX || m == OPMODE_RX_SINGLE) && radio->event != SIM_EV_RXDONE)
+        scheduleRx(radio);
+}
+
+static u1_t readRegister (struct radio_sim* radio, u1_t addr) {
+    switch (addr) {
+    case RegFifo:
+        if (isLora(radio))
+            return radio->fifo[radio->regs[LORARegFifoAddrPtr]++];
+        return radio->fifo[radio->fskptr++];
+    case LORARegRssiWideband:
+        if (isLora(radio))
+            return radio_sim_noise(radio);
+        break;
+    case LORARegRssiValue:
+        if (isLora(radio))
+            return 0x20 + (radio_sim_noise(radio) & 0x7);
+        break;
+    }
+    return radio->regs[addr];
+}
+
+static void writeRegister (struct radio_sim* radio, u1_t addr, u1_t val, u4_t now) {
+    switch (addr) {
+    case RegFifo:
+        if (isLora(radio))
+            radio->fifo[radio->regs[LORARegFifoAddrPtr]++] = val;
+        else
+            radio->fifo[radio->fskptr++] = val;
+        return;
+    case RegOpMode:
+        setOpMode(radio, val, now);
+        return;
+    case LORARegIrqFlags:
+        if (isLora(radio)) {
+            radio->regs[addr] &= ~val;
+            return;
+        }
+        break;
+    case FSKRegIrqFlags1:
+    case FSKRegIrqFlags2:
+        if (!isLora(radio)) {
+            radio->regs[addr] &= ~val;
+            return;
+        }
+        break;
+    case RegVersion:
+        return;
+    }
+    radio->regs[addr] = val;
+}
+
+bit_t radio_sim_busy (struct radio_sim* radio, u4_t now, u4_t* until) {
+    (void)radio; (void)now; (void)until;
+    return 0;
+}
+
+void radio_sim_nss (struct radio_sim* radio, u1_t val, u4_t now) {
+    (void)now;
+    radio->selected = !val;
+    radio->first = !val;
+}
+
+u1_t radio_sim_spi (struct radio_sim* radio, u1_t out, u4_t now) {
+    if (!radio->selected)
+        return 0;
+
+    if (radio->first) {
+        radio->first = 0;
+        radio->addr = out;
+        return 0;
+    }
+
+    u1_t addr = radio->addr & 0x7F;
+    u1_t res = 0;
+    if (radio->addr & 0x80)
+        writeRegister(radio, addr, out, now);
+    else
+        res = readRegister(radio, addr);
+
+    // Burst access auto-increments the address, except for the fifo
+    if (addr != RegFifo)
+        radio->addr = (radio->addr & 0x80) | ((addr + 1) & 0x7F);
+    return res;
+}
+
+#endif // defined(CFG_sx127x_radio)
+
+#endif // defined(USE_POSIX_HAL) || defined(USE_SIM_HAL)
@@ -7,12 +7,68 @@
 
 #define CFG_eu868 1
 //#define CFG_us915 1
+// Select the radio. Make sure at most one of these is uncommented (they
+// can also be defined on the compiler commandline). When none is, the
+// SX1276 is used. The radio driver for the SX1272 and SX1276 is in
+// lmic/sx127x.c, the one for the SX1261 and SX1262 in lmic/sx126x.c.
+//
 // This is the SX1272/SX1273 radio, which is also used on the HopeRF
 // RFM92 boards.
 //#define CFG_sx1272_radio 1
 // This is the SX1276/SX1277/SX1278/SX1279 radio, which is also used on
 // the HopeRF RFM95 boards.
+//#define CFG_sx1276_radio 1
+// These are the SX1261 (up to +14 dBm) and SX1262 (up to +22 dBm)
+// radios. They need less current than the SX127x, especially while
+// receiving, and an additional BUSY pin (see hal/hal.h).
+//#define CFG_sx1261_radio 1
+//#define CFG_sx1262_radio 1
+#if !defined(CFG_sx1272_radio) && !defined(CFG_sx1276_radio) && !defined(CFG_sx1261_radio) && !defined(CFG_sx1262_radio)
 #define CFG_sx1276_radio 1
+#endif
+
+// Settings for the SX1261 and SX1262, depending on the board:
+// Uncomment this when DIO2 of the radio controls the RF switch.
+//#define LMIC_SX126X_DIO2_RFSWITCH
+// Uncomment this when DIO3 of the radio powers a TCXO, with the voltage
+// code of SetDIO3AsTcxoCtrl (e.g. 0x02 for 1.8V).
+//#define LMIC_SX126X_TCXO 0x02
+// Uncomment this when the board has no inductor for the DC-DC
+// regulator, so the less efficient LDO must be used.
+//#define LMIC_SX126X_LDO
+
+// This selects the HAL implementation. Inside the Arduino environment,
+// the Arduino HAL (hal/hal.cpp) is used. Elsewhere, the POSIX HAL
+// (hal/posix.c) is used, which runs LMIC as a normal process against
+// a simulated radio (hal/radio_sim.h). This is useful to run and
+// profile the MAC code on a development machine.
+//
+// Defining LMIC_SIMULATION (e.g. on the compiler commandline) selects
+// the simulation HAL (hal/sim.c) instead, which runs many LMIC
+// instances in a single process against a shared virtual clock.
+#if defined(ARDUINO)
+#define USE_ARDUINO_HAL
+#elif defined(LMIC_SIMULATION)
+#define USE_SIM_HAL
+#else
+#define USE_POSIX_HAL
+#endif
+
+// Define this to allow running multiple independent LMIC instances, e.g.
+// to drive multiple radios from a single microcontroller. All state of
+// an instance then lives in an lmic_ctx_t, and the LMIC variable refers
+// to the instance selected by the lmic_ctx pointer. See lmic.h for the
+// context variants of the API. Simulation builds always enable this.
+//#define LMIC_MULTI_INSTANCE
+#if defined(LMIC_SIMULATION) && !defined(LMIC_MULTI_INSTANCE)
+#define LMIC_MULTI_INSTANCE
+#endif
+
+// A MAC job that starts more than this many ticks after its deadline is
+// counted as late (see os_getLateJobs). The MAC schedules its radio jobs
+// RX_RAMPUP or TX_RAMPUP (2 ms) before the radio must start, so a late
+// job is likely to miss its window.
+#define OS_LATE_TICKS ms2osticks(1)
 
 // 16 μs per tick
 // LMIC requires ticks to be 15.5μs - 100 μs long
@@ -37,6 +93,22 @@
 // halt execution.
 #define LMIC_FAILURE_TO Serial
 
+// Uncomment this to let the Arduino HAL use pin change interrupts on
+// the DIO pins, instead of polling them from os_runloop_once(). The
+// interrupt handler only records the time of the rising edge, the
+// radio is still serviced from os_runloop_once(). This makes the
+// timestamps of TX and RX completion exact, regardless of how often the
+// loop runs. All connected DIO pins must support interrupts.
+//#define LMIC_USE_INTERRUPTS
+
+// Uncomment this to let the Arduino HAL put the microcontroller in idle
+// mode while os_runloop_once() has no job to run, until the next job is
+// due or a DIO pin changes. This saves power between transmissions,
+// but means that os_runloop_once() only returns after that, so any
+// other work must be done from LMIC jobs. The host HALs (posix and
+// simulation) do their own sleeping regardless of this setting.
+//#define LMIC_IDLE_SLEEP
+
 // Uncomment this to disable all code related to joining
 //#define DISABLE_JOIN
 // Uncomment this to disable all code related to ping
@@ -45,6 +117,76 @@
 // Requires ping to be disabled too
 //#define DISABLE_BEACONS
 
+// Uncomment this to disable caching the expanded session keys. Without
+// the cache, the AES key expansion (and the CMAC subkey calculation) is
+// redone for every MIC and every payload encryption, but about 400
+// bytes of RAM are saved.
+//#define DISABLE_AES_KEYCACHE
+
+// Uncomment this to let os_runloop_once() use otherwise idle time to
+// precompute the CTR keystream for the first blocks of the next uplink
+// and downlink payload, and the start of the next uplink MIC (assuming
+// the same length as the previous uplink). Building the next uplink and
+// decoding the next downlink then take less time, which helps meeting
+// the RX windows on slow processors. The keystreams take
+// 2 * 16 * LMIC_PRECOMPUTE_BLOCKS bytes of RAM (128 by default). This
+// needs the key cache.
+//#define LMIC_PRECOMPUTE_AES
+//#define LMIC_PRECOMPUTE_BLOCKS 4
+
+// Uncomment this to start receive windows from a one-shot HAL timer
+// (see hal_setRxTimer) instead of busy-waiting for the exact start time
+// with interrupts disabled. The radio is set up and waits in standby,
+// and the CPU can sleep or run other jobs in the meantime (up to
+// RX_RAMPUP, 2 ms, for every window). The rx then starts as soon as the
+// HAL notices the timer expired, so the HAL must not sleep through it
+// and long running jobs must not be due right before a window.
+//#define LMIC_RX_TIMER
+
+// Uncomment this to learn the radio timing while running, instead of
+// using fixed constants: how long before an rx window or uplink its job
+// must start (starting at RX_RAMPUP and TX_RAMPUP, then following what
+// the last operations actually needed plus a margin), and the RxDone
+// latency for every SF and BW (learned from downlinks in RX1). See
+// LMIC_getCalibration() to keep the results across os_init().
+//#define LMIC_CALIBRATE
+
+// Uncomment this to estimate the clock error (see LMIC_setClockError)
+// from how far off the received downlinks and join accepts were, instead
+// of always widening the rx windows for the worst case configured by
+// hand. The estimate follows increases right away and decreases slowly.
+// RxDone latency the driver does not correct for is told apart from
+// drift by comparing the downlinks in RX1 and RX2 (see updateClockError
+// in lmic.c). With LMIC_CALIBRATE, a constant offset in RX1 is also
+// learned as RxDone latency.
+//#define LMIC_AUTO_CLOCK_ERROR
+
+// Uncomment this to collect scheduler statistics: for every job
+// callback, histograms of how late it started and how long it ran, as
+// well as the longest time interrupts were disabled and the most jobs
+// queued at the same time. See os_getStats() in oslmic.h. This costs
+// about 350 bytes of RAM on AVR and a little time for every job.
+//#define LMIC_OS_STATS
+
+// Uncomment this to let radio_init() continue the random generator
+// from a seed saved by the previous boot (see hal_loadRandSeed), mixed
+// with a short fresh noise sample and the time, instead of collecting
+// 15 bytes of RSSI noise. This shortens waking up from deep sleep or a
+// reset. Every boot saves a new seed right away, so a seed is never used
+// twice. radio_saveRandSeed() can be called to save the current state
+// explicitly. The Arduino HAL keeps the seed in RAM that survives a
+// reset on AVR only; a sketch can define its own (extern "C")
+// hal_loadRandSeed and hal_saveRandSeed to store it elsewhere.
+//#define LMIC_SAVE_RAND_SEED
+
+// Uncomment this to support class C (see LMIC_setClassC): between
+// uplinks, the radio then listens continuously on the RX2 frequency and
+// datarate, so downlinks arrive without waiting for the next uplink.
+// The radio is only interrupted for uplinks and RX1, but it draws the
+// receive current all the time, so this is for mains powered devices.
+// Not combined with beacon tracking and ping slots (class B).
+//#define LMIC_CLASSC
+
 // Uncomment these to disable the corresponding MAC commands.
 // Class A
 //#define DISABLE_MCMD_DCAP_REQ // duty cycle cap
@@ -66,18 +208,47 @@
 //#define DISABLE_INVERT_IQ_ON_RX
 
 // This allows choosing between multiple included AES implementations.
-// Make sure exactly one of these is uncommented.
+// Make sure at most one of these is uncommented (they can also be
+// defined on the compiler commandline). When none is, the Ideetron
+// implementation is used. extras/aes-bench can be used to compare
+// their speed.
 //
 // This selects the original AES implementation included LMIC. This
 // implementation is optimized for speed on 32-bit processors using
-// fairly big lookup tables, but it takes up big amounts of flash on the
-// AVR architecture.
+// fairly big lookup tables (5K), but it takes up big amounts of flash on
+// the AVR architecture.
 // #define USE_ORIGINAL_AES
 //
+// This selects a word-oriented implementation like the original, but
+// with a single 1K lookup table. It is meant for 32-bit processors,
+// where it is about as fast as the original, while using a lot less
+// flash.
+// #define USE_TTABLE_AES
+//
 // This selects the AES implementation written by Ideetroon for their
 // own LoRaWAN library. It also uses lookup tables, but smaller
 // byte-oriented ones, making it use a lot less flash space (but it is
-// also about twice as slow as the original).
+// also a lot slower than the other two on 32-bit processors).
+// #define USE_IDEETRON_AES
+//
+// This selects a bitsliced implementation, which uses no lookup tables
+// indexed by secret data and no secret-dependent branches, so its
+// timing does not depend on the key or data. It processes several
+// blocks at once (two on 32-bit, four on 64-bit processors), which
+// helps for encrypting payloads, but not for the MIC. It is slower
+// than the table-based implementations.
+// #define USE_BITSLICE_AES
+#if !defined(USE_ORIGINAL_AES) && !defined(USE_TTABLE_AES) && !defined(USE_IDEETRON_AES) && !defined(USE_BITSLICE_AES)
 #define USE_IDEETRON_AES
+#endif
+
+// When running on an x86-64 host (using the POSIX or simulation HAL),
+// this uses the AES-NI instructions if the processor has them, and the
+// implementation selected above otherwise. This needs gcc or clang, and
+// is ignored on other architectures.
+// #define USE_AESNI_AES
+#if defined(USE_AESNI_AES) && !(defined(__x86_64__) && defined(__GNUC__))
+#undef USE_AESNI_AES
+#endif
 
 #endif // _lmic_config_h_
@@ -21,11 +21,6 @@ extern "C"{
  */
 void hal_init (void);
 
-/*
- * drive radio NSS pin (0=low, 1=high).
- */
-void hal_pin_nss (u1_t val);
-
 /*
  * drive radio RX/TX pins (0=rx, 1=tx).
  */
@@ -36,12 +31,35 @@ void hal_pin_rxtx (u1_t val);
  */
 void hal_pin_rst (u1_t val);
 
+#if !defined(CFG_sx1261_radio) && !defined(CFG_sx1262_radio)
+/*
+ * perform a complete SPI transaction with radio.
+ *   - select the radio (drive NSS low)
+ *   - write the command byte 'cmd' (register address and r/w bit)
+ *   - write 'len' bytes from 'buf'
+ *   - deselect the radio again
+ */
+void hal_spi_write (u1_t cmd, const u1_t* buf, u1_t len);
+
 /*
- * perform 8-bit SPI transaction with radio.
- *   - write given byte 'outval'
- *   - read byte and return value
+ * perform a complete SPI transaction with radio.
+ *   - like hal_spi_write(), but read 'len' bytes into 'buf' after
+ *     writing the command byte
  */
-u1_t hal_spi (u1_t outval);
+void hal_spi_read (u1_t cmd, u1_t* buf, u1_t len);
+
+#else
+/*
+ * perform a complete SPI transaction with an SX126x radio.
+ *   - select the radio (drive NSS low), which also wakes it from sleep
+ *   - wait until the BUSY pin is low
+ *   - write 'cmdlen' bytes from 'cmd' (opcode and leading arguments)
+ *   - write 'len' bytes from 'buf', or read 'len' bytes into 'buf'
+ *     if 'read' is set
+ *   - deselect the radio again
+ */
+void hal_spi_cmd (const u1_t* cmd, u1_t cmdlen, u1_t* buf, u1_t len, bit_t read);
+#endif
 
 /*
  * disable all CPU interrupts.
@@ -57,6 +75,9 @@ void hal_enableIRQs (void);
 
 /*
  * put system and CPU in low-power mode, sleep until interrupt.
+ *   - called with interrupts disabled, when no job is runnable
+ *   - may sleep until the timer set by the last hal_checkTimer()
+ *     call that returned 0, or a radio interrupt, whichever is first
  */
 void hal_sleep (void);
 
@@ -77,6 +98,39 @@ void hal_waitUntil (u4_t time);
  */
 u1_t hal_checkTimer (u4_t targettime);
 
+#if defined(LMIC_RX_TIMER)
+/*
+ * arm a one-shot timer that calls radio_rxtimer_handler() once the
+ * given time (in ticks) is reached, replacing any timer armed before.
+ *   - call the handler like radio_irq_handler(), i.e. with interrupts
+ *     enabled and never in the middle of an SPI transaction
+ *   - call it as soon as the time is reached, also when already
+ *     passed, since its accuracy determines the start of the rx window
+ *   - hal_sleep() must wake up in time for it
+ */
+void hal_setRxTimer (u4_t time);
+
+/*
+ * disarm the timer set by hal_setRxTimer(), if still armed.
+ */
+void hal_clearRxTimer (void);
+#endif
+
+#if defined(LMIC_SAVE_RAND_SEED)
+/*
+ * load the 16-byte random seed saved by hal_saveRandSeed() before the
+ * last reboot or deep sleep.
+ *   - return 1 if a seed was saved, 0 otherwise (e.g. after power-up)
+ */
+bit_t hal_loadRandSeed (u1_t* seed);
+
+/*
+ * save a 16-byte random seed, to be loaded by the next boot.
+ *   - storage must survive a reboot or deep sleep (e.g. RTC memory)
+ */
+void hal_saveRandSeed (const u1_t* seed);
+#endif
+
 /*
  * perform fatal failure action.
  *   - called by assertions
@@ -16,6 +16,10 @@
 #error Ping needs beacon tracking
 #endif
 
+#if defined(LMIC_PRECOMPUTE_AES) && defined(DISABLE_AES_KEYCACHE)
+#error Precomputing keystreams needs the AES key cache
+#endif
+
 #if !defined(MINRX_SYMS)
 #define MINRX_SYMS 5
 #endif // !defined(MINRX_SYMS)
@@ -41,6 +45,15 @@
 #define DNW2_SAFETY_ZONE       ms2osticks(750)
 #endif
 
+// Time to start a job before an rx window or tx opens
+#if defined(LMIC_CALIBRATE)
+#define RX_LEAD  (radio_calib()->rx.time)
+#define TX_LEAD  (radio_calib()->tx.time)
+#else
+#define RX_LEAD  RX_RAMPUP
+#define TX_LEAD  TX_RAMPUP
+#endif
+
 // Special APIs - for development or testing
 #define isTESTMODE() 0
 
@@ -134,63 +147,277 @@ u2_t os_crc16 (xref2u1_t data, uint len) {
 // ================================================================================
 // BEG AES
 
-static void micB0 (u4_t devaddr, u4_t seqno, int dndir, int len) {
-    os_clearMem(AESaux,16);
-    AESaux[0]  = 0x49;
-    AESaux[5]  = dndir?1:0;
-    AESaux[15] = len;
-    os_wlsbf4(AESaux+ 6,devaddr);
-    os_wlsbf4(AESaux+10,seqno);
+// Session keys are passed around as the expanded key from the cache in
+// LMIC. Without the cache, they are passed as the raw key instead, and
+// expanded on the stack for every use.
+#if !defined(DISABLE_AES_KEYCACHE)
+typedef const aes_key_t* sesskey_t;
+#define NWKKEY (&LMIC.nwkKeySched)
+#define ARTKEY (&LMIC.artKeySched)
+#define AES_EXPAND(var, key) const aes_key_t* var = (key)
+#else
+typedef xref2cu1_t sesskey_t;
+#define NWKKEY ((sesskey_t)LMIC.nwkKey)
+#define ARTKEY ((sesskey_t)LMIC.artKey)
+#define AES_EXPAND(var, key) aes_key_t var##_buf; const aes_key_t* var = &var##_buf; \
+                             lmic_aes_setkey(&var##_buf, (key))
+#endif
+
+// Update the expanded keys after LMIC.nwkKey or LMIC.artKey changed.
+// Every MIC uses nwkKey, so its CMAC subkey is cached as well.
+static void aes_expandSessKeys (void) {
+#if !defined(DISABLE_AES_KEYCACHE)
+    lmic_aes_setkey(&LMIC.nwkKeySched, LMIC.nwkKey);
+    lmic_aes_cmac_prepare(&LMIC.nwkKeySched);
+    lmic_aes_setkey(&LMIC.artKeySched, LMIC.artKey);
+#endif
+#if defined(LMIC_PRECOMPUTE_AES)
+    LMIC.upStream.key = LMIC.dnStream.key = NULL;
+    LMIC.upB0len = 0;
+#endif
 }
 
 
-static int aes_verifyMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
-    micB0(devaddr, seqno, dndir, len);
-    os_copyMem(AESkey,key,16);
-    return os_aes(AES_MIC, pdu, len) == os_rmsbf4(pdu+len);
+static void micB0 (lmic_aes_cmac_t* cmac, u4_t devaddr, u4_t seqno, int dndir, int len) {
+    u1_t b0[16];
+    os_clearMem(b0,16);
+    b0[0]  = 0x49;
+    b0[5]  = dndir?1:0;
+    b0[15] = len;
+    os_wlsbf4(b0+ 6,devaddr);
+    os_wlsbf4(b0+10,seqno);
+    lmic_aes_cmac_update(cmac, b0, 16);
 }
 
 
-static void aes_appendMic (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
-    micB0(devaddr, seqno, dndir, len);
-    os_copyMem(AESkey,key,16);
-    // MSB because of internal structure of AES
-    os_wmsbf4(pdu+len, os_aes(AES_MIC, pdu, len));
+static u4_t aes_mic (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2cu1_t pdu, int len) {
+    AES_EXPAND(k, key);
+    lmic_aes_cmac_t cmac;
+    lmic_aes_cmac_init(&cmac, k);
+    micB0(&cmac, devaddr, seqno, dndir, len);
+    lmic_aes_cmac_update(&cmac, pdu, len);
+    return lmic_aes_cmac_final(&cmac);
+}
+
+
+static int aes_verifyMic (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t pdu, int len) {
+    return aes_mic(key, devaddr, seqno, dndir, pdu, len) == os_rmsbf4(pdu+len);
+}
+
+
+#if !defined(DISABLE_JOIN)
+static void aes_devKey (aes_key_t* devkey) {
+    u1_t raw[16];
+    os_getDevKey(raw);
+    lmic_aes_setkey(devkey, raw);
+}
+
+
+static u4_t aes_mic0 (const aes_key_t* devkey, xref2cu1_t pdu, int len) {
+    lmic_aes_cmac_t cmac;
+    lmic_aes_cmac_init(&cmac, devkey);
+    lmic_aes_cmac_update(&cmac, pdu, len);
+    return lmic_aes_cmac_final(&cmac);
 }
 
 
 static void aes_appendMic0 (xref2u1_t pdu, int len) {
-    os_getDevKey(AESkey);
-    os_wmsbf4(pdu+len, os_aes(AES_MIC|AES_MICNOAUX, pdu, len));  // MSB because of internal structure of AES
+    aes_key_t devkey;
+    aes_devKey(&devkey);
+    os_wmsbf4(pdu+len, aes_mic0(&devkey, pdu, len));  // MSB because of internal structure of AES
 }
 
 
-static int aes_verifyMic0 (xref2u1_t pdu, int len) {
-    os_getDevKey(AESkey);
-    return os_aes(AES_MIC|AES_MICNOAUX, pdu, len) == os_rmsbf4(pdu+len);
+static int aes_verifyMic0 (const aes_key_t* devkey, xref2u1_t pdu, int len) {
+    return aes_mic0(devkey, pdu, len) == os_rmsbf4(pdu+len);
 }
 
 
-static void aes_encrypt (xref2u1_t pdu, int len) {
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, pdu, len);
+static void aes_encrypt (const aes_key_t* devkey, xref2u1_t pdu, int len) {
+    lmic_aes_ecb(devkey, pdu, len);
+}
+#endif // !DISABLE_JOIN
+
+
+static void cipherA (lmic_aes_ctr_t* ctr, const aes_key_t* key, u4_t devaddr, u4_t seqno, int dndir) {
+    u1_t a[16];
+    os_clearMem(a, 16);
+    a[0] = a[15] = 1; // mode=cipher / dir=down / block counter=1
+    a[5] = dndir?1:0;
+    os_wlsbf4(a+ 6,devaddr);
+    os_wlsbf4(a+10,seqno);
+    lmic_aes_ctr_init(ctr, key, a);
 }
 
 
-static void aes_cipher (xref2cu1_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t payload, int len) {
+#if defined(LMIC_PRECOMPUTE_AES)
+// If the keystream for this payload was precomputed, xor as much of the
+// payload as it covers with it, and advance the counter past it.
+// Returns the number of bytes done.
+static int aes_precomputed (const aes_key_t* key, u4_t seqno, int dndir, lmic_aes_ctr_t* ctr, xref2u1_t payload, int len) {
+    struct keystream_t* s = dndir ? &LMIC.dnStream : &LMIC.upStream;
+    if( s->key != key || s->seqno != seqno )
+        return 0;
+    if( len > (int)sizeof(s->ks) )
+        len = sizeof(s->ks);
+    for( int i=0; i < len; i++ )
+        payload[i] ^= s->ks[i];
+    ctr->ctr[15] += LMIC_PRECOMPUTE_BLOCKS;
+    return len;
+}
+
+
+static void precomputeStream (struct keystream_t* s, const aes_key_t* key, u4_t seqno, int dndir) {
+    lmic_aes_ctr_t ctr;
+    cipherA(&ctr, key, LMIC.devaddr, seqno, dndir);
+    os_clearMem(s->ks, sizeof(s->ks));
+    lmic_aes_ctr_crypt(&ctr, s->ks, sizeof(s->ks));
+    s->key = key;
+    s->seqno = seqno;
+}
+
+
+// Key and frame counter of the next uplink and downlink payload. Most
+// payloads are for ports > 0, except for pending port 0 uplinks.
+#define NEXT_UP_KEY  ((LMIC.opmode & OP_TXDATA) && LMIC.pendTxPort == 0 ? NWKKEY : ARTKEY)
+#define NEXT_UP_SEQNO LMIC.seqnoUp
+#define NEXT_DN_SEQNO LMIC.seqnoDn
+
+bit_t LMIC_precomputePending (void) {
+    if( LMIC.devaddr == 0 || (LMIC.opmode & (OP_JOINING|OP_SHUTDOWN)) )
+        return 0;
+    return LMIC.upStream.key != NEXT_UP_KEY || LMIC.upStream.seqno != NEXT_UP_SEQNO
+        || (LMIC.upLen && (LMIC.upB0len != LMIC.upLen || LMIC.upB0seqno != NEXT_UP_SEQNO))
+        || LMIC.dnStream.key != ARTKEY || LMIC.dnStream.seqno != NEXT_DN_SEQNO;
+}
+
+// Do one piece of the pending precomputation at a time, so a job that
+// becomes due is not delayed for long
+void LMIC_precompute (void) {
+    if( LMIC.upStream.key != NEXT_UP_KEY || LMIC.upStream.seqno != NEXT_UP_SEQNO ) {
+        precomputeStream(&LMIC.upStream, NEXT_UP_KEY, NEXT_UP_SEQNO, /*up*/0);
+    } else if( LMIC.upLen && (LMIC.upB0len != LMIC.upLen || LMIC.upB0seqno != NEXT_UP_SEQNO) ) {
+        // Most applications send the same size frames every time, so
+        // assume the next uplink has the same length as the last one
+        lmic_aes_cmac_t cmac;
+        u1_t zero = 0;
+        lmic_aes_cmac_init(&cmac, NWKKEY);
+        micB0(&cmac, LMIC.devaddr, NEXT_UP_SEQNO, /*up*/0, LMIC.upLen);
+        // Feeding a zero byte makes the CMAC encrypt B0, without
+        // changing the result
+        lmic_aes_cmac_update(&cmac, &zero, 1);
+        os_copyMem(LMIC.upB0mac, cmac.x, 16);
+        LMIC.upB0seqno = NEXT_UP_SEQNO;
+        LMIC.upB0len = LMIC.upLen;
+    } else if( LMIC.dnStream.key != ARTKEY || LMIC.dnStream.seqno != NEXT_DN_SEQNO ) {
+        precomputeStream(&LMIC.dnStream, ARTKEY, NEXT_DN_SEQNO, /*dn*/1);
+    }
+}
+#endif // LMIC_PRECOMPUTE_AES
+
+
+static void aes_cipher (sesskey_t key, u4_t devaddr, u4_t seqno, int dndir, xref2u1_t payload, int len) {
     if( len <= 0 )
         return;
-    os_clearMem(AESaux, 16);
-    AESaux[0] = AESaux[15] = 1; // mode=cipher / dir=down / block counter=1
-    AESaux[5] = dndir?1:0;
-    os_wlsbf4(AESaux+ 6,devaddr);
-    os_wlsbf4(AESaux+10,seqno);
-    os_copyMem(AESkey,key,16);
-    os_aes(AES_CTR, payload, len);
+    AES_EXPAND(k, key);
+    lmic_aes_ctr_t ctr;
+    cipherA(&ctr, k, devaddr, seqno, dndir);
+#if defined(LMIC_PRECOMPUTE_AES)
+    int done = aes_precomputed(k, seqno, dndir, &ctr, payload, len);
+    payload += done;
+    len -= done;
+#endif
+    lmic_aes_ctr_crypt(&ctr, payload, len);
+}
+
+
+// Encrypt the payload of an uplink (from poff up to len) and append the
+// MIC over the whole frame in a single pass. The ciphertext is fed into
+// the CMAC right after it is produced, a few blocks at a time (so the
+// CTR can still encrypt multiple blocks at once). The payload is
+// encrypted with AppSKey when artkey is set, NwkSKey otherwise.
+static void aes_sealUplink (bit_t artkey, u4_t devaddr, u4_t seqno, xref2u1_t pdu, int poff, int len) {
+    AES_EXPAND(nk, NWKKEY);
+    const aes_key_t* ck = nk;
+#if defined(DISABLE_AES_KEYCACHE)
+    aes_key_t ak;
+    if( artkey ) {
+        lmic_aes_setkey(&ak, ARTKEY);
+        ck = &ak;
+    }
+#else
+    if( artkey )
+        ck = ARTKEY;
+#endif
+    lmic_aes_cmac_t cmac;
+    lmic_aes_ctr_t ctr;
+    int off = poff;
+    lmic_aes_cmac_init(&cmac, nk);
+#if defined(LMIC_PRECOMPUTE_AES)
+    if( LMIC.upB0len == len && LMIC.upB0seqno == seqno ) {
+        // B0 was already encrypted, so the CMAC continues from there
+        os_copyMem(cmac.x, LMIC.upB0mac, 16);
+    } else
+#endif
+    micB0(&cmac, devaddr, seqno, /*up*/0, len);
+    lmic_aes_cmac_update(&cmac, pdu, poff);
+    cipherA(&ctr, ck, devaddr, seqno, /*up*/0);
+#if defined(LMIC_PRECOMPUTE_AES)
+    off += aes_precomputed(ck, seqno, /*up*/0, &ctr, pdu+off, len-off);
+    lmic_aes_cmac_update(&cmac, pdu+poff, off-poff);
+    LMIC.upLen = len;
+#endif
+    for( ; off < len; off += 16*AES_MULTI ) {
+        int n = len-off < 16*AES_MULTI ? len-off : 16*AES_MULTI;
+        lmic_aes_ctr_crypt(&ctr, pdu+off, n);
+        lmic_aes_cmac_update(&cmac, pdu+off, n);
+    }
+    // MSB because of internal structure of AES
+    os_wmsbf4(pdu+len, lmic_aes_cmac_final(&cmac));
+}
+
+
+// Batched variants of aes_mic and aes_cipher, for many independent
+// frames. These work in groups of AES_MULTI frames, which the
+// multi-buffer AES functions process in lockstep.
+void LMIC_frameMics (const lmic_frame_t* frames, u4_t* mics, u2_t n) {
+    for( u2_t base=0; base < n; base += AES_MULTI ) {
+        u1_t m = n-base < AES_MULTI ? n-base : AES_MULTI;
+        lmic_aes_cmac_t cmac[AES_MULTI];
+        xref2cu1_t bufs[AES_MULTI];
+        u2_t lens[AES_MULTI];
+        for( u1_t i=0; i < m; i++ ) {
+            const lmic_frame_t* f = &frames[base+i];
+            lmic_aes_cmac_init(&cmac[i], f->key);
+            micB0(&cmac[i], f->devaddr, f->seqno, f->dndir, f->len);
+            bufs[i] = f->buf;
+            lens[i] = f->len;
+        }
+        lmic_aes_cmac_update_multi(cmac, bufs, lens, m);
+        lmic_aes_cmac_final_multi(cmac, mics+base, m);
+    }
+}
+
+
+void LMIC_frameCiphers (const lmic_frame_t* frames, u2_t n) {
+    for( u2_t base=0; base < n; base += AES_MULTI ) {
+        u1_t m = n-base < AES_MULTI ? n-base : AES_MULTI;
+        lmic_aes_ctr_t ctr[AES_MULTI];
+        xref2u1_t bufs[AES_MULTI];
+        u2_t lens[AES_MULTI];
+        for( u1_t i=0; i < m; i++ ) {
+            const lmic_frame_t* f = &frames[base+i];
+            cipherA(&ctr[i], f->key, f->devaddr, f->seqno, f->dndir);
+            bufs[i] = f->buf;
+            lens[i] = f->len;
+        }
+        lmic_aes_ctr_crypt_multi(ctr, bufs, lens, m);
+    }
 }
 
 
-static void aes_sessKeys (u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey, xref2u1_t artkey) {
+#if !defined(DISABLE_JOIN)
+static void aes_sessKeys (const aes_key_t* devkey, u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey, xref2u1_t artkey) {
     os_clearMem(nwkkey, 16);
     nwkkey[0] = 0x01;
     os_copyMem(nwkkey+1, artnonce, LEN_ARTNONCE+LEN_NETID);
@@ -198,11 +425,10 @@ static void aes_sessKeys (u2_t devnonce, xref2cu1_t artnonce, xref2u1_t nwkkey,
     os_copyMem(artkey, nwkkey, 16);
     artkey[0] = 0x02;
 
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, nwkkey, 16);
-    os_getDevKey(AESkey);
-    os_aes(AES_ENC, artkey, 16);
+    lmic_aes_ecb(devkey, nwkkey, 16);
+    lmic_aes_ecb(devkey, artkey, 16);
 }
+#endif // !DISABLE_JOIN
 
 // END AES
 // ================================================================================
@@ -426,11 +652,14 @@ static void calcBcnRxWindowFromMillis (u1_t ms, bit_t ini) {
 #if !defined(DISABLE_PING)
 // Setup scheduled RX window (ping/multicast slot)
 static void rxschedInit (xref2rxsched_t rxsched) {
-    os_clearMem(AESkey,16);
+    aes_key_t key;
+    u1_t zero[16];
+    os_clearMem(zero,16);
+    lmic_aes_setkey(&key, zero);
     os_clearMem(LMIC.frame+8,8);
     os_wlsbf4(LMIC.frame, LMIC.bcninfo.time);
     os_wlsbf4(LMIC.frame+4, LMIC.devaddr);
-    os_aes(AES_ENC,LMIC.frame,16);
+    lmic_aes_ecb(&key,LMIC.frame,16);
     u1_t intvExp = rxsched->intvExp;
     ostime_t off = os_rlsbf2(LMIC.frame) & (0x0FFF >> (7 - intvExp)); // random offset (slot units)
     rxsched->rxbase = (LMIC.bcninfo.txtime +
@@ -1085,7 +1314,7 @@ static bit_t decodeFrame (void) {
 
     seqno = LMIC.seqnoDn + (u2_t)(seqno - LMIC.seqnoDn);
 
-    if( !aes_verifyMic(LMIC.nwkKey, LMIC.devaddr, seqno, /*dn*/1, d, pend) ) {
+    if( !aes_verifyMic(NWKKEY, LMIC.devaddr, seqno, /*dn*/1, d, pend) ) {
         EV(spe3Cond, ERR, (e_.reason = EV::spe3Cond_t::CORRUPTED_MIC,
                            e_.eui1   = MAIN::CDEV->getEui(),
                            e_.info1  = Base::lsbf4(&d[pend]),
@@ -1286,7 +1515,7 @@ static bit_t decodeFrame (void) {
         // Handle payload only if not a replay
         // Decrypt payload - if any
         if( port >= 0  &&  pend-poff > 0 )
-            aes_cipher(port <= 0 ? LMIC.nwkKey : LMIC.artKey, LMIC.devaddr, seqno, /*dn*/1, d+poff, pend-poff);
+            aes_cipher(port <= 0 ? NWKKEY : ARTKEY, LMIC.devaddr, seqno, /*dn*/1, d+poff, pend-poff);
 
         EV(dfinfo, DEBUG, (e_.deveui  = MAIN::CDEV->getEui(),
                            e_.devaddr = LMIC.devaddr,
@@ -1379,9 +1608,83 @@ static void schedRx12 (ostime_t delay, osjobcb_t func, u1_t dr) {
     // Center the receive window on the center of the expected preamble
     // (again note that hsym is half a sumbol time, so no /2 needed)
     LMIC.rxtime = LMIC.txend + delay + PAMBL_SYMS * hsym - LMIC.rxsyms * hsym;
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+    LMIC.dnStart = LMIC.txend + delay;
+#endif
 
-    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, func);
+    os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, LMIC.rxtime - RX_LEAD, func);
+}
+
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+// Track the clock error seen in downlinks: follow increases right away,
+// but decreases only slowly, so a few good downlinks in a row do not
+// shrink the rx windows too much. The rx windows then allow for twice
+// the estimate.
+//
+// The timing error of a downlink is partly RxDone latency the driver
+// did not correct for, which is about proportional to the symbol time,
+// and partly drift, proportional to the time since the uplink:
+//     err = latency * sym + drift * interval
+// The last downlinks in RX1 and RX2 give two of these, which are solved
+// for the drift. When the ratio of sym to interval is too similar in
+// both windows, or there is only one window to go by, all of the error
+// counts as drift, which errs on the side of wide rx windows.
+static void updateClockError (u1_t win, ostime_t err, ostime_t interval, u1_t sym) {
+    int64_t num = err, den = interval;
+    if( LMIC.dnTiming[!win].interval != 0 ) {
+        ostime_t oerr = LMIC.dnTiming[!win].err;
+        int64_t a = (int64_t)LMIC.dnTiming[!win].sym * interval;
+        int64_t b = (int64_t)sym * LMIC.dnTiming[!win].interval;
+        if( 4 * (a > b ? a - b : b - a) >= (a > b ? a : b) ) {
+            num = (int64_t)LMIC.dnTiming[!win].sym * err - (int64_t)sym * oerr;
+            den = a - b;
+        }
+    }
+    LMIC.dnTiming[win].err = err;
+    LMIC.dnTiming[win].interval = interval;
+    LMIC.dnTiming[win].sym = sym;
+
+    if( num < 0 )
+        num = -num;
+    if( den < 0 )
+        den = -den;
+    int64_t seen = num * MAX_CLOCK_ERROR / den;
+    if( seen > 0x7FFF )
+        seen = 0x7FFF;
+    if( seen > LMIC.clockEst )
+        LMIC.clockEst = seen;
+    else
+        LMIC.clockEst -= (LMIC.clockEst - seen) / 8;
+    LMIC.clockError = 2 * LMIC.clockEst;
+#if LMIC_DEBUG_LEVEL > 1
+    lmic_printf("%lu: Clock error %ld ticks in RX%d, estimate %u\n", os_getTime(), (long)err, win + 1, LMIC.clockEst);
+#endif
 }
+#endif
+
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+// After receiving len bytes in RX1 or RX2, which the network sends
+// exactly at the start of the window, LMIC.rxtime should be the end of
+// that frame. Any difference is RxDone latency not corrected for yet,
+// or drift of the clock since the uplink ended. Frames from the class C
+// continuous rx are not necessarily sent at the start of RX2, so they
+// are left out.
+static void checkDnTiming (u1_t len) {
+    if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) == 0 || (LMIC.txrxFlags & TXRX_DNC) != 0
+        || getSf(LMIC.rps) == FSK )
+        return;
+    ostime_t err = LMIC.rxtime - (LMIC.dnStart + calcAirTime(LMIC.rps, len));
+#if defined(LMIC_CALIBRATE)
+    if( (LMIC.txrxFlags & TXRX_DNW1) != 0 )
+        radio_calibrateRxDone(err);
+#endif
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+    // Symbol time in units of 256 us (1 at SF7BW500, 128 at SF12BW125)
+    u1_t sym = (4 << (getSf(LMIC.rps) - SF7)) >> getBw(LMIC.rps);
+    updateClockError((LMIC.txrxFlags & TXRX_DNW2) != 0, err, LMIC.rxtime - LMIC.txend, sym);
+#endif
+}
+#endif
 
 static void setupRx1 (osjobcb_t func) {
     LMIC.txrxFlags = TXRX_DNW1;
@@ -1411,7 +1714,10 @@ static void txDone (ostime_t delay, osjobcb_t func) {
     if( /* TX datarate */LMIC.rxsyms == DR_FSK ) {
         LMIC.rxtime = LMIC.txend + delay - PRERX_FSK*us2osticksRound(160);
         LMIC.rxsyms = RXLEN_FSK;
-        os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, func);
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+        LMIC.dnStart = LMIC.txend + delay;
+#endif
+        os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, LMIC.rxtime - RX_LEAD, func);
     }
     else
 #endif
@@ -1456,10 +1762,10 @@ static bit_t processJoinAccept (void) {
         // Build next JOIN REQUEST with next engineUpdate call
         // Optionally, report join failed.
         // Both after a random/chosen amount of ticks.
-        os_setTimedCallback(&LMIC.osjob, os_getTime()+delay,
-                            (delay&1) != 0
-                            ? FUNC_ADDR(onJoinFailed)      // one JOIN iteration done and failed
-                            : FUNC_ADDR(runEngineUpdate)); // next step to be delayed
+        os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, os_getTime()+delay,
+                                (delay&1) != 0
+                                ? FUNC_ADDR(onJoinFailed)      // one JOIN iteration done and failed
+                                : FUNC_ADDR(runEngineUpdate)); // next step to be delayed
         return 1;
     }
     u1_t hdr  = LMIC.frame[0];
@@ -1476,12 +1782,17 @@ static bit_t processJoinAccept (void) {
             return 0;
         goto nojoinframe;
     }
-    aes_encrypt(LMIC.frame+1, dlen-1);
-    if( !aes_verifyMic0(LMIC.frame, dlen-4) ) {
+    aes_key_t devkey;
+    aes_devKey(&devkey);
+    aes_encrypt(&devkey, LMIC.frame+1, dlen-1);
+    if( !aes_verifyMic0(&devkey, LMIC.frame, dlen-4) ) {
         EV(specCond, ERR, (e_.reason = EV::specCond_t::JOIN_BAD_MIC,
                            e_.info   = mic));
         goto badframe;
     }
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+    checkDnTiming(LMIC.dataLen);
+#endif
 
     u4_t addr = os_rlsbf4(LMIC.frame+OFF_JA_DEVADDR);
     LMIC.devaddr = addr;
@@ -1507,7 +1818,8 @@ static bit_t processJoinAccept (void) {
     }
 
     // already incremented when JOIN REQ got sent off
-    aes_sessKeys(LMIC.devNonce-1, &LMIC.frame[OFF_JA_ARTNONCE], LMIC.nwkKey, LMIC.artKey);
+    aes_sessKeys(&devkey, LMIC.devNonce-1, &LMIC.frame[OFF_JA_ARTNONCE], LMIC.nwkKey, LMIC.artKey);
+    aes_expandSessKeys();
     DO_DEVDB(LMIC.netid,   netid);
     DO_DEVDB(LMIC.devaddr, devaddr);
     DO_DEVDB(LMIC.nwkKey,  nwkkey);
@@ -1574,6 +1886,55 @@ static void jreqDone (xref2osjob_t osjob) {
 // Fwd decl.
 static bit_t processDnData(void);
 
+#if defined(LMIC_CLASSC)
+// Whether to listen on RX2 between transactions. The radio drivers only
+// support continuous rx with LoRa, so with an FSK RX2 datarate the
+// device behaves like class A.
+static bit_t rxC (void) {
+    return (LMIC.opmode & (OP_CLASSC|OP_JOINING)) == OP_CLASSC
+        && getSf(dndr2rps(LMIC.dn2Dr)) != FSK;
+}
+
+// Put the radio to rest if it was listening continuously, and cancel
+// the job waiting for it.
+static void stopRxC (void) {
+    if( (LMIC.opmode & OP_RXCONT) != 0 ) {
+        os_radio(RADIO_RST);
+        os_clearCallback(&LMIC.osjob);
+        LMIC.opmode &= ~OP_RXCONT;
+    }
+}
+
+// Callback from HAL when a frame was received in continuous rx, or when
+// the job timer expires because an uplink is due.
+static void onRxC (xref2osjob_t osjob) {
+    // If we arrive via job timer make sure to put radio to rest.
+    stopRxC();
+    if( LMIC.dataLen != 0 ) {
+        LMIC.txrxFlags = TXRX_DNC;
+        if( decodeFrame() ) {
+            reportEvent(EV_RXCOMPLETE);
+            return;
+        }
+    }
+    engineUpdate();
+}
+
+// Listen on RX2 between transactions, until a frame is received or the
+// timer the caller set on LMIC.osjob expires. Keeps listening if the
+// radio already is.
+static void startRxC (void) {
+    LMIC.osjob.func = FUNC_ADDR(onRxC);
+    if( (LMIC.opmode & OP_RXCONT) != 0 )
+        return;
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.rps = dndr2rps(LMIC.dn2Dr);
+    LMIC.dataLen = 0;
+    LMIC.opmode |= OP_RXCONT;
+    os_radio(RADIO_RXON);
+}
+#endif // LMIC_CLASSC
+
 static void processRx2DnData (xref2osjob_t osjob) {
     if( LMIC.dataLen == 0 ) {
         LMIC.txrxFlags = 0;  // nothing in 1st/2nd DN slot
@@ -1593,10 +1954,87 @@ static void setupRx2DnData (xref2osjob_t osjob) {
     setupRx2();
 }
 
+#if defined(LMIC_CLASSC)
+// Whether the frame just received in continuous rx started within the
+// RX2 window that setupRx2DnDataC worked out. Anything else is a class
+// C downlink that happened to arrive after RX1, not the reply to the
+// uplink.
+static bit_t inRx2Window (void) {
+    // The window is centered on the preamble and allows for being off by
+    // rxsyms half symbols either way (see schedRx12)
+    ostime_t start = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen);
+    ostime_t off = start - (LMIC.txend + sec2osticks(LMIC.rxDelay + (int)DELAY_EXTDNW2));
+    ostime_t margin = LMIC.rxsyms * dr2hsym(LMIC.dn2Dr);
+    return off >= -margin && off <= margin;
+}
+
+// When a frame that started in the RX2 window would have been received
+// completely, which ends the wait for a reply in class C
+static ostime_t rx2EndC (void) {
+    ostime_t hsym = dr2hsym(LMIC.dn2Dr);
+    return LMIC.txend + sec2osticks(LMIC.rxDelay + (int)DELAY_EXTDNW2)
+        + (PAMBL_SYMS + LMIC.rxsyms) * hsym
+        + calcAirTime(dndr2rps(LMIC.dn2Dr), MAX_LEN_FRAME);
+}
+
+static void processRx2DnDataC (xref2osjob_t osjob);
+
+// Listen continuously on RX2 for the reply, until rx2EndC
+static void listenRx2C (void) {
+    LMIC.txrxFlags = TXRX_DNW2;
+    LMIC.rps = dndr2rps(LMIC.dn2Dr);
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.dataLen = 0;
+    os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, rx2EndC(), FUNC_ADDR(processRx2DnDataC));
+    LMIC.opmode |= OP_RXCONT;
+    os_radio(RADIO_RXON);
+}
+
+static void processRx2DnDataC (xref2osjob_t osjob) {
+    // If we arrive via job timer make sure to put radio to rest.
+    stopRxC();
+    if( LMIC.dataLen != 0 && !inRx2Window() ) {
+        // A class C downlink that is not the reply: report it on its own
+        // and keep waiting for the reply, unless the application ended
+        // the transaction meanwhile.
+        LMIC.txrxFlags = TXRX_DNC;
+        if( decodeFrame() )
+            reportEvent(EV_RXCOMPLETE);
+        if( (LMIC.opmode & OP_TXRXPEND) != 0 )
+            listenRx2C();
+        return;
+    }
+    // A class C downlink can just as well land inside the RX2 window, so
+    // checkDnTiming must not take the timing of this frame for the
+    // reply's either.
+    if( LMIC.dataLen != 0 )
+        LMIC.txrxFlags = TXRX_DNW2|TXRX_DNC;
+    processRx2DnData(osjob);
+}
+
+// In class C, RX2 is where the continuous rx starts: listen right after
+// RX1 already, and wait for a reply until a frame that started in the
+// RX2 window would have been received completely. Only a frame that
+// started inside the window counts as received in RX2 (TXRX_DNW2, along
+// with TXRX_DNC), and ends the transaction.
+static void setupRx2DnDataC (void) {
+    // Work out the RX2 window (and the reference for checkDnTiming)
+    schedRx12(sec2osticks(LMIC.rxDelay +(int)DELAY_EXTDNW2), FUNC_ADDR(processRx2DnDataC), LMIC.dn2Dr);
+    listenRx2C();
+}
+#endif // LMIC_CLASSC
+
 
 static void processRx1DnData (xref2osjob_t osjob) {
-    if( LMIC.dataLen == 0 || !processDnData() )
+    if( LMIC.dataLen == 0 || !processDnData() ) {
+#if defined(LMIC_CLASSC)
+        if( rxC() ) {
+            setupRx2DnDataC();
+            return;
+        }
+#endif
         schedRx12(sec2osticks(LMIC.rxDelay +(int)DELAY_EXTDNW2), FUNC_ADDR(setupRx2DnData), LMIC.dn2Dr);
+    }
 }
 
 
@@ -1720,11 +2158,9 @@ static void buildDataFrame (void) {
         }
         LMIC.frame[end] = LMIC.pendTxPort;
         os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
-        aes_cipher(LMIC.pendTxPort==0 ? LMIC.nwkKey : LMIC.artKey,
-                   LMIC.devaddr, LMIC.seqnoUp-1,
-                   /*up*/0, LMIC.frame+end+1, dlen);
     }
-    aes_appendMic(LMIC.nwkKey, LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame, flen-4);
+    aes_sealUplink(txdata && LMIC.pendTxPort != 0, LMIC.devaddr, LMIC.seqnoUp-1,
+                   LMIC.frame, txdata ? end+1 : flen-4, flen-4);
 
     EV(dfinfo, DEBUG, (e_.deveui  = MAIN::CDEV->getEui(),
                        e_.devaddr = LMIC.devaddr,
@@ -1757,7 +2193,7 @@ static void onBcnRx (xref2osjob_t job) {
         // Something is wrong with the beacon - continue scan
         LMIC.dataLen = 0;
         os_radio(RADIO_RXON);
-        os_setTimedCallback(&LMIC.osjob, LMIC.bcninfo.txtime, FUNC_ADDR(onBcnRx));
+        os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, LMIC.bcninfo.txtime, FUNC_ADDR(onBcnRx));
         return;
     }
     // Found our 1st beacon
@@ -1784,14 +2220,14 @@ static void startScan (void) {
     LMIC.opmode = (LMIC.opmode | OP_SCAN) & ~(OP_TXRXPEND);
     setBcnRxParams();
     LMIC.rxtime = LMIC.bcninfo.txtime = os_getTime() + sec2osticks(BCN_INTV_sec+1);
-    os_setTimedCallback(&LMIC.osjob, LMIC.rxtime, FUNC_ADDR(onBcnRx));
+    os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, LMIC.rxtime, FUNC_ADDR(onBcnRx));
     os_radio(RADIO_RXON);
 }
 
 
 bit_t LMIC_enableTracking (u1_t tryBcnInfo) {
-    if( (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_SHUTDOWN)) != 0 )
-        return 0;  // already in progress or failed to enable
+    if( (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_SHUTDOWN|OP_CLASSC)) != 0 )
+        return 0;  // already in progress, failed to enable or class C
     // If BCN info requested from NWK then app has to take are
     // of sending data up so that MCMD_BCNI_REQ can be attached.
     if( (LMIC.bcninfoTries = tryBcnInfo) == 0 )
@@ -1856,7 +2292,7 @@ bit_t LMIC_startJoining (void) {
         initJoinLoop();
         LMIC.opmode |= OP_JOINING;
         // reportEvent will call engineUpdate which then starts sending JOIN REQUESTS
-        os_setCallback(&LMIC.osjob, FUNC_ADDR(startJoining));
+        os_setCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, FUNC_ADDR(startJoining));
         return 1;
     }
     return 0; // already joined
@@ -1942,11 +2378,17 @@ static bit_t processDnData (void) {
 #endif // !DISABLE_BEACONS
         return 1;
     }
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+    u1_t dlen = LMIC.dataLen; // decodeFrame leaves just the payload
+#endif
     if( !decodeFrame() ) {
         if( (LMIC.txrxFlags & TXRX_DNW1) != 0 )
             return 0;
         goto norx;
     }
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+    checkDnTiming(dlen);
+#endif
     goto txcomplete;
 }
 
@@ -2053,8 +2495,8 @@ static void engineUpdate (void) {
 #if !defined(DISABLE_BEACONS)
     if( (LMIC.opmode & OP_TRACK) != 0 ) {
         // We are tracking a beacon
-        ASSERT( now + RX_RAMPUP - LMIC.bcnRxtime <= 0 );
-        rxtime = LMIC.bcnRxtime - RX_RAMPUP;
+        ASSERT( now + RX_LEAD - LMIC.bcnRxtime <= 0 );
+        rxtime = LMIC.bcnRxtime - RX_LEAD;
     }
 #endif // !DISABLE_BEACONS
 
@@ -2105,13 +2547,19 @@ static void engineUpdate (void) {
             goto checkrx;
         }
 #endif // !DISABLE_BEACONS
-        // Earliest possible time vs overhead to setup radio
-        if( txbeg - (now + TX_RAMPUP) < 0 ) {
+        // Earliest possible time vs overhead to setup radio. A delayed
+        // update runs at exactly txbeg-TX_LEAD (see txdelay below), which
+        // must count as ready, or it would keep rescheduling itself until
+        // the clock ticks.
+        if( txbeg - (now + TX_LEAD) <= 0 ) {
             #if LMIC_DEBUG_LEVEL > 1
                 lmic_printf("%lu: Ready for uplink\n", os_getTime());
             #endif
             // We could send right now!
         txbeg = now;
+#if defined(LMIC_CLASSC)
+            stopRxC();
+#endif
             dr_t txdr = (dr_t)LMIC.datarate;
 #if !defined(DISABLE_JOIN)
             if( jacc ) {
@@ -2136,7 +2584,7 @@ static void engineUpdate (void) {
                     // Device has to react! NWK will not roll over and just stop sending.
                     // Thus, we have N frames to detect a possible lock up.
                   reset:
-                    os_setCallback(&LMIC.osjob, FUNC_ADDR(runReset));
+                    os_setCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, FUNC_ADDR(runReset));
                     return;
                 }
                 if( (LMIC.txCnt==0 && LMIC.seqnoUp == 0xFFFFFFFF) ) {
@@ -2156,6 +2604,9 @@ static void engineUpdate (void) {
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             updateTx(txbeg);
             os_radio(RADIO_TX);
+#if defined(LMIC_CALIBRATE)
+            radio_calibrateTx(os_getTime() - now);
+#endif
             return;
         }
         #if LMIC_DEBUG_LEVEL > 1
@@ -2169,6 +2620,15 @@ static void engineUpdate (void) {
             txbeg += 1;  // TX delayed by one tick (insignificant amount of time)
     } else {
         // No TX pending - no scheduled RX
+#if defined(LMIC_CLASSC)
+        if( rxC() ) {
+            // Listen until a frame arrives
+            os_clearCallback(&LMIC.osjob);
+            startRxC();
+            return;
+        }
+        stopRxC();
+#endif
         if( (LMIC.opmode & OP_TRACK) == 0 )
             return;
     }
@@ -2179,7 +2639,7 @@ static void engineUpdate (void) {
 #if !defined(DISABLE_PING)
     if( (LMIC.opmode & OP_PINGINI) != 0 ) {
         // One more RX slot in this beacon period?
-        if( rxschedNext(&LMIC.ping, now+RX_RAMPUP) ) {
+        if( rxschedNext(&LMIC.ping, now+RX_LEAD) ) {
             if( txbeg != 0  &&  (txbeg - LMIC.ping.rxtime) < 0 )
                 goto txdelay;
             LMIC.rxsyms  = LMIC.ping.rxsyms;
@@ -2187,8 +2647,8 @@ static void engineUpdate (void) {
             LMIC.freq    = LMIC.ping.freq;
             LMIC.rps     = dndr2rps(LMIC.ping.dr);
             LMIC.dataLen = 0;
-            ASSERT(LMIC.rxtime - now+RX_RAMPUP >= 0 );
-            os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startRxPing));
+            ASSERT(LMIC.rxtime - now+RX_LEAD >= 0 );
+            os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, LMIC.rxtime - RX_LEAD, FUNC_ADDR(startRxPing));
             return;
         }
         // no - just wait for the beacon
@@ -2206,7 +2666,7 @@ static void engineUpdate (void) {
         os_radio(RADIO_RX);
         return;
     }
-    os_setTimedCallback(&LMIC.osjob, rxtime, FUNC_ADDR(startRxBcn));
+    os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, rxtime, FUNC_ADDR(startRxBcn));
     return;
 #endif // !DISABLE_BEACONS
 
@@ -2215,7 +2675,16 @@ static void engineUpdate (void) {
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = osticks2ms(txbeg-now),
                        e_.info2  = LMIC.seqnoUp-1));
-    os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
+#if defined(LMIC_CLASSC)
+    if( rxC() ) {
+        // Listen until the uplink is due
+        os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, txbeg-TX_LEAD, FUNC_ADDR(onRxC));
+        startRxC();
+        return;
+    }
+    stopRxC();
+#endif
+    os_setTimedCallbackPrio(&LMIC.osjob, OSJOB_PRIO_MAC, txbeg-TX_LEAD, FUNC_ADDR(runEngineUpdate));
 }
 
 
@@ -2279,7 +2748,7 @@ void LMIC_init (void) {
 
 
 void LMIC_clrTxData (void) {
-    LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL);
+    LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL|OP_RXCONT);
     LMIC.pendTxLen = 0;
     if( (LMIC.opmode & (OP_JOINING|OP_SCAN)) != 0 ) // do not interfere with JOINING
         return;
@@ -2324,6 +2793,30 @@ void LMIC_tryRejoin (void) {
     engineUpdate();
 }
 
+#if defined(LMIC_CLASSC)
+// Switch class C on or off. While on, the radio listens on RX2 whenever
+// no uplink or RX1 is in progress, and received frames are reported
+// with EV_RXCOMPLETE (TXRX_DNC set in LMIC.txrxFlags). Fails when beacon
+// tracking is enabled, which cannot be combined with class C. Like the
+// other session settings, LMIC_reset() switches it off again.
+bit_t LMIC_setClassC (bit_t enabled) {
+    if( enabled ) {
+#if !defined(DISABLE_BEACONS)
+        if( (LMIC.opmode & (OP_SCAN|OP_TRACK)) != 0 || LMIC.bcninfoTries != 0 )
+            return 0;
+#endif // !DISABLE_BEACONS
+        LMIC.opmode |= OP_CLASSC;
+    } else {
+        LMIC.opmode &= ~OP_CLASSC;
+        // The RX2 window of a transaction ends by itself
+        if( (LMIC.opmode & OP_TXRXPEND) == 0 )
+            stopRxC();
+    }
+    engineUpdate();
+    return 1;
+}
+#endif // LMIC_CLASSC
+
 //! \brief Setup given session keys
 //! and put the MAC in a state as if
 //! a join request/accept would have negotiated just these keys.
@@ -2345,6 +2838,7 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t
         os_copyMem(LMIC.nwkKey, nwkKey, 16);
     if( artKey != (xref2u1_t)0 )
         os_copyMem(LMIC.artKey, artKey, 16);
+    aes_expandSessKeys();
 
 #if defined(CFG_eu868)
     initDefaultChannels(0);
@@ -2377,6 +2871,180 @@ void LMIC_setLinkCheckMode (bit_t enabled) {
 // Sets the max clock error to compensate for (defaults to 0, which
 // allows for +/- 640 at SF7BW250). MAX_CLOCK_ERROR represents +/-100%,
 // so e.g. for a +/-1% error you would pass MAX_CLOCK_ERROR * 1 / 100.
+// With LMIC_AUTO_CLOCK_ERROR, this is only the starting point, which
+// the error measured in received downlinks then replaces.
 void LMIC_setClockError(u2_t error) {
     LMIC.clockError = error;
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+    // Starting point of the estimate, see updateClockError
+    LMIC.clockEst = error / 2;
+#endif
+}
+
+#if defined(LMIC_CALIBRATE)
+// Copy the timing calibration learned so far, e.g. to store it along
+// with the session.
+void LMIC_getCalibration (struct lmic_calib_t* calib) {
+    *calib = *radio_calib();
+}
+
+// Restore a calibration saved with LMIC_getCalibration, after os_init().
+void LMIC_setCalibration (const struct lmic_calib_t* calib) {
+    *radio_calib() = *calib;
+}
+#endif
+
+#if defined(LMIC_MULTI_INSTANCE)
+// ================================================================================
+// Context variants of the API. These select the given instance and then
+// do the same as their regular counterparts.
+
+#if defined(CFG_eu868)
+bit_t LMIC_setupBand_ctx (lmic_ctx_t* ctx, u1_t bandidx, s1_t txpow, u2_t txcap) {
+    lmic_ctx = ctx;
+    return LMIC_setupBand(bandidx, txpow, txcap);
+}
+#endif
+
+bit_t LMIC_setupChannel_ctx (lmic_ctx_t* ctx, u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
+    lmic_ctx = ctx;
+    return LMIC_setupChannel(chidx, freq, drmap, band);
+}
+
+void LMIC_disableChannel_ctx (lmic_ctx_t* ctx, u1_t channel) {
+    lmic_ctx = ctx;
+    LMIC_disableChannel(channel);
+}
+
+#if defined(CFG_us915)
+void LMIC_enableChannel_ctx (lmic_ctx_t* ctx, u1_t channel) {
+    lmic_ctx = ctx;
+    LMIC_enableChannel(channel);
+}
+
+void LMIC_enableSubBand_ctx (lmic_ctx_t* ctx, u1_t band) {
+    lmic_ctx = ctx;
+    LMIC_enableSubBand(band);
+}
+
+void LMIC_disableSubBand_ctx (lmic_ctx_t* ctx, u1_t band) {
+    lmic_ctx = ctx;
+    LMIC_disableSubBand(band);
 }
+
+void LMIC_selectSubBand_ctx (lmic_ctx_t* ctx, u1_t band) {
+    lmic_ctx = ctx;
+    LMIC_selectSubBand(band);
+}
+#endif
+
+void LMIC_setDrTxpow_ctx (lmic_ctx_t* ctx, dr_t dr, s1_t txpow) {
+    lmic_ctx = ctx;
+    LMIC_setDrTxpow(dr, txpow);
+}
+
+void LMIC_setAdrMode_ctx (lmic_ctx_t* ctx, bit_t enabled) {
+    lmic_ctx = ctx;
+    LMIC_setAdrMode(enabled);
+}
+
+#if !defined(DISABLE_JOIN)
+bit_t LMIC_startJoining_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    return LMIC_startJoining();
+}
+
+void LMIC_tryRejoin_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_tryRejoin();
+}
+#endif
+
+void LMIC_shutdown_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_shutdown();
+}
+
+void LMIC_reset_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_reset();
+}
+
+void LMIC_clrTxData_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_clrTxData();
+}
+
+void LMIC_setTxData_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_setTxData();
+}
+
+int LMIC_setTxData2_ctx (lmic_ctx_t* ctx, u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
+    lmic_ctx = ctx;
+    return LMIC_setTxData2(port, data, dlen, confirmed);
+}
+
+void LMIC_sendAlive_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_sendAlive();
+}
+
+#if !defined(DISABLE_BEACONS)
+bit_t LMIC_enableTracking_ctx (lmic_ctx_t* ctx, u1_t tryBcnInfo) {
+    lmic_ctx = ctx;
+    return LMIC_enableTracking(tryBcnInfo);
+}
+
+void LMIC_disableTracking_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_disableTracking();
+}
+#endif
+
+#if !defined(DISABLE_PING)
+void LMIC_stopPingable_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    LMIC_stopPingable();
+}
+
+void LMIC_setPingable_ctx (lmic_ctx_t* ctx, u1_t intvExp) {
+    lmic_ctx = ctx;
+    LMIC_setPingable(intvExp);
+}
+#endif
+
+#if defined(LMIC_CLASSC)
+bit_t LMIC_setClassC_ctx (lmic_ctx_t* ctx, bit_t enabled) {
+    lmic_ctx = ctx;
+    return LMIC_setClassC(enabled);
+}
+#endif
+
+void LMIC_setSession_ctx (lmic_ctx_t* ctx, u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey) {
+    lmic_ctx = ctx;
+    LMIC_setSession(netid, devaddr, nwkKey, artKey);
+}
+
+void LMIC_setLinkCheckMode_ctx (lmic_ctx_t* ctx, bit_t enabled) {
+    lmic_ctx = ctx;
+    LMIC_setLinkCheckMode(enabled);
+}
+
+void LMIC_setClockError_ctx (lmic_ctx_t* ctx, u2_t error) {
+    lmic_ctx = ctx;
+    LMIC_setClockError(error);
+}
+
+#if defined(LMIC_CALIBRATE)
+void LMIC_getCalibration_ctx (lmic_ctx_t* ctx, struct lmic_calib_t* calib) {
+    lmic_ctx = ctx;
+    LMIC_getCalibration(calib);
+}
+
+void LMIC_setCalibration_ctx (lmic_ctx_t* ctx, const struct lmic_calib_t* calib) {
+    lmic_ctx = ctx;
+    LMIC_setCalibration(calib);
+}
+#endif
+#endif // defined(LMIC_MULTI_INSTANCE)
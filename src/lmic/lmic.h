@@ -106,6 +106,19 @@ struct bcninfo_t {
 };
 #endif // !DISABLE_BEACONS
 
+#if defined(LMIC_PRECOMPUTE_AES)
+#if !defined(LMIC_PRECOMPUTE_BLOCKS)
+#define LMIC_PRECOMPUTE_BLOCKS 4
+#endif
+// Precomputed CTR keystream for the start of the payload of one frame,
+// see LMIC_PRECOMPUTE_AES in config.h
+struct keystream_t {
+    const aes_key_t* key;     // key used, NULL if invalid
+    u4_t             seqno;   // frame counter used
+    u1_t             ks[16*LMIC_PRECOMPUTE_BLOCKS];
+};
+#endif // LMIC_PRECOMPUTE_AES
+
 // purpose of receive window - lmic_t.rxState
 enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3 };
 // Netid values /  lmic_t.netid
@@ -126,6 +139,8 @@ enum { OP_NONE     = 0x0000,
        OP_NEXTCHNL = 0x0800, // find a new channel
        OP_LINKDEAD = 0x1000, // link was reported as dead
        OP_TESTMODE = 0x2000, // developer test mode
+       OP_CLASSC   = 0x4000, // class C: listen on RX2 between transactions
+       OP_RXCONT   = 0x8000, // continuous RX on RX2 running (class C)
 };
 // TX-RX transaction flags - report back to user
 enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
@@ -134,7 +149,9 @@ enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
        TXRX_PORT   = 0x10,   // set if a frame with a port was RXed, LMIC.frame[LMIC.dataBeg-1] => port
        TXRX_DNW1   = 0x01,   // received in 1st DN slot
        TXRX_DNW2   = 0x02,   // received in 2dn DN slot
-       TXRX_PING   = 0x04 }; // received in a scheduled RX slot
+       TXRX_PING   = 0x04,   // received in a scheduled RX slot
+       TXRX_DNC    = 0x08 }; // received in continuous RX (class C), also
+                             // set with TXRX_DNW2 for a reply in class C
 // Event types for event callback
 enum _ev_t { EV_SCAN_TIMEOUT=1, EV_BEACON_FOUND,
              EV_BEACON_MISSED, EV_BEACON_TRACKED, EV_JOINING,
@@ -148,10 +165,34 @@ enum {
         MAX_CLOCK_ERROR = 65536,
 };
 
+#if defined(LMIC_CALIBRATE)
+//! How long before a radio operation its job starts, adapted to what
+//! the last operations needed (see radio.c).
+struct lmic_rampup_t {
+    ostime_t    time;   //!< current ramp-up
+    ostime_t    worst;  //!< most needed in the current round
+    u1_t        count;  //!< operations in the current round
+};
+
+//! Timing calibration of the radio, measured while running. It is reset
+//! by os_init() and kept by LMIC_reset(). An application can save it
+//! (LMIC_getCalibration) and restore it after the next os_init()
+//! (LMIC_setCalibration) to skip learning again.
+struct lmic_calib_t {
+    struct lmic_rampup_t rx;   //!< job start to rx window start
+    struct lmic_rampup_t tx;   //!< job start to tx start
+    u2_t        rxdone[SF12-SF7+1][BW500+1]; //!< RxDone latency in ticks, by SF and BW
+    u2_t        txdone;        //!< TxDone latency in ticks
+};
+#endif
+
 struct lmic_t {
     // Radio settings TX/RX (also accessed by HAL)
     ostime_t    txend;
     ostime_t    rxtime;
+#if defined(LMIC_CALIBRATE) || defined(LMIC_AUTO_CLOCK_ERROR)
+    ostime_t    dnStart;      // expected start of a downlink in RX1/RX2
+#endif
     u4_t        freq;
     s1_t        rssi;
     s1_t        snr;
@@ -193,6 +234,14 @@ struct lmic_t {
 
     u2_t        clockError; // Inaccuracy in the clock. CLOCK_ERROR_MAX
                             // represents +/-100% error
+#if defined(LMIC_AUTO_CLOCK_ERROR)
+    u2_t        clockEst;   // clock error seen in downlinks, same unit
+    struct {
+        ostime_t err;       // timing error of the last downlink in RX1/RX2
+        ostime_t interval;  // how long after the uplink (0 if none yet)
+        u1_t     sym;       // symbol time of the window, see checkDnTiming
+    } dnTiming[2];
+#endif
 
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
@@ -202,6 +251,18 @@ struct lmic_t {
     u2_t        devNonce;     // last generated nonce
     u1_t        nwkKey[16];   // network session key
     u1_t        artKey[16];   // application router session key
+#if !defined(DISABLE_AES_KEYCACHE)
+    aes_key_t   nwkKeySched;  // nwkKey, expanded
+    aes_key_t   artKeySched;  // artKey, expanded
+#endif
+#if defined(LMIC_PRECOMPUTE_AES)
+    struct keystream_t upStream;  // payload keystream of the next uplink
+    struct keystream_t dnStream;  // and of the next downlink
+    u1_t        upB0mac[16];  // MIC state after B0 of the next uplink
+    u4_t        upB0seqno;
+    u1_t        upB0len;      // frame length (without MIC) used for upB0mac, 0 if invalid
+    u1_t        upLen;        // frame length (without MIC) of the last uplink
+#endif
     devaddr_t   devaddr;
     u4_t        seqnoDn;      // device level down stream seqno
     u4_t        seqnoUp;
@@ -256,6 +317,34 @@ struct lmic_t {
     bcninfo_t   bcninfo;      // Last received beacon info
 #endif
 };
+
+//! Shadow copies of radio configuration registers, kept by radio.c to
+//! skip writes that would not change anything.
+#define RADIO_REGCACHE_SIZE 17
+struct radio_regcache_t {
+    u1_t        val[RADIO_REGCACHE_SIZE];
+    u4_t        valid;  // bit n set when val[n] is known to match the radio
+};
+
+#if defined(LMIC_MULTI_INSTANCE)
+//! All state of a single LMIC instance. lmic_ctx points to the
+//! instance that is currently running. The application allocates a
+//! context for every instance, and points hal to the HAL-specific
+//! state for its radio (see hal/hal.h). LMIC uses the reentrant
+//! lmic_aes_* API with keys in this context, so no AES state is shared
+//! between instances.
+struct lmic_ctx_t {
+    struct lmic_t     lmic;
+    struct osstate_t  os;
+    u1_t              randbuf[16];
+    struct radio_regcache_t regcache;
+#if defined(LMIC_CALIBRATE)
+    struct lmic_calib_t calib;
+#endif
+    void*             hal;
+};
+#endif
+
 //! \var struct lmic_t LMIC
 //! The state of LMIC MAC layer is encapsulated in this variable.
 DECLARE_LMIC; //!< \internal
@@ -301,10 +390,89 @@ void  LMIC_setPingable   (u1_t intvExp);
 #if !defined(DISABLE_JOIN)
 void  LMIC_tryRejoin     (void);
 #endif
+#if defined(LMIC_CLASSC)
+bit_t LMIC_setClassC     (bit_t enabled);
+#endif
 
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
 void LMIC_setLinkCheckMode (bit_t enabled);
 void LMIC_setClockError(u2_t error);
+#if defined(LMIC_CALIBRATE)
+void LMIC_getCalibration (struct lmic_calib_t* calib);
+void LMIC_setCalibration (const struct lmic_calib_t* calib);
+#endif
+
+#if defined(LMIC_MULTI_INSTANCE)
+// Variants of the above that select the given instance first. Code
+// that accesses LMIC directly must set lmic_ctx itself.
+#if defined(CFG_eu868)
+bit_t LMIC_setupBand_ctx (lmic_ctx_t* ctx, u1_t bandidx, s1_t txpow, u2_t txcap);
+#endif
+bit_t LMIC_setupChannel_ctx (lmic_ctx_t* ctx, u1_t channel, u4_t freq, u2_t drmap, s1_t band);
+void  LMIC_disableChannel_ctx (lmic_ctx_t* ctx, u1_t channel);
+#if defined(CFG_us915)
+void  LMIC_enableChannel_ctx (lmic_ctx_t* ctx, u1_t channel);
+void  LMIC_enableSubBand_ctx (lmic_ctx_t* ctx, u1_t band);
+void  LMIC_disableSubBand_ctx (lmic_ctx_t* ctx, u1_t band);
+void  LMIC_selectSubBand_ctx (lmic_ctx_t* ctx, u1_t band);
+#endif
+void  LMIC_setDrTxpow_ctx   (lmic_ctx_t* ctx, dr_t dr, s1_t txpow);
+void  LMIC_setAdrMode_ctx   (lmic_ctx_t* ctx, bit_t enabled);
+#if !defined(DISABLE_JOIN)
+bit_t LMIC_startJoining_ctx (lmic_ctx_t* ctx);
+void  LMIC_tryRejoin_ctx    (lmic_ctx_t* ctx);
+#endif
+void  LMIC_shutdown_ctx     (lmic_ctx_t* ctx);
+void  LMIC_reset_ctx        (lmic_ctx_t* ctx);
+void  LMIC_clrTxData_ctx    (lmic_ctx_t* ctx);
+void  LMIC_setTxData_ctx    (lmic_ctx_t* ctx);
+int   LMIC_setTxData2_ctx   (lmic_ctx_t* ctx, u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
+void  LMIC_sendAlive_ctx    (lmic_ctx_t* ctx);
+#if !defined(DISABLE_BEACONS)
+bit_t LMIC_enableTracking_ctx  (lmic_ctx_t* ctx, u1_t tryBcnInfo);
+void  LMIC_disableTracking_ctx (lmic_ctx_t* ctx);
+#endif
+#if !defined(DISABLE_PING)
+void  LMIC_stopPingable_ctx  (lmic_ctx_t* ctx);
+void  LMIC_setPingable_ctx   (lmic_ctx_t* ctx, u1_t intvExp);
+#endif
+#if defined(LMIC_CLASSC)
+bit_t LMIC_setClassC_ctx     (lmic_ctx_t* ctx, bit_t enabled);
+#endif
+void  LMIC_setSession_ctx (lmic_ctx_t* ctx, u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+void  LMIC_setLinkCheckMode_ctx (lmic_ctx_t* ctx, bit_t enabled);
+void  LMIC_setClockError_ctx (lmic_ctx_t* ctx, u2_t error);
+#if defined(LMIC_CALIBRATE)
+void  LMIC_getCalibration_ctx (lmic_ctx_t* ctx, struct lmic_calib_t* calib);
+void  LMIC_setCalibration_ctx (lmic_ctx_t* ctx, const struct lmic_calib_t* calib);
+#endif
+#endif // defined(LMIC_MULTI_INSTANCE)
+
+// Crypto for many independent frames (e.g. of different devices) at
+// once, for simulations and network-side processing. Every frame has
+// its own expanded key (see lmic_aes_setkey, and lmic_aes_cmac_prepare
+// for keys used for MICs). LMIC_frameMics calculates the MIC over buf
+// (the frame without its MIC) as an MSBF number, so it can be compared
+// with os_rmsbf4(buf+len). LMIC_frameCiphers encrypts or decrypts the
+// FRMPayload in buf in place. Neither uses or changes the LMIC state.
+typedef struct {
+    const aes_key_t* key;      // NwkSKey, or AppSKey for FRMPayloads on FPort > 0
+    devaddr_t        devaddr;
+    u4_t             seqno;    // full 32-bit frame counter
+    u1_t             dndir;    // 1 for downlinks, 0 for uplinks
+    xref2u1_t        buf;
+    u1_t             len;
+} lmic_frame_t;
+void LMIC_frameMics    (const lmic_frame_t* frames, u4_t* mics, u2_t n);
+void LMIC_frameCiphers (const lmic_frame_t* frames, u2_t n);
+
+#if defined(LMIC_PRECOMPUTE_AES)
+// Called by os_runloop_once() when no job is due. When there is
+// something to precompute, it calls LMIC_precompute() (with interrupts
+// enabled) instead of sleeping.
+bit_t LMIC_precomputePending (void);
+void  LMIC_precompute (void);
+#endif
 
 // Declare onEvent() function, to make sure any definition will have the
 // C conventions, even when in a C++ file.
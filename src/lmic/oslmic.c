@@ -22,10 +22,11 @@ extern inline s4_t table_get_s4(const s4_t *table, size_t index);
 extern inline ostime_t table_get_ostime(const ostime_t *table, size_t index);
 
 // RUNTIME STATE
-static struct {
-    osjob_t* scheduledjobs;
-    osjob_t* runnablejobs;
-} OS;
+#if defined(LMIC_MULTI_INSTANCE)
+#define OS (lmic_ctx->os)
+#else
+static struct osstate_t OS;
+#endif
 
 void os_init () {
     memset(&OS, 0x00, sizeof(OS));
@@ -38,20 +39,154 @@ ostime_t os_getTime () {
     return hal_ticks();
 }
 
-static u1_t unlinkjob (osjob_t** pnext, osjob_t* job) {
-    for( ; *pnext; pnext = &((*pnext)->next)) {
-        if(*pnext == job) { // unlink
-            *pnext = job->next;
-            return 1;
-        }
+// Returns nonzero when job a must run before job b
+static u1_t jobBefore (osjob_t* a, osjob_t* b) {
+    if(a->runnable != b->runnable)
+        return a->runnable;
+    return a->deadline - b->deadline < 0; // (cmp diff, not abs!)
+}
+
+// Every priority has its own queue, kept as a binary heap whose links
+// live in the jobs themselves, so the number of queued jobs is not
+// limited. The heap is a complete binary tree: a queued job at position
+// pos (the root is 1) has its children at 2*pos and 2*pos+1, so the
+// bits of pos below the top one spell out the path from the root, 0 for
+// left and 1 for right. Every operation follows at most one such path.
+
+// Return the job at position pos (1..OS.njobs[prio]) of a queue
+static osjob_t* jobAt (u1_t prio, u2_t pos) {
+    osjob_t* job = OS.jobs[prio];
+    u2_t bit = 0x8000;
+    while(!(pos & bit))
+        bit >>= 1;
+    while(bit >>= 1)
+        job = (pos & bit) ? job->right : job->left;
+    return job;
+}
+
+// Swap a job with its parent
+static void swapUp (osjob_t* job) {
+    osjob_t* p = job->parent;
+    osjob_t* l = job->left;
+    osjob_t* r = job->right;
+    if(p->left == job) {
+        job->left = p;
+        job->right = p->right;
+        if(job->right)
+            job->right->parent = job;
+    } else {
+        job->right = p;
+        job->left = p->left;
+        job->left->parent = job;
+    }
+    job->parent = p->parent;
+    if(!job->parent)
+        OS.jobs[job->prio] = job;
+    else if(job->parent->left == p)
+        job->parent->left = job;
+    else
+        job->parent->right = job;
+    p->parent = job;
+    p->left = l;
+    p->right = r;
+    if(l)
+        l->parent = p;
+    if(r)
+        r->parent = p;
+    u2_t pos = job->pos;
+    job->pos = p->pos;
+    p->pos = pos;
+}
+
+static void siftUp (osjob_t* job) {
+    while(job->parent && jobBefore(job, job->parent))
+        swapUp(job);
+}
+
+static void siftDown (osjob_t* job) {
+    while(1) {
+        osjob_t* c = job->left;
+        if(c && job->right && jobBefore(job->right, c))
+            c = job->right;
+        if(!c || !jobBefore(c, job))
+            break;
+        swapUp(c);
     }
-    return 0;
+}
+
+// A job only counts as queued when its position leads back to it, so
+// jobs need no initialization before their first use, and jobs queued
+// before the last os_init() do not count.
+static u1_t isqueued (osjob_t* job) {
+    return job->prio < OSJOB_NUM_PRIOS
+        && job->pos >= 1 && job->pos <= OS.njobs[job->prio]
+        && jobAt(job->prio, job->pos) == job;
+}
+
+static void unlinkjob (osjob_t* job) {
+    u1_t prio = job->prio;
+    // take the last job out of the tree
+    osjob_t* last = jobAt(prio, OS.njobs[prio]);
+    if(!last->parent)
+        OS.jobs[prio] = NULL;
+    else if(last->parent->left == last)
+        last->parent->left = NULL;
+    else
+        last->parent->right = NULL;
+    OS.njobs[prio]--;
+    // and put it in the place of the removed job
+    if(last != job) {
+        last->parent = job->parent;
+        last->left = job->left;
+        last->right = job->right;
+        last->pos = job->pos;
+        if(!last->parent)
+            OS.jobs[prio] = last;
+        else if(last->parent->left == job)
+            last->parent->left = last;
+        else
+            last->parent->right = last;
+        if(last->left)
+            last->left->parent = last;
+        if(last->right)
+            last->right->parent = last;
+        siftUp(last);
+        siftDown(last);
+    }
+    job->pos = 0;
+}
+
+static void linkjob (osjob_t* job) {
+    u1_t prio = job->prio;
+    ASSERT(prio < OSJOB_NUM_PRIOS && OS.njobs[prio] < 0xFFFF);
+    job->pos = ++OS.njobs[prio];
+    job->left = job->right = NULL;
+    if(job->pos == 1) {
+        job->parent = NULL;
+        OS.jobs[prio] = job;
+    } else {
+        job->parent = jobAt(prio, job->pos >> 1);
+        if(job->pos & 1)
+            job->parent->right = job;
+        else
+            job->parent->left = job;
+        siftUp(job);
+    }
+#if defined(LMIC_OS_STATS)
+    u2_t queued = 0;
+    for(u1_t p = 0; p < OSJOB_NUM_PRIOS; p++)
+        queued += OS.njobs[p];
+    if(queued > OS.stats.maxQueued)
+        OS.stats.maxQueued = queued;
+#endif
 }
 
 // clear scheduled job
 void os_clearCallback (osjob_t* job) {
     hal_disableIRQs();
-    u1_t res = unlinkjob(&OS.scheduledjobs, job) || unlinkjob(&OS.runnablejobs, job);
+    u1_t res = isqueued(job);
+    if(res)
+        unlinkjob(job);
     hal_enableIRQs();
     #if LMIC_DEBUG_LEVEL > 1
         if (res)
@@ -61,16 +196,20 @@ void os_clearCallback (osjob_t* job) {
 
 // schedule immediately runnable job
 void os_setCallback (osjob_t* job, osjobcb_t cb) {
-    osjob_t** pnext;
+    os_setCallbackPrio(job, OSJOB_PRIO_APP, cb);
+}
+
+void os_setCallbackPrio (osjob_t* job, u1_t prio, osjobcb_t cb) {
     hal_disableIRQs();
     // remove if job was already queued
     os_clearCallback(job);
     // fill-in job
     job->func = cb;
-    job->next = NULL;
+    job->prio = prio;
+    job->runnable = 1;
+    job->deadline = (ostime_t)OS.seq++;
     // add to end of run queue
-    for(pnext=&OS.runnablejobs; *pnext; pnext=&((*pnext)->next));
-    *pnext = job;
+    linkjob(job);
     hal_enableIRQs();
     #if LMIC_DEBUG_LEVEL > 1
         lmic_printf("%lu: Scheduled job %p, cb %p ASAP\n", os_getTime(), job, cb);
@@ -79,29 +218,76 @@ void os_setCallback (osjob_t* job, osjobcb_t cb) {
 
 // schedule timed job
 void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
-    osjob_t** pnext;
+    os_setTimedCallbackPrio(job, OSJOB_PRIO_APP, time, cb);
+}
+
+void os_setTimedCallbackPrio (osjob_t* job, u1_t prio, ostime_t time, osjobcb_t cb) {
     hal_disableIRQs();
     // remove if job was already queued
     os_clearCallback(job);
     // fill-in job
     job->deadline = time;
     job->func = cb;
-    job->next = NULL;
+    job->prio = prio;
+    job->runnable = 0;
     // insert into schedule
-    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
-        if((*pnext)->deadline - time > 0) { // (cmp diff, not abs!)
-            // enqueue before next element and stop
-            job->next = *pnext;
-            break;
-        }
-    }
-    *pnext = job;
+    linkjob(job);
     hal_enableIRQs();
     #if LMIC_DEBUG_LEVEL > 1
         lmic_printf("%lu: Scheduled job %p, cb %p at %lu\n", os_getTime(), job, cb, time);
     #endif
 }
 
+#if defined(LMIC_OS_STATS)
+static void count (u2_t* counter) {
+    if(*counter != 0xFFFF)
+        (*counter)++;
+}
+
+// add a time to a histogram (see struct os_stats_t)
+static void record (u2_t* hist, ostime_t* max, ostime_t t) {
+    u1_t b = 0;
+    while(b < OS_STATS_BUCKETS-1 && t >= ((ostime_t)1 << 2*b))
+        b++;
+    count(&hist[b]);
+    if(t > *max)
+        *max = t;
+}
+
+static void recordJob (osjobcb_t func, bit_t timed, ostime_t deadline, ostime_t start) {
+    ostime_t end = os_getTime();
+    struct os_funcstats_t* fs = OS.stats.funcs;
+    while(fs < OS.stats.funcs + OS_STATS_FUNCS && fs->func && fs->func != func)
+        fs++;
+    if(fs == OS.stats.funcs + OS_STATS_FUNCS) {
+        count(&OS.stats.otherRuns);
+        return;
+    }
+    fs->func = func;
+    count(&fs->runs);
+    if(timed)
+        record(fs->late, &fs->maxLate, start - deadline);
+    record(fs->runtime, &fs->maxRuntime, end - start);
+}
+
+void os_noteIrqOff (ostime_t ticks) {
+    if(ticks > OS.stats.maxIrqOff)
+        OS.stats.maxIrqOff = ticks;
+}
+
+void os_getStats (struct os_stats_t* stats) {
+    hal_disableIRQs();
+    *stats = OS.stats;
+    hal_enableIRQs();
+}
+
+void os_resetStats () {
+    hal_disableIRQs();
+    memset(&OS.stats, 0, sizeof(OS.stats));
+    hal_enableIRQs();
+}
+#endif // defined(LMIC_OS_STATS)
+
 // execute jobs from timer and from run queue
 void os_runloop () {
     while(1) {
@@ -114,25 +300,104 @@ void os_runloop_once() {
         bool has_deadline = false;
     #endif
     osjob_t* j = NULL;
+#if defined(LMIC_PRECOMPUTE_AES)
+    bit_t precompute = 0;
+#endif
     hal_disableIRQs();
-    // check for runnable jobs
-    if(OS.runnablejobs) {
-        j = OS.runnablejobs;
-        OS.runnablejobs = j->next;
-    } else if(OS.scheduledjobs && hal_checkTimer(OS.scheduledjobs->deadline)) { // check for expired timed jobs
-        j = OS.scheduledjobs;
-        OS.scheduledjobs = j->next;
+    // Starting with the highest priority, look for a runnable or
+    // expired job. Within a priority, runnable jobs come first (see
+    // jobBefore). Remember the earliest timed job to wake up for.
+    ostime_t now = os_getTime();
+    osjob_t* next = NULL;
+    for(u1_t p = OSJOB_NUM_PRIOS; p-- > 0 && !j; ) {
+        osjob_t* first = OS.jobs[p];
+        if(!first)
+            continue;
+        if(first->runnable || first->deadline - now <= 0)
+            j = first;
+        else if(!next || first->deadline - next->deadline < 0)
+            next = first;
+    }
+    if(!j && next && hal_checkTimer(next->deadline)) // check for expired timed jobs
+        j = next;
+    if(j) {
+        unlinkjob(j);
         #if LMIC_DEBUG_LEVEL > 1
-            has_deadline = true;
+            has_deadline = !j->runnable;
         #endif
+        if(!j->runnable && j->prio > OSJOB_PRIO_APP && os_getTime() - j->deadline > OS_LATE_TICKS) {
+            // Started too late for the radio, e.g. because an application
+            // job ran too long
+            OS.latejobs++;
+            #if LMIC_DEBUG_LEVEL > 0
+                lmic_printf("%lu: Job %p started %ld ticks late\n", os_getTime(), j, (long)(os_getTime() - j->deadline));
+            #endif
+        }
     } else { // nothing pending
+#if defined(LMIC_PRECOMPUTE_AES)
+        // Use the idle time to prepare the crypto for the next frames
+        // first, and only sleep once there is nothing left to do
+        precompute = LMIC_precomputePending();
+        if(!precompute)
+#endif
         hal_sleep(); // wake by irq (timer already restarted)
     }
+#if defined(LMIC_OS_STATS)
+    // the callback might queue the job again, so save these first
+    osjobcb_t func = j ? j->func : NULL;
+    bit_t timed = j && !j->runnable;
+    ostime_t deadline = j ? j->deadline : 0;
+#endif
     hal_enableIRQs();
     if(j) { // run job callback
         #if LMIC_DEBUG_LEVEL > 1
             lmic_printf("%lu: Running job %p, cb %p, deadline %lu\n", os_getTime(), j, j->func, has_deadline ? j->deadline : 0);
         #endif
+#if defined(LMIC_OS_STATS)
+        ostime_t start = os_getTime();
+        j->func(j);
+        recordJob(func, timed, deadline, start);
+#else
         j->func(j);
+#endif
     }
+#if defined(LMIC_PRECOMPUTE_AES)
+    else if(precompute)
+        LMIC_precompute();
+#endif
+}
+
+// number of high priority jobs that started more than OS_LATE_TICKS
+// after their deadline
+u2_t os_getLateJobs () {
+    return OS.latejobs;
+}
+
+#if defined(LMIC_MULTI_INSTANCE)
+// Context variants, these select the given instance and then do the
+// same as their regular counterparts.
+void os_init_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    os_init();
+}
+
+void os_runloop_once_ctx (lmic_ctx_t* ctx) {
+    lmic_ctx = ctx;
+    os_runloop_once();
+}
+
+void os_setCallback_ctx (lmic_ctx_t* ctx, osjob_t* job, osjobcb_t cb) {
+    lmic_ctx = ctx;
+    os_setCallback(job, cb);
+}
+
+void os_setTimedCallback_ctx (lmic_ctx_t* ctx, osjob_t* job, ostime_t time, osjobcb_t cb) {
+    lmic_ctx = ctx;
+    os_setTimedCallback(job, time, cb);
+}
+
+void os_clearCallback_ctx (lmic_ctx_t* ctx, osjob_t* job) {
+    lmic_ctx = ctx;
+    os_clearCallback(job);
 }
+#endif // defined(LMIC_MULTI_INSTANCE)
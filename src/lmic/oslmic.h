@@ -77,15 +77,33 @@ extern u4_t AESKEY[];
 
 u1_t radio_rand1 (void);
 #define os_getRndU1() radio_rand1()
+#if defined(LMIC_SAVE_RAND_SEED)
+void radio_saveRandSeed (void);
+#endif
 
+#if defined(LMIC_MULTI_INSTANCE)
+// With multiple instances, all state of an LMIC instance lives in a
+// struct lmic_ctx_t (see lmic.h) and LMIC refers to the currently
+// selected instance.
+typedef struct lmic_ctx_t lmic_ctx_t;
+#define DEFINE_LMIC  lmic_ctx_t* lmic_ctx
+#define DECLARE_LMIC extern lmic_ctx_t* lmic_ctx
+#define LMIC         (lmic_ctx->lmic)
+#else
 #define DEFINE_LMIC  struct lmic_t LMIC
 #define DECLARE_LMIC extern struct lmic_t LMIC
+#endif
 
 void radio_init (void);
 void radio_irq_handler (u1_t dio);
 void os_init (void);
 void os_runloop (void);
 void os_runloop_once (void);
+#if defined(LMIC_MULTI_INSTANCE)
+// Variants of the above that select the given instance first
+void os_init_ctx (lmic_ctx_t* ctx);
+void os_runloop_once_ctx (lmic_ctx_t* ctx);
+#endif
 
 //================================================================================
 
@@ -105,6 +123,21 @@ void os_runloop_once (void);
 
 typedef s4_t  ostime_t;
 
+// Like radio_irq_handler, for HALs that record when the DIO pin went
+// high themselves.
+void radio_irq_handler_at (u1_t dio, ostime_t when);
+#if defined(LMIC_RX_TIMER)
+// Called by the HAL when the timer set with hal_setRxTimer expires
+void radio_rxtimer_handler (void);
+#endif
+#if defined(LMIC_CALIBRATE)
+// Timing calibration kept by the radio driver (see LMIC_CALIBRATE in
+// config.h), and the measurements lmic.c feeds it.
+struct lmic_calib_t* radio_calib (void);
+void radio_calibrateTx (ostime_t needed);
+void radio_calibrateRxDone (ostime_t error);
+#endif
+
 #if !HAS_ostick_conv
 #define us2osticks(us)   ((ostime_t)( ((int64_t)(us) * OSTICKS_PER_SEC) / 1000000))
 #define ms2osticks(ms)   ((ostime_t)( ((int64_t)(ms) * OSTICKS_PER_SEC)    / 1000))
@@ -122,12 +155,66 @@ typedef s4_t  ostime_t;
 struct osjob_t;  // fwd decl.
 typedef void (*osjobcb_t) (struct osjob_t*);
 struct osjob_t {
-    struct osjob_t* next;
-    ostime_t deadline;
+    struct osjob_t* parent; // job queue links (see oslmic.c)
+    struct osjob_t* left;
+    struct osjob_t* right;
+    ostime_t deadline;  // or sequence number for runnable jobs
     osjobcb_t  func;
+    u1_t     runnable;
+    u1_t     prio;      // one of OSJOB_PRIO_*
+    u2_t     pos;       // position in the queue
 };
 TYPEDEF_xref2osjob_t;
 
+// Job priorities. When jobs of different priorities are due, the higher
+// one runs first. The MAC schedules its (timing critical) jobs at
+// OSJOB_PRIO_MAC, os_setCallback and os_setTimedCallback use
+// OSJOB_PRIO_APP.
+enum { OSJOB_PRIO_APP, OSJOB_PRIO_MAC, OSJOB_NUM_PRIOS };
+
+// Scheduler state. Every priority has its own queue of jobs, kept as a
+// binary heap linked through the jobs, so any number of jobs can be
+// queued. Runnable jobs sort before all timed jobs, in the order they
+// were queued, timed jobs sort by deadline.
+#if defined(LMIC_OS_STATS)
+// Scheduler statistics, see os_getStats(). Times are in ticks and go
+// into histogram buckets by powers of four: bucket 0 counts 0 ticks,
+// bucket i counts 4^(i-1) up to 4^i - 1 ticks, and the last bucket
+// everything above that. Counters stop at 0xFFFF.
+#define OS_STATS_BUCKETS 8
+#define OS_STATS_FUNCS   8
+
+struct os_funcstats_t {
+    osjobcb_t func;      // callback, NULL for an unused entry
+    u2_t      runs;
+    u2_t      late[OS_STATS_BUCKETS];    // deadline to start, timed jobs only
+    u2_t      runtime[OS_STATS_BUCKETS]; // time spent in the callback
+    ostime_t  maxLate;
+    ostime_t  maxRuntime;
+};
+
+struct os_stats_t {
+    // One entry per callback function, in order of first run
+    struct os_funcstats_t funcs[OS_STATS_FUNCS];
+    // Runs of callbacks that did not fit in funcs
+    u2_t     otherRuns;
+    // Longest time interrupts were disabled, excluding hal_sleep()
+    ostime_t maxIrqOff;
+    // Most jobs queued at the same time
+    u2_t     maxQueued;
+};
+#endif // defined(LMIC_OS_STATS)
+
+struct osstate_t {
+    osjob_t* jobs[OSJOB_NUM_PRIOS]; // root of every queue
+    u2_t     njobs[OSJOB_NUM_PRIOS];
+    u4_t     seq;
+    u2_t     latejobs;
+#if defined(LMIC_OS_STATS)
+    struct os_stats_t stats;
+#endif
+};
+
 
 #ifndef HAS_os_calls
 
@@ -149,6 +236,22 @@ void os_setTimedCallback (xref2osjob_t job, ostime_t time, osjobcb_t cb);
 #ifndef os_clearCallback
 void os_clearCallback (xref2osjob_t job);
 #endif
+#ifndef os_setCallbackPrio
+void os_setCallbackPrio (xref2osjob_t job, u1_t prio, osjobcb_t cb);
+#endif
+#ifndef os_setTimedCallbackPrio
+void os_setTimedCallbackPrio (xref2osjob_t job, u1_t prio, ostime_t time, osjobcb_t cb);
+#endif
+#ifndef os_getLateJobs
+u2_t os_getLateJobs (void);
+#endif
+#if defined(LMIC_OS_STATS)
+void os_getStats (struct os_stats_t* stats);
+void os_resetStats (void);
+// Called by the HAL when it enables interrupts again after they were
+// disabled for the given number of ticks
+void os_noteIrqOff (ostime_t ticks);
+#endif
 #ifndef os_getTime
 ostime_t os_getTime (void);
 #endif
@@ -197,6 +300,12 @@ u2_t os_crc16 (xref2u1_t d, uint len);
 
 #endif // !HAS_os_calls
 
+#if defined(LMIC_MULTI_INSTANCE)
+void os_setCallback_ctx (lmic_ctx_t* ctx, xref2osjob_t job, osjobcb_t cb);
+void os_setTimedCallback_ctx (lmic_ctx_t* ctx, xref2osjob_t job, ostime_t time, osjobcb_t cb);
+void os_clearCallback_ctx (lmic_ctx_t* ctx, xref2osjob_t job);
+#endif
+
 // ======================================================================
 // Table support
 // These macros for defining a table of constants and retrieving values
@@ -281,6 +390,73 @@ extern xref2u1_t AESaux;
 u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len);
 #endif
 
+// Reentrant AES API. Unlike os_aes, which passes the key and aux block
+// through the global AESkey and AESaux buffers, all state is kept in
+// structs owned by the caller, so multiple LMIC instances or threads
+// can use it at the same time. os_aes itself is implemented on top of
+// this.
+
+// An expanded AES-128 key (all 11 round keys). Expanding a key takes
+// about as long as encrypting a block, so keys that are used often
+// (like the session keys) are better expanded only once. The layout of
+// the round keys depends on the AES implementation. The bitsliced one
+// needs eight native words per round key, the others 16 bytes.
+#if defined(USE_BITSLICE_AES)
+#define AES_KEY_WORDS (11 * 8)
+#else
+#define AES_KEY_WORDS (11 * 16 / sizeof(uintptr_t))
+#endif
+typedef struct {
+    uintptr_t rk[AES_KEY_WORDS];
+    u1_t k1[16];   // CMAC subkey K1, see lmic_aes_cmac_prepare
+    u1_t k1valid;
+} aes_key_t;
+void lmic_aes_setkey (aes_key_t* key, xref2cu1_t raw);
+
+// Encrypt len bytes in place, block by block. len must be a multiple
+// of 16, anything else fails an ASSERT.
+void lmic_aes_ecb (const aes_key_t* key, xref2u1_t buf, u2_t len);
+
+// RFC4493 AES-CMAC. The message can be passed in pieces through any
+// number of update calls. final returns the first four bytes of the
+// CMAC as an MSBF number (i.e. the LoRaWAN MIC); the full CMAC is left
+// in x.
+typedef struct {
+    const aes_key_t* key;
+    u1_t             x[16];  // chaining value, xored with the pending block
+    u1_t             n;      // number of bytes in the pending block
+} lmic_aes_cmac_t;
+void lmic_aes_cmac_init (lmic_aes_cmac_t* ctx, const aes_key_t* key);
+// Every CMAC needs the subkey K1, which costs an extra block encryption
+// to calculate. For keys used for many CMACs, this calculates it once
+// and stores it in the key, for use by every next lmic_aes_cmac_final.
+void lmic_aes_cmac_prepare (aes_key_t* key);
+void lmic_aes_cmac_update (lmic_aes_cmac_t* ctx, xref2cu1_t buf, u2_t len);
+u4_t lmic_aes_cmac_final (lmic_aes_cmac_t* ctx);
+
+// AES-CTR, as used by LoRaWAN: the last byte of the counter block is
+// incremented for every block. crypt encrypts or decrypts in place, and
+// can be called repeatedly as long as len is a multiple of 16 for all
+// but the last call.
+typedef struct {
+    const aes_key_t* key;
+    u1_t             ctr[16];  // next counter block
+} lmic_aes_ctr_t;
+void lmic_aes_ctr_init (lmic_aes_ctr_t* ctx, const aes_key_t* key, xref2cu1_t ctr);
+void lmic_aes_ctr_crypt (lmic_aes_ctr_t* ctx, xref2u1_t buf, u2_t len);
+
+// Multi-buffer variants, which run n independent contexts (usually with
+// different keys) in lockstep, so the block encryptions of up to
+// AES_MULTI of them can be interleaved (AES-NI) or run in parallel
+// lanes (bitsliced). Context i processes lens[i] bytes from bufs[i].
+// The results are the same as calling the single variants in a loop.
+// The table-based implementations do exactly that, so these only pay
+// off with USE_AESNI_AES or USE_BITSLICE_AES.
+#define AES_MULTI 4
+void lmic_aes_cmac_update_multi (lmic_aes_cmac_t* ctx, xref2cu1_t const* bufs, const u2_t* lens, u2_t n);
+void lmic_aes_cmac_final_multi (lmic_aes_cmac_t* ctx, u4_t* mics, u2_t n);
+void lmic_aes_ctr_crypt_multi (lmic_aes_ctr_t* ctx, xref2u1_t const* bufs, const u2_t* lens, u2_t n);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Interface between the chip independent part of the radio driver
+ * (radio.c: os_radio, the interrupt handler, the random generator and
+ * timing calibration) and the code for a specific radio chip. Exactly
+ * one chip driver is compiled in, selected in config.h:
+ *
+ *  - sx127x.c for CFG_sx1272_radio and CFG_sx1276_radio
+ *  - sx126x.c for CFG_sx1261_radio and CFG_sx1262_radio
+ *
+ * All of these are called with interrupts disabled.
+ *******************************************************************************/
+
+#ifndef _radio_h_
+#define _radio_h_
+
+#include "lmic.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#if defined(CFG_sx1272_radio) || defined(CFG_sx1276_radio)
+#define CFG_sx127x_radio 1
+#elif defined(CFG_sx1261_radio) || defined(CFG_sx1262_radio)
+#define CFG_sx126x_radio 1
+#else
+#error Missing CFG_sx1272_radio/CFG_sx1276_radio/CFG_sx1261_radio/CFG_sx1262_radio
+#endif
+
+enum { RXMODE_SINGLE, RXMODE_SCAN, RXMODE_RSSI };
+
+// Outcome of a radio interrupt, see radio_drv_irq
+enum { RADIO_IRQ_NONE, RADIO_IRQ_TXDONE, RADIO_IRQ_RXDONE, RADIO_IRQ_RXTIMEOUT };
+
+// Reset the radio and check that it is the expected chip. Leaves it in
+// sleep mode.
+void radio_drv_reset (void);
+
+// Start transmitting LMIC.frame (LMIC.dataLen bytes) with LMIC.freq,
+// LMIC.rps and LMIC.txpow.
+void radio_drv_tx (void);
+
+// Set up the receiver with LMIC.freq and LMIC.rps. RXMODE_SINGLE
+// leaves the radio waiting in standby, until radio_drv_rxstart starts
+// a single rx with a timeout of LMIC.rxsyms symbols. RXMODE_SCAN and
+// RXMODE_RSSI start continuous rx right away (RXMODE_RSSI with fixed
+// settings, to sample noise for radio_drv_noise).
+void radio_drv_rx (u1_t rxmode);
+void radio_drv_rxstart (void);
+
+// Put the radio to sleep, aborting whatever it is doing
+void radio_drv_sleep (void);
+
+// Find out why the radio raised an interrupt and acknowledge it. For
+// RADIO_IRQ_RXDONE, also fill LMIC.frame, LMIC.dataLen, LMIC.snr and
+// LMIC.rssi.
+u1_t radio_drv_irq (void);
+
+// Latency between the end of a frame on the air and the TxDone or
+// RxDone interrupt with the given radio parameters, in ticks
+ostime_t radio_drv_txdoneFixup (rps_t rps);
+ostime_t radio_drv_rxdoneFixup (rps_t rps);
+
+// Current RSSI in the raw format of the chip
+u1_t radio_drv_rssi (void);
+
+// Fill buf with random bits from the wideband noise RSSI. The radio
+// must be receiving in RXMODE_RSSI.
+void radio_drv_noise (u1_t* buf, u1_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _radio_h_
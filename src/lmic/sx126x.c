@@ -0,0 +1,433 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Arduino-LMIC contributors
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *******************************************************************************/
+
+// Driver for the SX1261 and SX1262, see radio.h. Unlike the SX127x,
+// these are controlled through commands instead of registers. Every
+// command goes through hal_spi_cmd(), which waits for the BUSY pin and
+// wakes the radio from sleep when needed. DIO1 signals all interrupts.
+
+#include "radio.h"
+
+#if defined(CFG_sx126x_radio)
+
+// ----------------------------------------
+// Commands
+#define CMD_SET_SLEEP                   0x84
+#define CMD_SET_STANDBY                 0x80
+#define CMD_SET_TX                      0x83
+#define CMD_SET_RX                      0x82
+#define CMD_SET_REGULATOR_MODE          0x96
+#define CMD_CALIBRATE                   0x89
+#define CMD_CALIBRATE_IMAGE             0x98
+#define CMD_SET_PA_CONFIG               0x95
+#define CMD_SET_DIO_IRQ_PARAMS          0x08
+#define CMD_GET_IRQ_STATUS              0x12
+#define CMD_CLR_IRQ_STATUS              0x02
+#define CMD_SET_DIO2_AS_RF_SWITCH_CTRL  0x9D
+#define CMD_SET_DIO3_AS_TCXO_CTRL       0x97
+#define CMD_SET_RF_FREQUENCY            0x86
+#define CMD_SET_PACKET_TYPE             0x8A
+#define CMD_SET_TX_PARAMS               0x8E
+#define CMD_SET_MODULATION_PARAMS       0x8B
+#define CMD_SET_PACKET_PARAMS           0x8C
+#define CMD_SET_BUFFER_BASE_ADDRESS     0x8F
+#define CMD_SET_LORA_SYMB_NUM_TIMEOUT   0xA0
+#define CMD_GET_RX_BUFFER_STATUS        0x13
+#define CMD_GET_PACKET_STATUS           0x14
+#define CMD_GET_RSSI_INST               0x15
+#define CMD_WRITE_REGISTER              0x0D
+#define CMD_READ_REGISTER               0x1D
+#define CMD_WRITE_BUFFER                0x0E
+#define CMD_READ_BUFFER                 0x1E
+
+// ----------------------------------------
+// Registers
+#define REG_WHITENING_INIT              0x06B8
+#define REG_CRC_INIT                    0x06BC
+#define REG_CRC_POLY                    0x06BE
+#define REG_FSK_SYNC_WORD               0x06C0
+#define REG_IQ_POLARITY                 0x0736
+#define REG_LORA_SYNC_WORD              0x0740
+#define REG_RANDOM                      0x0819
+#define REG_TX_MODULATION               0x0889
+
+// ----------------------------------------
+// Command arguments
+#define PACKET_TYPE_FSK                 0x00
+#define PACKET_TYPE_LORA                0x01
+
+#define STDBY_RC                        0x00
+#define SLEEP_WARM_START                0x04 // keep the configuration
+#define REGULATOR_DC_DC                 0x01
+#define CALIBRATE_ALL                   0x7F
+#define RAMP_40U                        0x02
+
+#define LORA_BW_125                     0x04
+#define LORA_BW_250                     0x05
+#define LORA_BW_500                     0x06
+
+#define IRQ_TXDONE                      0x0001
+#define IRQ_RXDONE                      0x0002
+#define IRQ_TIMEOUT                     0x0200
+
+// SetRx timeouts, in steps of 15.625 us
+#define RX_CONTINUOUS                   0xFFFFFF
+// The SX127x driver uses a preamble timeout of 255 * 16 bits (81.6 ms)
+#define FSK_RX_TIMEOUT                  5222
+
+// Public LoRaWAN network, 0x34 on the SX127x
+#define LORA_MAC_SYNC_WORD              0x34, 0x44
+
+// ----------------------------------------
+
+static void command (u1_t op, u1_t* args, u1_t len) {
+    hal_spi_cmd(&op, 1, args, len, 0);
+}
+
+// Get commands return a status byte before the data
+static void getCommand (u1_t op, u1_t* buf, u1_t len) {
+    u1_t cmd[2] = { op, 0x00 };
+    hal_spi_cmd(cmd, sizeof(cmd), buf, len, 1);
+}
+
+static void writeRegs (u2_t addr, u1_t* buf, u1_t len) {
+    u1_t cmd[3] = { CMD_WRITE_REGISTER, (u1_t)(addr >> 8), (u1_t)addr };
+    hal_spi_cmd(cmd, sizeof(cmd), buf, len, 0);
+}
+
+static void readRegs (u2_t addr, u1_t* buf, u1_t len) {
+    u1_t cmd[4] = { CMD_READ_REGISTER, (u1_t)(addr >> 8), (u1_t)addr, 0x00 };
+    hal_spi_cmd(cmd, sizeof(cmd), buf, len, 1);
+}
+
+static void writeReg (u2_t addr, u1_t data) {
+    writeRegs(addr, &data, 1);
+}
+
+static u1_t readReg (u2_t addr) {
+    u1_t data;
+    readRegs(addr, &data, 1);
+    return data;
+}
+
+static void setBit (u2_t addr, u1_t mask, bit_t on) {
+    u1_t v = readReg(addr);
+    writeReg(addr, on ? v | mask : v & ~mask);
+}
+
+static void standby () {
+    u1_t mode = STDBY_RC;
+    command(CMD_SET_STANDBY, &mode, 1);
+}
+
+static void setRx (u4_t timeout) {
+    u1_t t[3] = { (u1_t)(timeout >> 16), (u1_t)(timeout >> 8), (u1_t)timeout };
+    command(CMD_SET_RX, t, sizeof(t));
+}
+
+static void configChannel () {
+    // set frequency: Frf = freq * 2^25 / 32 MHz
+    u4_t frf = ((uint64_t)LMIC.freq << 25) / 32000000;
+    u1_t f[4] = { (u1_t)(frf >> 24), (u1_t)(frf >> 16), (u1_t)(frf >> 8), (u1_t)frf };
+    command(CMD_SET_RF_FREQUENCY, f, sizeof(f));
+}
+
+// configure LoRa modem and packet, len is the payload length for TX
+// and the maximum length for RX
+static void configLora (u1_t len, bit_t invertIq) {
+    u1_t type = PACKET_TYPE_LORA;
+    command(CMD_SET_PACKET_TYPE, &type, 1);
+
+    sf_t sf = getSf(LMIC.rps);
+    bw_t bw = getBw(LMIC.rps);
+    ASSERT(bw != BWrfu);
+    u1_t mod[4] = {
+        (u1_t)(sf + 6),                                          // SF7..SF12
+        bw == BW125 ? LORA_BW_125 : (bw == BW250 ? LORA_BW_250 : LORA_BW_500),
+        (u1_t)(getCr(LMIC.rps) + 1),                             // 4/5..4/8
+        (u1_t)((sf == SF11 || sf == SF12) && bw == BW125),       // low data rate optimize
+    };
+    command(CMD_SET_MODULATION_PARAMS, mod, sizeof(mod));
+
+    if (getIh(LMIC.rps))
+        len = getIh(LMIC.rps); // required length
+    u1_t pkt[6] = {
+        0x00, 0x08,                       // preamble length
+        (u1_t)(getIh(LMIC.rps) ? 1 : 0),  // implicit header
+        len,
+        (u1_t)(getNocrc(LMIC.rps) ? 0 : 1),
+        invertIq,
+    };
+    command(CMD_SET_PACKET_PARAMS, pkt, sizeof(pkt));
+    // work around the IQ polarity errata (datasheet 15.4)
+    setBit(REG_IQ_POLARITY, 0x04, !invertIq);
+
+    u1_t sync[2] = { LORA_MAC_SYNC_WORD };
+    writeRegs(REG_LORA_SYNC_WORD, sync, sizeof(sync));
+}
+
+// configure FSK modem and packet like the SX127x driver: 50 kbps,
+// +/- 25 kHz, 5 byte preamble, 3 byte sync word, variable length,
+// whitening and CCITT CRC
+static void configFsk (u1_t len) {
+    u1_t type = PACKET_TYPE_FSK;
+    command(CMD_SET_PACKET_TYPE, &type, 1);
+
+    u1_t mod[8] = {
+        0x00, 0x50, 0x00, // bitrate 32 * 32 MHz / 50 kbps
+        0x09,             // gaussian BT 0.5
+        0x0B,             // rx bandwidth 117.3 kHz
+        0x00, 0x66, 0x66, // fdev 25 kHz * 2^25 / 32 MHz
+    };
+    command(CMD_SET_MODULATION_PARAMS, mod, sizeof(mod));
+
+    u1_t pkt[9] = {
+        0x00, 0x28,       // preamble 40 bits
+        0x05,             // preamble detector 16 bits
+        0x18,             // sync word 24 bits
+        0x00,             // no address filtering
+        0x01,             // variable length
+        len,
+        0x06,             // 2 byte CRC, inverted
+        0x01,             // whitening
+    };
+    command(CMD_SET_PACKET_PARAMS, pkt, sizeof(pkt));
+
+    u1_t sync[3] = { 0xC1, 0x94, 0xC1 };
+    writeRegs(REG_FSK_SYNC_WORD, sync, sizeof(sync));
+    u1_t crc[4] = { 0x1D, 0x0F, 0x10, 0x21 }; // init, polynomial
+    writeRegs(REG_CRC_INIT, crc, sizeof(crc));
+    u1_t white[2] = { (u1_t)((readReg(REG_WHITENING_INIT) & 0xFE) | 0x01), 0xFF };
+    writeRegs(REG_WHITENING_INIT, white, sizeof(white));
+}
+
+static void configPower () {
+    s1_t pw = (s1_t)LMIC.txpow;
+#ifdef CFG_sx1262_radio
+    // high power PA, -9 to +22 dBm
+    u1_t pa[4] = { 0x04, 0x07, 0x00, 0x01 };
+    if(pw > 22) {
+        pw = 22;
+    } else if(pw < -9) {
+        pw = -9;
+    }
+#else
+    // low power PA, -17 to +14 dBm
+    u1_t pa[4] = { 0x04, 0x00, 0x01, 0x01 };
+    if(pw > 14) {
+        pw = 14;
+    } else if(pw < -17) {
+        pw = -17;
+    }
+#endif
+    command(CMD_SET_PA_CONFIG, pa, sizeof(pa));
+    u1_t tx[2] = { (u1_t)pw, RAMP_40U };
+    command(CMD_SET_TX_PARAMS, tx, sizeof(tx));
+}
+
+// route the given IRQs to DIO1 and clear all radio IRQ flags
+static void configIrq (u2_t mask) {
+    u1_t irq[8] = { (u1_t)(mask >> 8), (u1_t)mask, (u1_t)(mask >> 8), (u1_t)mask, 0, 0, 0, 0 };
+    command(CMD_SET_DIO_IRQ_PARAMS, irq, sizeof(irq));
+    u1_t clr[2] = { 0xFF, 0xFF };
+    command(CMD_CLR_IRQ_STATUS, clr, sizeof(clr));
+}
+
+// start transmitter (buf=LMIC.frame, len=LMIC.dataLen)
+void radio_drv_tx () {
+    standby();
+    if(getSf(LMIC.rps) == FSK) { // FSK modem
+        configFsk(LMIC.dataLen);
+    } else { // LoRa modem
+        configLora(LMIC.dataLen, 0);
+        // work around the BW500 modulation quality errata (datasheet 15.1)
+        setBit(REG_TX_MODULATION, 0x04, getBw(LMIC.rps) != BW500);
+    }
+    configChannel();
+    configPower();
+
+    // download buffer to the radio
+    u1_t base[2] = { 0x00, 0x00 }; // tx, rx
+    command(CMD_SET_BUFFER_BASE_ADDRESS, base, sizeof(base));
+    u1_t cmd[2] = { CMD_WRITE_BUFFER, 0x00 };
+    hal_spi_cmd(cmd, sizeof(cmd), LMIC.frame, LMIC.dataLen, 0);
+
+    configIrq(IRQ_TXDONE);
+
+    // enable antenna switch for TX
+    hal_pin_rxtx(1);
+
+    // now we actually start the transmission (without timeout)
+    u1_t timeout[3] = { 0, 0, 0 };
+    command(CMD_SET_TX, timeout, sizeof(timeout));
+
+#if LMIC_DEBUG_LEVEL > 0
+    lmic_printf("%lu: TXMODE, freq=%lu, len=%d, SF=%d\n",
+           os_getTime(), LMIC.freq, LMIC.dataLen,
+           getSf(LMIC.rps) == FSK ? 0 : getSf(LMIC.rps) + 6);
+#endif
+}
+
+// set up receiver (timeout=LMIC.rxsyms, result=LMIC.frame[LMIC.dataLen])
+void radio_drv_rx (u1_t rxmode) {
+    standby();
+    if(rxmode == RXMODE_RSSI) {
+        // the noise is sampled with the reset modem settings
+        u1_t type = PACKET_TYPE_LORA;
+        command(CMD_SET_PACKET_TYPE, &type, 1);
+    } else if(getSf(LMIC.rps) == FSK) {
+        configFsk(MAX_LEN_FRAME);
+        configChannel();
+    } else {
+#if !defined(DISABLE_INVERT_IQ_ON_RX)
+        // use inverted I/Q signal (prevent mote-to-mote communication)
+        configLora(MAX_LEN_FRAME, 1);
+#else
+        configLora(MAX_LEN_FRAME, 0);
+#endif
+        configChannel();
+        // set symbol timeout (for single rx)
+        u1_t syms = rxmode == RXMODE_SINGLE ? LMIC.rxsyms : 0;
+        command(CMD_SET_LORA_SYMB_NUM_TIMEOUT, &syms, 1);
+    }
+    u1_t base[2] = { 0x00, 0x00 }; // tx, rx
+    command(CMD_SET_BUFFER_BASE_ADDRESS, base, sizeof(base));
+
+    configIrq(rxmode == RXMODE_SINGLE ? IRQ_RXDONE|IRQ_TIMEOUT :
+              rxmode == RXMODE_SCAN ? IRQ_RXDONE : 0);
+
+    // enable antenna switch for RX
+    hal_pin_rxtx(0);
+
+    // single rx is started by radio_drv_rxstart at the exact rx time
+    if(rxmode != RXMODE_SINGLE) { // continous rx (scan or rssi)
+        setRx(RX_CONTINUOUS);
+    }
+
+#if LMIC_DEBUG_LEVEL > 0
+    lmic_printf("%lu: %s, freq=%lu, SF=%d\n", os_getTime(),
+           rxmode == RXMODE_SINGLE ? "RXMODE_SINGLE" : (rxmode == RXMODE_SCAN ? "RXMODE_SCAN" : "RXMODE_RSSI"),
+           LMIC.freq, getSf(LMIC.rps) == FSK ? 0 : getSf(LMIC.rps) + 6);
+#endif
+}
+
+void radio_drv_rxstart () {
+    // LoRa times out after LMIC.rxsyms symbols, see radio_drv_rx
+    setRx(getSf(LMIC.rps) == FSK ? FSK_RX_TIMEOUT : 0);
+}
+
+void radio_drv_sleep () {
+    u1_t cfg = SLEEP_WARM_START;
+    command(CMD_SET_SLEEP, &cfg, 1);
+}
+
+// fill buf with random bits from the random number generator, which
+// samples the wideband noise while receiving
+void radio_drv_noise (u1_t* buf, u1_t len) {
+    u1_t rnd[4];
+    for(u1_t i=0; i<len; i++) {
+        if( (i & 3) == 0 )
+            readRegs(REG_RANDOM, rnd, sizeof(rnd));
+        buf[i] = rnd[i & 3];
+    }
+}
+
+void radio_drv_reset () {
+    // manually reset radio
+    hal_pin_rst(0); // drive NRESET pin low
+    hal_waitUntil(os_getTime()+ms2osticks(1)); // wait >100us
+    hal_pin_rst(2); // configure NRESET pin floating!
+    // hal_spi_cmd waits until the radio has started up
+
+    // some sanity checks, e.g., read a register with a known reset value
+    u1_t sync[2];
+    readRegs(REG_LORA_SYNC_WORD, sync, sizeof(sync));
+    ASSERT(sync[0] == 0x14 && sync[1] == 0x24);
+
+    standby();
+    u1_t arg;
+#if defined(LMIC_SX126X_TCXO)
+    // power the TCXO from DIO3, allowing 5 ms to start, and calibrate
+    // again with it running
+    u1_t tcxo[4] = { LMIC_SX126X_TCXO, 0x00, 0x01, 0x40 };
+    command(CMD_SET_DIO3_AS_TCXO_CTRL, tcxo, sizeof(tcxo));
+    arg = CALIBRATE_ALL;
+    command(CMD_CALIBRATE, &arg, 1);
+#endif
+#if !defined(LMIC_SX126X_LDO)
+    arg = REGULATOR_DC_DC;
+    command(CMD_SET_REGULATOR_MODE, &arg, 1);
+#endif
+#if defined(LMIC_SX126X_DIO2_RFSWITCH)
+    arg = 1;
+    command(CMD_SET_DIO2_AS_RF_SWITCH_CTRL, &arg, 1);
+#endif
+#if defined(CFG_eu868)
+    // the image calibration after reset is for 902-928 MHz
+    u1_t band[2] = { 0xD7, 0xDB }; // 863-870 MHz
+    command(CMD_CALIBRATE_IMAGE, band, sizeof(band));
+#endif
+    (void)arg;
+
+    radio_drv_sleep();
+}
+
+u1_t radio_drv_rssi () {
+    u1_t rssi; // -2 * RSSI [dBm]
+    getCommand(CMD_GET_RSSI_INST, &rssi, 1);
+    return rssi;
+}
+
+// The TxDone and RxDone latencies were not measured for these radios,
+// LMIC_CALIBRATE can learn the latter
+ostime_t radio_drv_txdoneFixup (rps_t rps) {
+    (void)rps;
+    return 0;
+}
+
+ostime_t radio_drv_rxdoneFixup (rps_t rps) {
+    (void)rps;
+    return 0;
+}
+
+u1_t radio_drv_irq () {
+    u1_t ev = RADIO_IRQ_NONE;
+    u1_t buf[3];
+    getCommand(CMD_GET_IRQ_STATUS, buf, 2);
+    u2_t flags = (buf[0] << 8) | buf[1];
+#if LMIC_DEBUG_LEVEL > 1
+    lmic_printf("%lu: irq: flags: 0x%x\n", os_getTime(), flags);
+#endif
+    if( flags & IRQ_TXDONE ) {
+        ev = RADIO_IRQ_TXDONE;
+    } else if( flags & IRQ_RXDONE ) {
+        ev = RADIO_IRQ_RXDONE;
+        // read the PDU and inform the MAC that we received something
+        getCommand(CMD_GET_RX_BUFFER_STATUS, buf, 2); // length, start
+        LMIC.dataLen = buf[0] > MAX_LEN_FRAME ? MAX_LEN_FRAME : buf[0];
+        u1_t cmd[3] = { CMD_READ_BUFFER, buf[1], 0x00 };
+        hal_spi_cmd(cmd, sizeof(cmd), LMIC.frame, LMIC.dataLen, 1);
+        // read rx quality parameters
+        if( getSf(LMIC.rps) != FSK ) {
+            getCommand(CMD_GET_PACKET_STATUS, buf, 3);
+            LMIC.snr  = (s1_t)buf[1];   // SNR [dB] * 4
+            LMIC.rssi = 96 - buf[0]/2;  // RSSI [dBm] + 96, as the SX127x driver
+        } else {
+            LMIC.snr  = 0; // determine snr
+            LMIC.rssi = 0; // determine rssi
+        }
+    } else if( flags & IRQ_TIMEOUT ) {
+        ev = RADIO_IRQ_RXTIMEOUT;
+    }
+    // clear radio IRQ flags
+    u1_t clr[2] = { 0xFF, 0xFF };
+    command(CMD_CLR_IRQ_STATUS, clr, sizeof(clr));
+    return ev;
+}
+
+#endif // defined(CFG_sx126x_radio)
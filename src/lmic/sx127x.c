@@ -0,0 +1,865 @@
+/*******************************************************************************
+ * Copyright (c) 2014-2015 IBM Corporation.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Contributors:
+ *    IBM Zurich Research Lab - initial API, implementation and documentation
+ *******************************************************************************/
+
+// Driver for the SX1272 and SX1276 families, see radio.h
+
+#include "radio.h"
+
+#if defined(CFG_sx127x_radio)
+
+// ----------------------------------------
+// Registers Mapping
+#define RegFifo                                    0x00 // common
+#define RegOpMode                                  0x01 // common
+#define FSKRegBitrateMsb                           0x02
+#define FSKRegBitrateLsb                           0x03
+#define FSKRegFdevMsb                              0x04
+#define FSKRegFdevLsb                              0x05
+#define RegFrfMsb                                  0x06 // common
+#define RegFrfMid                                  0x07 // common
+#define RegFrfLsb                                  0x08 // common
+#define RegPaConfig                                0x09 // common
+#define RegPaRamp                                  0x0A // common
+#define RegOcp                                     0x0B // common
+#define RegLna                                     0x0C // common
+#define FSKRegRxConfig                             0x0D
+#define LORARegFifoAddrPtr                         0x0D
+#define FSKRegRssiConfig                           0x0E
+#define LORARegFifoTxBaseAddr                      0x0E
+#define FSKRegRssiCollision                        0x0F
+#define LORARegFifoRxBaseAddr                      0x0F
+#define FSKRegRssiThresh                           0x10
+#define LORARegFifoRxCurrentAddr                   0x10
+#define FSKRegRssiValue                            0x11
+#define LORARegIrqFlagsMask                        0x11
+#define FSKRegRxBw                                 0x12
+#define LORARegIrqFlags                            0x12
+#define FSKRegAfcBw                                0x13
+#define LORARegRxNbBytes                           0x13
+#define FSKRegOokPeak                              0x14
+#define LORARegRxHeaderCntValueMsb                 0x14
+#define FSKRegOokFix                               0x15
+#define LORARegRxHeaderCntValueLsb                 0x15
+#define FSKRegOokAvg                               0x16
+#define LORARegRxPacketCntValueMsb                 0x16
+#define LORARegRxpacketCntValueLsb                 0x17
+#define LORARegModemStat                           0x18
+#define LORARegPktSnrValue                         0x19
+#define FSKRegAfcFei                               0x1A
+#define LORARegPktRssiValue                        0x1A
+#define FSKRegAfcMsb                               0x1B
+#define LORARegRssiValue                           0x1B
+#define FSKRegAfcLsb                               0x1C
+#define LORARegHopChannel                          0x1C
+#define FSKRegFeiMsb                               0x1D
+#define LORARegModemConfig1                        0x1D
+#define FSKRegFeiLsb                               0x1E
+#define LORARegModemConfig2                        0x1E
+#define FSKRegPreambleDetect                       0x1F
+#define LORARegSymbTimeoutLsb                      0x1F
+#define FSKRegRxTimeout1                           0x20
+#define LORARegPreambleMsb                         0x20
+#define FSKRegRxTimeout2                           0x21
+#define LORARegPreambleLsb                         0x21
+#define FSKRegRxTimeout3                           0x22
+#define LORARegPayloadLength                       0x22
+#define FSKRegRxDelay                              0x23
+#define LORARegPayloadMaxLength                    0x23
+#define FSKRegOsc                                  0x24
+#define LORARegHopPeriod                           0x24
+#define FSKRegPreambleMsb                          0x25
+#define LORARegFifoRxByteAddr                      0x25
+#define LORARegModemConfig3                        0x26
+#define FSKRegPreambleLsb                          0x26
+#define FSKRegSyncConfig                           0x27
+#define LORARegFeiMsb                              0x28
+#define FSKRegSyncValue1                           0x28
+#define LORAFeiMib                                 0x29
+#define FSKRegSyncValue2                           0x29
+#define LORARegFeiLsb                              0x2A
+#define FSKRegSyncValue3                           0x2A
+#define FSKRegSyncValue4                           0x2B
+#define LORARegRssiWideband                        0x2C
+#define FSKRegSyncValue5                           0x2C
+#define FSKRegSyncValue6                           0x2D
+#define FSKRegSyncValue7                           0x2E
+#define FSKRegSyncValue8                           0x2F
+#define FSKRegPacketConfig1                        0x30
+#define FSKRegPacketConfig2                        0x31
+#define LORARegDetectOptimize                      0x31
+#define FSKRegPayloadLength                        0x32
+#define FSKRegNodeAdrs                             0x33
+#define LORARegInvertIQ                            0x33
+#define FSKRegBroadcastAdrs                        0x34
+#define FSKRegFifoThresh                           0x35
+#define FSKRegSeqConfig1                           0x36
+#define FSKRegSeqConfig2                           0x37
+#define LORARegDetectionThreshold                  0x37
+#define FSKRegTimerResol                           0x38
+#define FSKRegTimer1Coef                           0x39
+#define LORARegSyncWord                            0x39
+#define FSKRegTimer2Coef                           0x3A
+#define FSKRegImageCal                             0x3B
+#define FSKRegTemp                                 0x3C
+#define FSKRegLowBat                               0x3D
+#define FSKRegIrqFlags1                            0x3E
+#define FSKRegIrqFlags2                            0x3F
+#define RegDioMapping1                             0x40 // common
+#define RegDioMapping2                             0x41 // common
+#define RegVersion                                 0x42 // common
+// #define RegAgcRef                                  0x43 // common
+// #define RegAgcThresh1                              0x44 // common
+// #define RegAgcThresh2                              0x45 // common
+// #define RegAgcThresh3                              0x46 // common
+// #define RegPllHop                                  0x4B // common
+// #define RegTcxo                                    0x58 // common
+#define RegPaDac                                   0x5A // common
+// #define RegPll                                     0x5C // common
+// #define RegPllLowPn                                0x5E // common
+// #define RegFormerTemp                              0x6C // common
+// #define RegBitRateFrac                             0x70 // common
+
+// ----------------------------------------
+// spread factors and mode for RegModemConfig2
+#define SX1272_MC2_FSK  0x00
+#define SX1272_MC2_SF7  0x70
+#define SX1272_MC2_SF8  0x80
+#define SX1272_MC2_SF9  0x90
+#define SX1272_MC2_SF10 0xA0
+#define SX1272_MC2_SF11 0xB0
+#define SX1272_MC2_SF12 0xC0
+// bandwidth for RegModemConfig1
+#define SX1272_MC1_BW_125  0x00
+#define SX1272_MC1_BW_250  0x40
+#define SX1272_MC1_BW_500  0x80
+// coding rate for RegModemConfig1
+#define SX1272_MC1_CR_4_5 0x08
+#define SX1272_MC1_CR_4_6 0x10
+#define SX1272_MC1_CR_4_7 0x18
+#define SX1272_MC1_CR_4_8 0x20
+#define SX1272_MC1_IMPLICIT_HEADER_MODE_ON 0x04 // required for receive
+#define SX1272_MC1_RX_PAYLOAD_CRCON        0x02
+#define SX1272_MC1_LOW_DATA_RATE_OPTIMIZE  0x01 // mandated for SF11 and SF12
+// transmit power configuration for RegPaConfig
+#define SX1272_PAC_PA_SELECT_PA_BOOST 0x80
+#define SX1272_PAC_PA_SELECT_RFIO_PIN 0x00
+
+
+// sx1276 RegModemConfig1
+#define SX1276_MC1_BW_125                0x70
+#define SX1276_MC1_BW_250                0x80
+#define SX1276_MC1_BW_500                0x90
+#define SX1276_MC1_CR_4_5            0x02
+#define SX1276_MC1_CR_4_6            0x04
+#define SX1276_MC1_CR_4_7            0x06
+#define SX1276_MC1_CR_4_8            0x08
+
+#define SX1276_MC1_IMPLICIT_HEADER_MODE_ON    0x01
+
+// sx1276 RegModemConfig2
+#define SX1276_MC2_RX_PAYLOAD_CRCON        0x04
+
+// sx1276 RegModemConfig3
+#define SX1276_MC3_LOW_DATA_RATE_OPTIMIZE  0x08
+#define SX1276_MC3_AGCAUTO                 0x04
+
+// preamble for lora networks (nibbles swapped)
+#define LORA_MAC_PREAMBLE                  0x34
+
+#define RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG1 0x0A
+#ifdef CFG_sx1276_radio
+#define RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG2 0x70
+#elif CFG_sx1272_radio
+#define RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG2 0x74
+#endif
+
+
+
+// ----------------------------------------
+// Constants for radio registers
+#define OPMODE_LORA      0x80
+#define OPMODE_MASK      0x07
+#define OPMODE_SLEEP     0x00
+#define OPMODE_STANDBY   0x01
+#define OPMODE_FSTX      0x02
+#define OPMODE_TX        0x03
+#define OPMODE_FSRX      0x04
+#define OPMODE_RX        0x05
+#define OPMODE_RX_SINGLE 0x06
+#define OPMODE_CAD       0x07
+
+// ----------------------------------------
+// Bits masking the corresponding IRQs from the radio
+#define IRQ_LORA_RXTOUT_MASK 0x80
+#define IRQ_LORA_RXDONE_MASK 0x40
+#define IRQ_LORA_CRCERR_MASK 0x20
+#define IRQ_LORA_HEADER_MASK 0x10
+#define IRQ_LORA_TXDONE_MASK 0x08
+#define IRQ_LORA_CDDONE_MASK 0x04
+#define IRQ_LORA_FHSSCH_MASK 0x02
+#define IRQ_LORA_CDDETD_MASK 0x01
+
+#define IRQ_FSK1_MODEREADY_MASK         0x80
+#define IRQ_FSK1_RXREADY_MASK           0x40
+#define IRQ_FSK1_TXREADY_MASK           0x20
+#define IRQ_FSK1_PLLLOCK_MASK           0x10
+#define IRQ_FSK1_RSSI_MASK              0x08
+#define IRQ_FSK1_TIMEOUT_MASK           0x04
+#define IRQ_FSK1_PREAMBLEDETECT_MASK    0x02
+#define IRQ_FSK1_SYNCADDRESSMATCH_MASK  0x01
+#define IRQ_FSK2_FIFOFULL_MASK          0x80
+#define IRQ_FSK2_FIFOEMPTY_MASK         0x40
+#define IRQ_FSK2_FIFOLEVEL_MASK         0x20
+#define IRQ_FSK2_FIFOOVERRUN_MASK       0x10
+#define IRQ_FSK2_PACKETSENT_MASK        0x08
+#define IRQ_FSK2_PAYLOADREADY_MASK      0x04
+#define IRQ_FSK2_CRCOK_MASK             0x02
+#define IRQ_FSK2_LOWBAT_MASK            0x01
+
+// ----------------------------------------
+// DIO function mappings                D0D1D2D3
+#define MAP_DIO0_LORA_RXDONE   0x00  // 00------
+#define MAP_DIO0_LORA_TXDONE   0x40  // 01------
+#define MAP_DIO1_LORA_RXTOUT   0x00  // --00----
+#define MAP_DIO1_LORA_NOP      0x30  // --11----
+#define MAP_DIO2_LORA_NOP      0x0C  // ----11--
+
+#define MAP_DIO0_FSK_READY     0x00  // 00------ (packet sent / payload ready)
+#define MAP_DIO1_FSK_NOP       0x30  // --11----
+#define MAP_DIO2_FSK_TXNOP     0x04  // ----01--
+#define MAP_DIO2_FSK_TIMEOUT   0x08  // ----10--
+
+
+// FSK IMAGECAL defines
+#define RF_IMAGECAL_AUTOIMAGECAL_MASK               0x7F
+#define RF_IMAGECAL_AUTOIMAGECAL_ON                 0x80
+#define RF_IMAGECAL_AUTOIMAGECAL_OFF                0x00  // Default
+
+#define RF_IMAGECAL_IMAGECAL_MASK                   0xBF
+#define RF_IMAGECAL_IMAGECAL_START                  0x40
+
+#define RF_IMAGECAL_IMAGECAL_RUNNING                0x20
+#define RF_IMAGECAL_IMAGECAL_DONE                   0x00  // Default
+
+
+// RADIO STATE
+// (forgotten by radio_drv_reset())
+#if defined(LMIC_MULTI_INSTANCE)
+#define regcache (lmic_ctx->regcache)
+#else
+static struct radio_regcache_t regcache;
+#endif
+
+
+#ifdef CFG_sx1276_radio
+#define LNA_RX_GAIN (0x20|0x1)
+#elif CFG_sx1272_radio
+#define LNA_RX_GAIN (0x20|0x03)
+#endif
+
+
+// Returns the regcache slot for the given register, or NOT_CACHED.
+// Only configuration registers that the radio never changes by itself
+// can be cached, with the exception of RegOpMode (see writeReg).
+#define NOT_CACHED 0xFF
+static u1_t cacheSlot (u1_t addr) {
+    switch (addr) {
+    case RegOpMode:               return 0;
+    case RegFrfMsb:               return 1;
+    case RegFrfMid:               return 2;
+    case RegFrfLsb:               return 3;
+    case RegPaConfig:             return 4;
+    case RegPaRamp:               return 5;
+    case RegLna:                  return 6;
+    case RegDioMapping1:          return 7;
+    case RegPaDac:                return 8;
+    case LORARegModemConfig1:     return 9;
+    case LORARegModemConfig2:     return 10;
+    case LORARegModemConfig3:     return 11;
+    case LORARegSyncWord:         return 12;
+    case LORARegIrqFlagsMask:     return 13;
+    case LORARegPayloadMaxLength: return 14;
+    case LORARegInvertIQ:         return 15;
+    case LORARegSymbTimeoutLsb:   return 16;
+    default:                      return NOT_CACHED;
+    }
+}
+
+static bit_t cacheHit (u1_t slot, u1_t data) {
+    return slot != NOT_CACHED && (regcache.valid & ((u4_t)1 << slot)) && regcache.val[slot] == data;
+}
+
+static void cacheStore (u1_t addr, u1_t data) {
+    u1_t slot = cacheSlot(addr);
+    if (slot == NOT_CACHED)
+        return;
+    if (addr == RegOpMode && (!(regcache.valid & 1) || ((regcache.val[0] ^ data) & OPMODE_LORA))) {
+        // Most registers above RegLna have a different meaning
+        // in LoRa and FSK mode, so forget everything when switching.
+        regcache.valid = 0;
+    }
+    regcache.val[slot] = data;
+    regcache.valid |= ((u4_t)1 << slot);
+}
+
+static void writeReg (u1_t addr, u1_t data ) {
+    // The mode bits of RegOpMode change when TX or RX completes, so
+    // that is always written.
+    if (addr != RegOpMode && cacheHit(cacheSlot(addr), data))
+        return;
+    hal_spi_write(addr | 0x80, &data, 1);
+    cacheStore(addr, data);
+}
+
+static u1_t readReg (u1_t addr) {
+    u1_t val;
+    hal_spi_read(addr & 0x7F, &val, 1);
+    return val;
+}
+
+// Like readReg, but uses the cached value if there is one. For
+// RegOpMode, only the bits outside of OPMODE_MASK can be trusted.
+static u1_t readRegCached (u1_t addr) {
+    u1_t slot = cacheSlot(addr);
+    if (slot != NOT_CACHED && (regcache.valid & ((u4_t)1 << slot)))
+        return regcache.val[slot];
+    u1_t val = readReg(addr);
+    cacheStore(addr, val);
+    return val;
+}
+
+// Writes len bytes to the FIFO, or to len consecutive registers
+// starting at addr, in a single transaction. A register block is
+// skipped when all of it is cached and unchanged.
+static void writeBuf (u1_t addr, xref2cu1_t buf, u1_t len) {
+    if (addr != RegFifo) {
+        u1_t i;
+        for (i = 0; i < len && cacheHit(cacheSlot(addr + i), buf[i]); i++)
+            ;
+        if (i == len)
+            return;
+    }
+    hal_spi_write(addr | 0x80, buf, len);
+    if (addr != RegFifo) {
+        for (u1_t i = 0; i < len; i++)
+            cacheStore(addr + i, buf[i]);
+    }
+}
+
+static void readBuf (u1_t addr, xref2u1_t buf, u1_t len) {
+    hal_spi_read(addr & 0x7F, buf, len);
+}
+
+static void opmode (u1_t mode) {
+    writeReg(RegOpMode, (readRegCached(RegOpMode) & ~OPMODE_MASK) | mode);
+}
+
+static void opmodeLora() {
+    u1_t u = OPMODE_LORA;
+#ifdef CFG_sx1276_radio
+    u |= 0x8;   // TBD: sx1276 high freq
+#endif
+    writeReg(RegOpMode, u);
+}
+
+static void opmodeFSK() {
+    u1_t u = 0;
+#ifdef CFG_sx1276_radio
+    u |= 0x8;   // TBD: sx1276 high freq
+#endif
+    writeReg(RegOpMode, u);
+}
+
+// configure LoRa modem (cfg1, cfg2)
+static void configLoraModem () {
+    sf_t sf = getSf(LMIC.rps);
+
+#ifdef CFG_sx1276_radio
+        u1_t mc1 = 0, mc2 = 0, mc3 = 0;
+
+        switch (getBw(LMIC.rps)) {
+        case BW125: mc1 |= SX1276_MC1_BW_125; break;
+        case BW250: mc1 |= SX1276_MC1_BW_250; break;
+        case BW500: mc1 |= SX1276_MC1_BW_500; break;
+        default:
+            ASSERT(0);
+        }
+        switch( getCr(LMIC.rps) ) {
+        case CR_4_5: mc1 |= SX1276_MC1_CR_4_5; break;
+        case CR_4_6: mc1 |= SX1276_MC1_CR_4_6; break;
+        case CR_4_7: mc1 |= SX1276_MC1_CR_4_7; break;
+        case CR_4_8: mc1 |= SX1276_MC1_CR_4_8; break;
+        default:
+            ASSERT(0);
+        }
+
+        if (getIh(LMIC.rps)) {
+            mc1 |= SX1276_MC1_IMPLICIT_HEADER_MODE_ON;
+            writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
+        }
+        mc2 = (SX1272_MC2_SF7 + ((sf-1)<<4));
+        if (getNocrc(LMIC.rps) == 0) {
+            mc2 |= SX1276_MC2_RX_PAYLOAD_CRCON;
+        }
+        // set ModemConfig1 and ModemConfig2
+        u1_t mc[2] = { mc1, mc2 };
+        writeBuf(LORARegModemConfig1, mc, sizeof(mc));
+
+        mc3 = SX1276_MC3_AGCAUTO;
+        if ((sf == SF11 || sf == SF12) && getBw(LMIC.rps) == BW125) {
+            mc3 |= SX1276_MC3_LOW_DATA_RATE_OPTIMIZE;
+        }
+        writeReg(LORARegModemConfig3, mc3);
+#elif CFG_sx1272_radio
+        u1_t mc1 = (getBw(LMIC.rps)<<6);
+
+        switch( getCr(LMIC.rps) ) {
+        case CR_4_5: mc1 |= SX1272_MC1_CR_4_5; break;
+        case CR_4_6: mc1 |= SX1272_MC1_CR_4_6; break;
+        case CR_4_7: mc1 |= SX1272_MC1_CR_4_7; break;
+        case CR_4_8: mc1 |= SX1272_MC1_CR_4_8; break;
+        }
+
+        if ((sf == SF11 || sf == SF12) && getBw(LMIC.rps) == BW125) {
+            mc1 |= SX1272_MC1_LOW_DATA_RATE_OPTIMIZE;
+        }
+
+        if (getNocrc(LMIC.rps) == 0) {
+            mc1 |= SX1272_MC1_RX_PAYLOAD_CRCON;
+        }
+
+        if (getIh(LMIC.rps)) {
+            mc1 |= SX1272_MC1_IMPLICIT_HEADER_MODE_ON;
+            writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
+        }
+        // set ModemConfig1 and ModemConfig2 (sf, AgcAutoOn=1 SymbTimeoutHi=00)
+        u1_t mc[2] = { mc1, (u1_t)((SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x04) };
+        writeBuf(LORARegModemConfig1, mc, sizeof(mc));
+#endif /* CFG_sx1272_radio */
+}
+
+static void configChannel () {
+    // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
+    uint64_t frf = ((uint64_t)LMIC.freq << 19) / 32000000;
+    u1_t regs[3] = { (u1_t)(frf>>16), (u1_t)(frf>> 8), (u1_t)(frf>> 0) };
+    writeBuf(RegFrfMsb, regs, sizeof(regs));
+}
+
+
+
+static void configPower () {
+#ifdef CFG_sx1276_radio
+    // no boost used for now
+    s1_t pw = (s1_t)LMIC.txpow;
+    if(pw >= 17) {
+        pw = 15;
+    } else if(pw < 2) {
+        pw = 2;
+    }
+    // check board type for BOOST pin
+    writeReg(RegPaConfig, (u1_t)(0x80|(pw&0xf)));
+    writeReg(RegPaDac, readRegCached(RegPaDac)|0x4);
+
+#elif CFG_sx1272_radio
+    // set PA config (2-17 dBm using PA_BOOST)
+    s1_t pw = (s1_t)LMIC.txpow;
+    if(pw > 17) {
+        pw = 17;
+    } else if(pw < 2) {
+        pw = 2;
+    }
+    writeReg(RegPaConfig, (u1_t)(0x80|(pw-2)));
+#endif /* CFG_sx1272_radio */
+}
+
+// FSK register blocks shared by TX and RX
+static const u1_t fskBitrateFdev[] = {
+    0x02, 0x80,       // FSKRegBitrate: 50kbps
+    0x01, 0x99,       // FSKRegFdev: +/- 25kHz
+};
+static const u1_t fskSync[] = {
+    0x12,             // FSKRegSyncConfig
+    0xC1, 0x94, 0xC1, // FSKRegSyncValue1-3
+};
+
+static void txfsk () {
+    // select FSK modem (from sleep mode)
+    writeReg(RegOpMode, 0x10); // FSK, BT=0.5
+    ASSERT(readReg(RegOpMode) == 0x10);
+    // enter standby mode (required for FIFO loading))
+    opmode(OPMODE_STANDBY);
+    // set bitrate and frequency deviation
+    writeBuf(FSKRegBitrateMsb, fskBitrateFdev, sizeof(fskBitrateFdev));
+    // frame and packet handler settings
+    writeReg(FSKRegPreambleMsb, 0x00);
+    writeReg(FSKRegPreambleLsb, 0x05);
+    writeBuf(FSKRegSyncConfig, fskSync, sizeof(fskSync));
+    static const u1_t packetconfig[] = { 0xD0, 0x40 };
+    writeBuf(FSKRegPacketConfig1, packetconfig, sizeof(packetconfig));
+    // configure frequency
+    configChannel();
+    // configure output power
+    configPower();
+
+    // set the IRQ mapping DIO0=PacketSent DIO1=NOP DIO2=NOP
+    writeReg(RegDioMapping1, MAP_DIO0_FSK_READY|MAP_DIO1_FSK_NOP|MAP_DIO2_FSK_TXNOP);
+
+    // initialize the payload size and address pointers
+    writeReg(FSKRegPayloadLength, LMIC.dataLen+1); // (insert length byte into payload))
+
+    // download length byte and buffer to the radio FIFO
+    writeReg(RegFifo, LMIC.dataLen);
+    writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+
+    // enable antenna switch for TX
+    hal_pin_rxtx(1);
+
+    // now we actually start the transmission
+    opmode(OPMODE_TX);
+}
+
+static void txlora () {
+    // select LoRa modem (from sleep mode)
+    //writeReg(RegOpMode, OPMODE_LORA);
+    opmodeLora();
+    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+
+    // enter standby mode (required for FIFO loading))
+    opmode(OPMODE_STANDBY);
+    // configure LoRa modem (cfg1, cfg2)
+    configLoraModem();
+    // configure frequency
+    configChannel();
+    // configure output power
+    writeReg(RegPaRamp, (readRegCached(RegPaRamp) & 0xF0) | 0x08); // set PA ramp-up time 50 uSec
+    configPower();
+    // set sync word
+    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+
+    // set the IRQ mapping DIO0=TxDone DIO1=NOP DIO2=NOP
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    // mask all IRQs but TxDone and clear all radio IRQ flags
+    u1_t irq[2] = { (u1_t)~IRQ_LORA_TXDONE_MASK, 0xFF };
+    writeBuf(LORARegIrqFlagsMask, irq, sizeof(irq));
+
+    // initialize the payload size and address pointers
+    u1_t ptrs[2] = { 0x00, 0x00 }; // FifoAddrPtr, FifoTxBaseAddr
+    writeBuf(LORARegFifoAddrPtr, ptrs, sizeof(ptrs));
+    writeReg(LORARegPayloadLength, LMIC.dataLen);
+
+    // download buffer to the radio FIFO
+    writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+
+    // enable antenna switch for TX
+    hal_pin_rxtx(1);
+
+    // now we actually start the transmission
+    opmode(OPMODE_TX);
+
+#if LMIC_DEBUG_LEVEL > 0
+    u1_t sf = getSf(LMIC.rps) + 6; // 1 == SF7
+    u1_t bw = getBw(LMIC.rps);
+    u1_t cr = getCr(LMIC.rps);
+    lmic_printf("%lu: TXMODE, freq=%lu, len=%d, SF=%d, BW=%d, CR=4/%d, IH=%d\n",
+           os_getTime(), LMIC.freq, LMIC.dataLen, sf,
+           bw == BW125 ? 125 : (bw == BW250 ? 250 : 500),
+           cr == CR_4_5 ? 5 : (cr == CR_4_6 ? 6 : (cr == CR_4_7 ? 7 : 8)),
+           getIh(LMIC.rps)
+   );
+#endif
+}
+
+// start transmitter (buf=LMIC.frame, len=LMIC.dataLen)
+void radio_drv_tx () {
+    ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+    if(getSf(LMIC.rps) == FSK) { // FSK modem
+        txfsk();
+    } else { // LoRa modem
+        txlora();
+    }
+    // the radio will go back to STANDBY mode as soon as the TX is finished
+    // the corresponding IRQ will inform us about completion.
+}
+
+static CONST_TABLE(u1_t, rxlorairqmask)[] = {
+    [RXMODE_SINGLE] = IRQ_LORA_RXDONE_MASK|IRQ_LORA_RXTOUT_MASK,
+    [RXMODE_SCAN]   = IRQ_LORA_RXDONE_MASK,
+    [RXMODE_RSSI]   = 0x00,
+};
+
+static CONST_TABLE(u2_t, LORA_RXDONE_FIXUP)[] = {
+    [FSK]  =     us2osticks(0), // (   0 ticks)
+    [SF7]  =     us2osticks(0), // (   0 ticks)
+    [SF8]  =  us2osticks(1648), // (  54 ticks)
+    [SF9]  =  us2osticks(3265), // ( 107 ticks)
+    [SF10] =  us2osticks(7049), // ( 231 ticks)
+    [SF11] = us2osticks(13641), // ( 447 ticks)
+    [SF12] = us2osticks(31189), // (1022 ticks)
+};
+
+// start LoRa receiver (time=LMIC.rxtime, timeout=LMIC.rxsyms, result=LMIC.frame[LMIC.dataLen])
+static void rxlora (u1_t rxmode) {
+    // select LoRa modem (from sleep mode)
+    opmodeLora();
+    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    // enter standby mode (warm up))
+    opmode(OPMODE_STANDBY);
+    // don't use MAC settings at startup
+    if(rxmode == RXMODE_RSSI) { // use fixed settings for rssi scan
+        writeReg(LORARegModemConfig1, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG1);
+        writeReg(LORARegModemConfig2, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG2);
+    } else { // single or continuous rx mode
+        // configure LoRa modem (cfg1, cfg2)
+        configLoraModem();
+        // configure frequency
+        configChannel();
+    }
+    // set LNA gain
+    writeReg(RegLna, LNA_RX_GAIN);
+    // set max payload size
+    writeReg(LORARegPayloadMaxLength, 64);
+#if !defined(DISABLE_INVERT_IQ_ON_RX)
+    // use inverted I/Q signal (prevent mote-to-mote communication)
+    writeReg(LORARegInvertIQ, readRegCached(LORARegInvertIQ)|(1<<6));
+#endif
+    // set symbol timeout (for single rx)
+    writeReg(LORARegSymbTimeoutLsb, LMIC.rxsyms);
+    // set sync word
+    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+
+    // configure DIO mapping DIO0=RxDone DIO1=RxTout DIO2=NOP
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_RXDONE|MAP_DIO1_LORA_RXTOUT|MAP_DIO2_LORA_NOP);
+    // enable required radio IRQs and clear all radio IRQ flags
+    u1_t irq[2] = { (u1_t)~TABLE_GET_U1(rxlorairqmask, rxmode), 0xFF };
+    writeBuf(LORARegIrqFlagsMask, irq, sizeof(irq));
+
+    // enable antenna switch for RX
+    hal_pin_rxtx(0);
+
+    // now instruct the radio to receive, single rx is started by
+    // radio_drv_rxstart at the exact rx time
+    if (rxmode != RXMODE_SINGLE) { // continous rx (scan or rssi)
+        opmode(OPMODE_RX);
+    }
+
+#if LMIC_DEBUG_LEVEL > 0
+    if (rxmode == RXMODE_RSSI) {
+        lmic_printf("RXMODE_RSSI\n");
+    } else {
+        u1_t sf = getSf(LMIC.rps) + 6; // 1 == SF7
+        u1_t bw = getBw(LMIC.rps);
+        u1_t cr = getCr(LMIC.rps);
+        lmic_printf("%lu: %s, freq=%lu, SF=%d, BW=%d, CR=4/%d, IH=%d\n",
+               os_getTime(),
+               rxmode == RXMODE_SINGLE ? "RXMODE_SINGLE" : (rxmode == RXMODE_SCAN ? "RXMODE_SCAN" : "UNKNOWN_RX"),
+               LMIC.freq, sf,
+               bw == BW125 ? 125 : (bw == BW250 ? 250 : 500),
+               cr == CR_4_5 ? 5 : (cr == CR_4_6 ? 6 : (cr == CR_4_7 ? 7 : 8)),
+               getIh(LMIC.rps)
+       );
+    }
+#endif
+}
+
+static void rxfsk (u1_t rxmode) {
+    // only single rx (no continuous scanning, no noise sampling)
+    ASSERT( rxmode == RXMODE_SINGLE );
+    // select FSK modem (from sleep mode)
+    //writeReg(RegOpMode, 0x00); // (not LoRa)
+    opmodeFSK();
+    ASSERT((readReg(RegOpMode) & OPMODE_LORA) == 0);
+    // enter standby mode (warm up))
+    opmode(OPMODE_STANDBY);
+    // configure frequency
+    configChannel();
+    // set LNA gain
+    //writeReg(RegLna, 0x20|0x03); // max gain, boost enable
+    writeReg(RegLna, LNA_RX_GAIN);
+    // configure receiver
+    writeReg(FSKRegRxConfig, 0x1E); // AFC auto, AGC, trigger on preamble?!?
+    // set receiver and AFC bandwidth
+    static const u1_t bw[] = {
+        0x0B, // FSKRegRxBw: 50kHz SSb
+        0x12, // FSKRegAfcBw: 83.3kHz SSB
+    };
+    writeBuf(FSKRegRxBw, bw, sizeof(bw));
+    // set preamble detection
+    writeReg(FSKRegPreambleDetect, 0xAA); // enable, 2 bytes, 10 chip errors
+    // set sync config (no auto restart, preamble 0xAA, enable, fill
+    // FIFO, 3 bytes sync) and sync value
+    writeBuf(FSKRegSyncConfig, fskSync, sizeof(fskSync));
+    // set packet config
+    static const u1_t packetconfig[] = {
+        0xD8, // var-length, whitening, crc, no auto-clear, no adr filter
+        0x40, // packet mode
+    };
+    writeBuf(FSKRegPacketConfig1, packetconfig, sizeof(packetconfig));
+    // set preamble timeout
+    writeReg(FSKRegRxTimeout2, 0xFF);//(LMIC.rxsyms+1)/2);
+    // set bitrate and frequency deviation
+    writeBuf(FSKRegBitrateMsb, fskBitrateFdev, sizeof(fskBitrateFdev));
+
+    // configure DIO mapping DIO0=PayloadReady DIO1=NOP DIO2=TimeOut
+    writeReg(RegDioMapping1, MAP_DIO0_FSK_READY|MAP_DIO1_FSK_NOP|MAP_DIO2_FSK_TIMEOUT);
+
+    // enable antenna switch for RX
+    hal_pin_rxtx(0);
+
+    // the receiver is started by radio_drv_rxstart at the exact rx time
+}
+
+void radio_drv_rx (u1_t rxmode) {
+    ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+    if(rxmode != RXMODE_RSSI && getSf(LMIC.rps) == FSK) { // FSK modem
+        rxfsk(rxmode);
+    } else { // LoRa modem
+        rxlora(rxmode);
+    }
+    // the radio will go back to STANDBY mode as soon as the RX is finished
+    // or timed out, and the corresponding IRQ will inform us about completion.
+}
+
+void radio_drv_rxstart () {
+    if( (readRegCached(RegOpMode) & OPMODE_LORA) != 0 ) {
+        opmode(OPMODE_RX_SINGLE);
+    } else {
+        opmode(OPMODE_RX); // no single rx mode available in FSK
+    }
+}
+
+void radio_drv_sleep () {
+    opmode(OPMODE_SLEEP);
+}
+
+// fill buf with random bits from the wideband noise rssi
+void radio_drv_noise (u1_t* buf, u1_t len) {
+    while( (readReg(RegOpMode) & OPMODE_MASK) != OPMODE_RX ); // continuous rx
+    for(u1_t i=0; i<len; i++) {
+        for(int j=0; j<8; j++) {
+            u1_t b; // wait for two non-identical subsequent least-significant bits
+            while( (b = readReg(LORARegRssiWideband) & 0x01) == (readReg(LORARegRssiWideband) & 0x01) );
+            buf[i] = (buf[i] << 1) | b;
+        }
+    }
+}
+
+void radio_drv_reset () {
+    // forget all cached registers, the reset restores their defaults
+    regcache.valid = 0;
+
+    // manually reset radio
+#ifdef CFG_sx1276_radio
+    hal_pin_rst(0); // drive RST pin low
+#else
+    hal_pin_rst(1); // drive RST pin high
+#endif
+    hal_waitUntil(os_getTime()+ms2osticks(1)); // wait >100us
+    hal_pin_rst(2); // configure RST pin floating!
+    hal_waitUntil(os_getTime()+ms2osticks(5)); // wait 5ms
+
+    opmode(OPMODE_SLEEP);
+
+    // some sanity checks, e.g., read version number
+    u1_t v = readReg(RegVersion);
+#ifdef CFG_sx1276_radio
+    ASSERT(v == 0x12 );
+#elif CFG_sx1272_radio
+    ASSERT(v == 0x22);
+#endif
+
+#ifdef CFG_sx1276mb1_board
+    // chain calibration
+    writeReg(RegPaConfig, 0);
+
+    // Launch Rx chain calibration for LF band
+    writeReg(FSKRegImageCal, (readReg(FSKRegImageCal) & RF_IMAGECAL_IMAGECAL_MASK)|RF_IMAGECAL_IMAGECAL_START);
+    while((readReg(FSKRegImageCal)&RF_IMAGECAL_IMAGECAL_RUNNING) == RF_IMAGECAL_IMAGECAL_RUNNING){ ; }
+
+    // Sets a Frequency in HF band
+    u4_t frf = 868000000;
+    writeReg(RegFrfMsb, (u1_t)(frf>>16));
+    writeReg(RegFrfMid, (u1_t)(frf>> 8));
+    writeReg(RegFrfLsb, (u1_t)(frf>> 0));
+
+    // Launch Rx chain calibration for HF band
+    writeReg(FSKRegImageCal, (readReg(FSKRegImageCal) & RF_IMAGECAL_IMAGECAL_MASK)|RF_IMAGECAL_IMAGECAL_START);
+    while((readReg(FSKRegImageCal) & RF_IMAGECAL_IMAGECAL_RUNNING) == RF_IMAGECAL_IMAGECAL_RUNNING) { ; }
+
+    opmode(OPMODE_SLEEP);
+#endif /* CFG_sx1276mb1_board */
+}
+
+u1_t radio_drv_rssi () {
+    return readReg(LORARegRssiValue);
+}
+
+ostime_t radio_drv_txdoneFixup (rps_t rps) {
+    return getSf(rps) == FSK ? 0 : us2osticks(43);
+}
+
+ostime_t radio_drv_rxdoneFixup (rps_t rps) {
+    if( getSf(rps) == FSK || getBw(rps) != BW125 )
+        return 0;
+    return TABLE_GET_U2(LORA_RXDONE_FIXUP, getSf(rps));
+}
+
+u1_t radio_drv_irq () {
+    u1_t ev = RADIO_IRQ_NONE;
+    if( (readRegCached(RegOpMode) & OPMODE_LORA) != 0) { // LORA modem
+        u1_t flags = readReg(LORARegIrqFlags);
+#if LMIC_DEBUG_LEVEL > 1
+        lmic_printf("%lu: irq: flags: 0x%x\n", os_getTime(), flags);
+#endif
+        if( flags & IRQ_LORA_TXDONE_MASK ) {
+            ev = RADIO_IRQ_TXDONE;
+        } else if( flags & IRQ_LORA_RXDONE_MASK ) {
+            ev = RADIO_IRQ_RXDONE;
+            // read the PDU and inform the MAC that we received something
+            LMIC.dataLen = (readRegCached(LORARegModemConfig1) & SX1272_MC1_IMPLICIT_HEADER_MODE_ON) ?
+                readReg(LORARegPayloadLength) : readReg(LORARegRxNbBytes);
+            // set FIFO read address pointer
+            writeReg(LORARegFifoAddrPtr, readReg(LORARegFifoRxCurrentAddr));
+            // now read the FIFO
+            readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+            // read rx quality parameters
+            LMIC.snr  = readReg(LORARegPktSnrValue); // SNR [dB] * 4
+            LMIC.rssi = readReg(LORARegPktRssiValue) - 125 + 64; // RSSI [dBm] (-196...+63)
+        } else if( flags & IRQ_LORA_RXTOUT_MASK ) {
+            ev = RADIO_IRQ_RXTIMEOUT;
+        }
+        // mask all radio IRQs
+        writeReg(LORARegIrqFlagsMask, 0xFF);
+        // clear radio IRQ flags
+        writeReg(LORARegIrqFlags, 0xFF);
+    } else { // FSK modem
+        u1_t flags1 = readReg(FSKRegIrqFlags1);
+        u1_t flags2 = readReg(FSKRegIrqFlags2);
+        if( flags2 & IRQ_FSK2_PACKETSENT_MASK ) {
+            ev = RADIO_IRQ_TXDONE;
+        } else if( flags2 & IRQ_FSK2_PAYLOADREADY_MASK ) {
+            ev = RADIO_IRQ_RXDONE;
+            // read the PDU and inform the MAC that we received something
+            LMIC.dataLen = readReg(FSKRegPayloadLength);
+            // now read the FIFO
+            readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+            // read rx quality parameters
+            LMIC.snr  = 0; // determine snr
+            LMIC.rssi = 0; // determine rssi
+        } else if( flags1 & IRQ_FSK1_TIMEOUT_MASK ) {
+            ev = RADIO_IRQ_RXTIMEOUT;
+        } else {
+            ASSERT(0);
+        }
+    }
+    return ev;
+}
+
+#endif // defined(CFG_sx127x_radio)